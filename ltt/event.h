@@ -7,6 +7,7 @@
 #include <endian.h>
 #include <ltt/ltt.h>
 #include <ltt/time.h>
+#include <ltt/compiler.h>
 
 struct marker_field;
 
@@ -36,7 +37,13 @@ struct LttEvent {
 	LttTime event_time;
 
 	void *data;		/* event data */
-	GArray *fields_offsets; /* current field offsets table */
+	struct LttField *fields_offsets; /* current field offsets table : shared
+					    with the marker when its layout
+					    is static, NULL until the fields
+					    are read in lazy decoding mode */
+	GArray *dynamic_offsets;	/* Array of LttField owned by the event :
+					   its field offsets when its layout
+					   is dynamic */
 	guint data_size;
 	guint event_size;	/* event_size field of the header :
 				   used to verify data_size from marker. */
@@ -114,9 +121,14 @@ static inline LttCycleCount ltt_event_cycle_count(const LttEvent *e)
   return e->tsc;
 }
 
-static inline struct LttField *ltt_event_field(const LttEvent *e, int index)
+/* Compute the field offsets of an event read in lazy decoding mode */
+void ltt_event_resolve_fields(LttEvent *e);
+
+static inline struct LttField *ltt_event_field(LttEvent *e, int index)
 {
-	return &g_array_index(e->fields_offsets, struct LttField, index);
+	if (unlikely(e->fields_offsets == NULL))
+		ltt_event_resolve_fields(e);
+	return &e->fields_offsets[index];
 }
 
 #endif //_LTT_EVENT_H
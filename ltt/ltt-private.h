@@ -111,6 +111,28 @@ static inline size_t ltt_subbuffer_header_size(void)
 	return offsetof(ltt_subbuffer_header_t, header_end);
 }
 
+/*
+ * Block index entry : one per subbuffer of a tracefile. Values are kept in
+ * host byte order. The array is also what gets saved in the block index
+ * sidecar file, so any layout change must bump LTT_BLOCK_INDEX_VERSION.
+ */
+typedef struct _LttBlockIndex {
+  uint64_t offset;              /* Offset of the subbuffer in the file */
+  uint64_t cycle_count_begin;   /* Cycle count at subbuffer start */
+  uint64_t cycle_count_end;     /* Cycle count at subbuffer end */
+  uint32_t size;                /* Subbuffer size (sb_size) */
+  uint32_t events_lost;         /* Events lost since the beginning of trace */
+} LttBlockIndex;
+
+/*
+ * Block time entry : begin and end timestamps of a subbuffer, interpolated
+ * from the cycle counts of its block index entry.
+ */
+typedef struct _LttBlockTime {
+  LttTime begin;
+  LttTime end;
+} LttBlockTime;
+
 enum field_status { FIELD_UNKNOWN, FIELD_VARIABLE, FIELD_FIXED };
 
 typedef struct _LttBuffer {
@@ -146,6 +168,8 @@ struct LttTracefile {
   guint pgid;                         //Usertrace pgid, else 0
   guint64 creation;                   //Usertrace creation, else 0
   LttTrace * trace;                  //trace containing the tracefile
+  LttTracefile *handle;              //tracefile opened with the trace, whose
+                                     //tables its cursors share (itself then)
   struct marker_data *mdata;         // marker id/name/fields mapping
   int fd;                            //file descriptor 
   off_t file_size;                   //file size
@@ -157,6 +181,9 @@ struct LttTracefile {
                                      // 0 or the architecture size in bytes.
 
   size_t    buffer_header_size;
+  /* Event header decoder specialized for the tracefile byte order. Reads the
+   * header at the aligned position pos, returns the position of the payload */
+  void *(*read_event_header)(LttTracefile *tf, void *pos);
   uint8_t   tscbits;
   uint8_t   eventbits;
   uint64_t  tsc_mask;
@@ -164,13 +191,36 @@ struct LttTracefile {
   uint32_t  events_lost;
   uint32_t  subbuf_corrupt;
 
-  GArray *buf_index;                 /* index mapping buffer index to offset */
+  GArray *buf_index;                 /* Array of LttBlockIndex, indexed by
+                                        block number */
+  GArray *buf_time;                  /* Array of LttBlockTime, indexed by
+                                        block number, NULL until needed */
+  struct {                           /* Trace clock buf_time was built with */
+    guint32 freq_scale;
+    uint64_t start_freq;
+    double drift;
+    double offset;
+  } buf_time_clock;
 
   /* Current event */
   LttEvent event;                    //Event currently accessible in the trace
 
   /* Current block */
   LttBuffer buffer;                  //current buffer
+
+  /* Whole tracefile mapping mode (see ltt_tracefile_map_whole) */
+  void *map_head;                    //mapping window, NULL when blocks are
+                                     //mapped one at a time
+  uint64_t map_offset;               //file offset of the mapping window
+  size_t map_size;                   //size of the mapping window
+
+  guint readahead_next;              //first block not yet prefetched
+
+  struct decode_ahead *ahead;        //decode pipeline, NULL when the events
+                                     //are decoded by the reader
+
+  struct prev_cache *prev_cache;     //event offsets of the subbuffers read
+                                     //backward, NULL until needed
 };
 
 /* The characteristics of the system on which the trace was obtained
@@ -78,6 +78,8 @@ typedef struct LttSystemDescription LttSystemDescription;
 
 typedef struct LttEvent LttEvent;
 
+typedef struct LttEventBatch LttEventBatch;
+
 /* Checksums are used to differentiate facilities which have the same name
    but differ. */
 
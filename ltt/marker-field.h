@@ -20,10 +20,10 @@ enum ltt_type {
 };
 
 /*
- * Fields "offset" and "size" below are only valid while the event is being
- * read. They are also being shared with events of the same type coming from
- * other per-cpu tracefiles. Therefore, the "LttEvent" fields_offsets offset and
- * size should be used rather than these.
+ * Fields "offset" and "size" below are the layout computed from the marker
+ * format : they are not valid after the first string of the event. Therefore,
+ * the "LttEvent" fields_offsets offset and size should be used rather than
+ * these.
  */
 struct marker_field {
   GQuark name;
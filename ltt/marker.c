@@ -287,61 +287,84 @@ static inline long add_type(struct marker_info *info,
   }
 }
 
-long marker_update_fields_offsets(struct marker_info *info, const char *data)
+/*
+ * Lay out the fields of an event of a marker with a dynamic size in fields,
+ * which must hold one entry per field of the marker. Only the strings of the
+ * payload are scanned. Returns the size of the event payload.
+ */
+long marker_layout_event_fields(struct marker_info *info, const char *data,
+  struct LttField *fields)
 {
-  struct marker_field *field;
   unsigned int i;
-  long offset = 0;
-
-  /* Find the last field with a static offset, then update from there. */
-  for (i = info->fields->len - 1; i >= 0; i--) {
-    field = &g_array_index(info->fields, struct marker_field, i);
-    if (field->static_offset) {
-      offset = field->_offset;
-      break;
+  guint8 size;
+  long offset = info->dynamic_start;
+
+  memcpy(fields, info->static_offsets,
+         info->nb_static_fields * sizeof(struct LttField));
+
+  for (i = info->nb_static_fields; i < info->fields->len; i++) {
+    size = info->dynamic_layout[i - info->nb_static_fields];
+    if (size == 0) {
+      /* string */
+      fields[i].offset = offset;
+      fields[i].size = 0;
+      offset = offset + strlen(&data[offset]) + 1;
+      // not aligning on pointer size, breaking genevent backward compatibility.
+    } else {
+      /* integer types are aligned on their size */
+      offset += ltt_align(offset, size, info->alignment);
+      fields[i].offset = offset;
+      fields[i].size = size;
+      offset += size;
     }
   }
+  return offset;
+}
+
+/*
+ * Precompile the field layout of a marker from the fields parsed from its
+ * format. It is done only once per marker id : the events of static layout
+ * point to static_offsets.
+ */
+static void compile_layout(struct marker_info *info)
+{
+  struct marker_field *field;
+  unsigned int i, nb_fields = info->fields->len;
 
-  for (; i < info->fields->len; i++) {
-    field = &g_array_index(info->fields, struct marker_field, i);
+  g_assert(info->static_offsets == NULL);
+  info->static_offsets = g_new(struct LttField, nb_fields);
+  info->dynamic_layout = NULL;
 
+  for (i = 0; i < nb_fields; i++) {
+    field = marker_get_field(info, i);
+    if (field->type == LTT_TYPE_STRING)
+      break;
+    info->static_offsets[i].offset = field->_offset;
+    info->static_offsets[i].size = field->_size;
+  }
+  info->nb_static_fields = i;
+  if (i == nb_fields)
+    return;
+
+  g_assert(info->size == -1);
+  info->dynamic_start = field->_offset;
+  info->dynamic_layout = g_new(guint8, nb_fields - i);
+  for (; i < nb_fields; i++) {
+    field = marker_get_field(info, i);
     switch (field->type) {
     case LTT_TYPE_SIGNED_INT:
     case LTT_TYPE_UNSIGNED_INT:
     case LTT_TYPE_POINTER:
-      field->_offset = offset + ltt_align(offset, field->alignment,
-                                          info->alignment);
-      offset = field->_offset + field->_size;
+      g_assert(field->alignment == field->_size);
+      info->dynamic_layout[i - info->nb_static_fields] = field->_size;
       break;
     case LTT_TYPE_STRING:
-      field->_offset = offset;
-      offset = offset + strlen(&data[offset]) + 1;
-      // not aligning on pointer size, breaking genevent backward compatibility.
+      info->dynamic_layout[i - info->nb_static_fields] = 0;
       break;
     default:
       g_error("Unexpected type");
-      return -1;
     }
   }
-  return offset;
-}
-
-void marker_update_event_fields_offsets(GArray *fields_offsets,
-					struct marker_info *info)
-{
-  unsigned int i;
-
-  g_array_set_size(fields_offsets, info->fields->len);
-  for (i = 0; i < info->fields->len; i++) {
-    struct marker_field *mfield =
-      &g_array_index(info->fields, struct marker_field, i);
-    struct LttField *eventfield =
-      &g_array_index(fields_offsets, struct LttField, i);
-    eventfield->offset = mfield->_offset;
-    eventfield->size = mfield->_size;
-    g_assert(eventfield->offset != -1);
-    g_assert(eventfield->size != -1);
-  }
 }
 
 static void format_parse(const char *fmt, struct marker_info *info)
@@ -432,11 +455,13 @@ static void format_parse(const char *fmt, struct marker_info *info)
 
 int marker_parse_format(const char *format, struct marker_info *info)
 {
+  /* The format of a marker id does not change once parsed */
   if (info->fields)
-    g_array_free(info->fields, TRUE);
+    return 0;
   info->fields = g_array_sized_new(FALSE, TRUE,
                     sizeof(struct marker_field), DEFAULT_FIELDS_NUM);
   format_parse(format, info);
+  compile_layout(info);
   return 0;
 }
 
@@ -501,6 +526,14 @@ int marker_id_event(LttTrace *trace, GQuark channel, GQuark name, guint16 id,
     mdata->markers = g_array_set_size(mdata->markers,
       max(mdata->markers->len * 2, id + 1));
   info = &g_array_index(mdata->markers, struct marker_info, id);
+  if (info->name != 0) {
+    /* Registered already : its layout may be in use by events */
+    if (info->name != name)
+      g_error("Marker id %hu of channel %s used by %s and %s. Kernel issue.",
+        id, g_quark_to_string(channel), g_quark_to_string(info->name),
+        g_quark_to_string(name));
+    return 0;
+  }
   info->name = name;
   info->int_size = int_size;
   info->long_size = long_size;
@@ -508,6 +541,8 @@ int marker_id_event(LttTrace *trace, GQuark channel, GQuark name, guint16 id,
   info->size_t_size = size_t_size;
   info->alignment = alignment;
   info->fields = NULL;
+  info->static_offsets = NULL;
+  info->dynamic_layout = NULL;
   info->next = NULL;
   info->format = marker_get_format_from_name(mdata, name);
   info->largest_align = 1;
@@ -576,6 +611,8 @@ void destroy_marker_data(struct marker_data *data)
       }
       g_array_free(info->fields, TRUE);
     }
+    g_free(info->static_offsets);
+    g_free(info->dynamic_layout);
   }
   g_hash_table_destroy(data->markers_format_hash);
   g_hash_table_destroy(data->markers_hash);
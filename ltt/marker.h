@@ -20,6 +20,7 @@
 #define MARKER_CORE_IDS         8
 
 struct marker_info;
+struct LttField;
 
 struct marker_info {
   GQuark name;
@@ -33,6 +34,17 @@ struct marker_info {
                         done. Useful to encapsulate x86_32 events on
 			x86_64 kernels. */
   struct marker_info *next; /* Linked list of markers with the same name */
+
+  /*
+   * Precompiled field layout. The offsets of the fields preceding the first
+   * string are known statically. The fields starting at the first string are
+   * laid out for each event by marker_layout_event_fields.
+   */
+  struct LttField *static_offsets; /* Offsets and sizes of the static fields */
+  unsigned int nb_static_fields;
+  long dynamic_start;   /* Offset of the first string */
+  guint8 *dynamic_layout; /* Size of each field from the first string on,
+                             0 for strings. NULL when the size is static. */
 };
 
 struct marker_data {
@@ -116,6 +128,8 @@ int marker_format_event(LttTrace *trace, GQuark channel, GQuark name,
 int marker_id_event(LttTrace *trace, GQuark channel, GQuark name, guint16 id,
   uint8_t int_size, uint8_t long_size, uint8_t pointer_size,
   uint8_t size_t_size, uint8_t alignment);
+long marker_layout_event_fields(struct marker_info *info, const char *data,
+  struct LttField *fields);
 struct marker_data *allocate_marker_data(void);
 void destroy_marker_data(struct marker_data *data);
 
@@ -46,7 +46,18 @@ struct LttTrace {
   LttTime   start_time;
   LttTime   start_time_from_tsc;
 
+  /* Fixed point TSC to nanoseconds conversion (see ltt_trace_update_clock) :
+   * ns = ((tsc * tsc_mult) >> tsc_shift) + tsc_offset_ns */
+  uint64_t  tsc_mult;
+  guint32   tsc_shift;
+  int64_t   tsc_offset_ns;
+  gboolean  tsc_fixed;      /* FALSE when the ratio does not fit the fixed
+                               point format : the conversion uses doubles */
+
   GData     *tracefiles;                    //tracefiles groups
+  GPtrArray *metadata;                      //cursors of the metadata
+                                            //tracefiles, after the last
+                                            //marker registration read
 };
 
 static inline guint ltt_trace_get_num_cpu(LttTrace *t)
@@ -73,6 +84,21 @@ LttTrace *ltt_trace_open(const gchar *pathname);
  */
 LttTrace *ltt_trace_copy(LttTrace *self);
 
+/* Threading contract. A trace and the tracefiles opened with it hold the data
+ * shared by all the readers : file descriptors, block indexes, marker tables.
+ * Once ltt_trace_open returns they are only read, except by the functions
+ * changing the clock of the trace (ltt_trace_update_clock after
+ * synchronization) or growing the block indexes
+ * (ltt_tracefile_update_block_index), which must not run while the trace is
+ * being read.
+ *
+ * The position of a reader (mapped subbuffer, current event and timestamp
+ * counter state) is held by a cursor. Each tracefile of the trace is also its
+ * own cursor, and ltt_tracefile_cursor_new gives more. A cursor is used by one
+ * thread at a time, different cursors of a tracefile may be read by
+ * different threads at once. The toggles of the reader (ltt_event_debug,
+ * ltt_tracefile_map_whole...) must be set before reading starts. */
+
 static inline GQuark ltt_trace_name(const LttTrace *t)
 {
   return t->pathname;
@@ -137,6 +163,34 @@ static inline guint ltt_tracefile_block_number(LttTracefile *tf)
 }
 
 
+/* Follow a tracefile being written : index the subbuffers appended to it
+ * since its block index was built. A read which returned ERANGE at the end of
+ * the tracefile then goes on with the new events. Returns the number of new
+ * subbuffers, -1 on error. */
+
+int ltt_tracefile_update_block_index(LttTracefile *tf);
+
+/* End time of the last subbuffer indexed : the events the tracefile will
+ * still get once updated are later */
+
+LttTime ltt_tracefile_indexed_end_time(LttTracefile *tf);
+
+/* Follow a trace being written : read the marker registrations appended to
+ * its metadata tracefiles, so the events of the new markers can be decoded.
+ * It must be called before the block indexes of the other tracefiles are
+ * updated. Returns the number of new subbuffers of metadata, -1 on error. */
+
+int ltt_trace_update_metadata(LttTrace *t);
+
+/* Cursor on a tracefile, sharing its tables. It must be positioned by a seek
+ * before it is read, and be destroyed before the trace is closed. Positions
+ * may be used by any cursor of the same tracefile. A cursor keeps the
+ * number of subbuffers of the tracefile at its creation. */
+
+LttTracefile *ltt_tracefile_cursor_new(LttTracefile *tf);
+
+void ltt_tracefile_cursor_destroy(LttTracefile *cursor);
+
 /* Seek to the first event of the trace with time larger or equal to time */
 
 int ltt_tracefile_seek_time(LttTracefile *t, LttTime time);
@@ -150,6 +204,15 @@ int ltt_tracefile_seek_position(LttTracefile *t,
 
 int ltt_tracefile_read(LttTracefile *t);
 
+/* Read the previous event. The offsets of the events of the last subbuffers
+ * read backward are cached in the tracefile. */
+
+int ltt_tracefile_read_prev(LttTracefile *t);
+
+/* Seek after the last event : the next ltt_tracefile_read_prev returns it */
+
+int ltt_tracefile_seek_end(LttTracefile *t);
+
 /* ltt_tracefile_read cut down in pieces */
 int ltt_tracefile_read_seek(LttTracefile *t);
 int ltt_tracefile_read_update_event(LttTracefile *t);
@@ -158,6 +221,40 @@ int ltt_tracefile_read_op(LttTracefile *t);
 /* Get the current event of the tracefile : valid until the next read */
 LttEvent *ltt_tracefile_get_event(LttTracefile *tf);
 
+/* Events of a subbuffer decoded in bulk, stored as parallel arrays indexed by
+ * event number within the subbuffer. Payload offsets are relative to the
+ * beginning of the subbuffer : the payloads can be accessed until the
+ * tracefile is read again. (block, offset, tsc) is the position of each event,
+ * usable with ltt_event_position_set to seek back to it. */
+struct LttEventBatch {
+  LttTracefile *tracefile;
+  guint block;                /* Subbuffer decoded */
+  guint len;                  /* Number of events */
+  guint alloc;                /* Allocated length of the arrays */
+  guint64 *tsc;               /* Full timestamp counter */
+  LttTime *time;
+  guint16 *event_id;
+  guint32 *offset;            /* Event offset in the subbuffer */
+  guint32 *data_offset;       /* Payload offset in the subbuffer */
+  guint32 *data_size;         /* Payload size */
+  guint32 *event_size;        /* Size given by the event header */
+  guint next;                 /* Next event of ltt_tracefile_read_batched */
+};
+
+LttEventBatch *ltt_event_batch_new(void);
+void ltt_event_batch_destroy(LttEventBatch *batch);
+
+/* Decode all the events of a subbuffer into batch. The tracefile is left at
+ * the end of the subbuffer : ltt_tracefile_read then returns the first event
+ * of the next one. */
+int ltt_tracefile_read_block_batch(LttTracefile *tf, guint block_num,
+    LttEventBatch *batch);
+
+/* Same as ltt_tracefile_read, the events being decoded a subbuffer at a time
+ * into batch, which is kept from one read to the next. The tracefile may be
+ * seeked between two reads. */
+int ltt_tracefile_read_batched(LttTracefile *tf, LttEventBatch *batch);
+
 /* get the data type size and endian type of the local machine */
 
 void getDataEndianType(LttArchSize * size, LttArchEndian * endian);
@@ -211,11 +308,45 @@ guint64 ltt_get_uint(gboolean reverse_byte_order, gint size, void *data);
 
 guint64 tsc_to_uint64(guint32 freq_scale, uint64_t start_freq, guint64 tsc);
 
+/* Recompute the fixed point TSC conversion factors of the trace. Must be called
+ * whenever start_freq, freq_scale, drift or offset are modified. */
+void ltt_trace_update_clock(LttTrace *t);
+
+/* Convert a TSC value of the trace to nanoseconds, drift and offset included */
+guint64 ltt_trace_tsc_to_ns(LttTrace *t, guint64 tsc);
+
 LttTime ltt_interpolate_time_from_tsc(LttTracefile *tf, guint64 tsc);
 
 /* Set to enable event debugging output */
 void ltt_event_debug(int state);
 
+/* Set to compute the field offsets of events carrying their size in their
+ * header only when one of their fields is read. Ignored while event debugging
+ * is enabled, so the sizes keep being verified. */
+void ltt_event_lazy_decode(int state);
+
+/* Set to map each tracefile once (in large windows on 32-bit hosts) rather
+ * than mapping and unmapping each subbuffer as it is read. */
+void ltt_tracefile_map_whole(int state);
+
+/* Set to decode the event headers of the tracefile with the decoder
+ * specialized for its byte order (default). When cleared, a generic decoder
+ * testing the byte order for each field is used instead. */
+void ltt_tracefile_specialized_decode(LttTracefile *tf, int state);
+
+/* Set the number of subbuffers prefetched ahead of the one being read in
+ * each tracefile. 0 disables read-ahead. */
+void ltt_tracefile_set_readahead(guint nb_blocks);
+
+/* Set the number of threads decoding the tracefiles of the traces opened
+ * next ahead of their reader. 0 (default) disables the decode pipeline. */
+void ltt_tracefile_decode_threads(guint nb_threads);
+
+/* Set to have the events of the tracefile decoded ahead by the decode
+ * pipeline threads. ltt_tracefile_read then returns the events they decoded,
+ * which are the same as the ones it would decode. */
+int ltt_tracefile_decode_ahead(LttTracefile *tf, int state);
+
 /* A structure representing the version number of the trace */
 struct LttTraceVersion {
   guint8    ltt_major_version;
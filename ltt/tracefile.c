@@ -38,6 +38,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 // For realpath
 #include <limits.h>
@@ -53,11 +54,6 @@
 
 #define DEFAULT_N_BLOCKS 32
 
-/* from marker.c */
-extern long marker_update_fields_offsets(struct marker_info *info, const char *data);
-extern void marker_update_event_fields_offsets(GArray *fields_offsets,
-					       struct marker_info *info);
-
 /* Tracefile names used in this file */
 
 GQuark LTT_TRACEFILE_NAME_METADATA;
@@ -82,6 +78,10 @@ GQuark LTT_TRACEFILE_NAME_METADATA;
 #define PAGE_MASK (~(page_size-1))
 #define PAGE_ALIGN(addr)  (((addr)+page_size-1)&PAGE_MASK)
 
+/* Size of the mapping windows used by the whole tracefile mapping mode when
+ * the address space cannot hold entire tracefiles. */
+#define LTT_MAP_WINDOW_SIZE (256UL << 20)
+
 /* set the offset of the fields belonging to the event,
    need the information of the archecture */
 //void set_fields_offsets(LttTracefile *tf, LttEventType *event_type);
@@ -99,13 +99,31 @@ static guint64 cycles_2_ns(LttTracefile *tf, guint64 cycles);
 /* go to the next event */
 static int ltt_seek_next_event(LttTracefile *tf);
 
-static int open_tracefiles(LttTrace *trace, gchar *root_path,
-    gchar *relative_path);
+/* ask the kernel to read the subbuffers following the current one */
+static void prefetch_blocks(LttTracefile *tf);
+
+/* decode pipeline */
+static int decode_ahead_read(LttTracefile *tf);
+static void decode_ahead_restart(LttTracefile *tf);
+static void decode_ahead_move(LttTracefile *tf, guint block);
+static int batch_set_event(LttTracefile *tf, LttEventBatch *batch, guint i);
+
+/* backward reading */
+static void prev_cache_free(LttTracefile *tf);
+
+/* event header decoders */
+static void *read_event_header_native(LttTracefile *tf, void *pos);
+static void *read_event_header_reverse(LttTracefile *tf, void *pos);
+static void *read_event_header_generic(LttTracefile *tf, void *pos);
+
+static int open_tracefiles(LttTrace *trace, gchar *root_path);
 static int ltt_process_metadata_tracefile(LttTracefile *tf);
 static void ltt_tracefile_time_span_get(LttTracefile *tf,
                                         LttTime *start, LttTime *end);
 static void group_time_span_get(GQuark name, gpointer data, gpointer user_data);
+static void group_decode_ahead(GQuark name, gpointer data, gpointer user_data);
 static gint map_block(LttTracefile * tf, guint block_num);
+static int map_first_block(LttTracefile *tf);
 static void ltt_update_event_size(LttTracefile *tf);
 
 /* Enable event debugging */
@@ -116,6 +134,38 @@ void ltt_event_debug(int state)
   a_event_debug = state;
 }
 
+/* Defer field offsets computation until the fields are read */
+static int a_lazy_decode = 0;
+
+void ltt_event_lazy_decode(int state)
+{
+  a_lazy_decode = state;
+}
+
+/* Map whole tracefiles instead of one subbuffer at a time */
+static int a_map_whole = 0;
+
+void ltt_tracefile_map_whole(int state)
+{
+  a_map_whole = state;
+}
+
+/* Number of subbuffers prefetched ahead of the current one */
+static guint a_readahead_blocks = 4;
+
+void ltt_tracefile_set_readahead(guint nb_blocks)
+{
+  a_readahead_blocks = nb_blocks;
+}
+
+/* Number of threads decoding the tracefiles of the traces opened next */
+static guint a_decode_threads = 0;
+
+void ltt_tracefile_decode_threads(guint nb_threads)
+{
+  a_decode_threads = nb_threads;
+}
+
 /* trace can be NULL
  *
  * Return value : 0 success, 1 bad tracefile
@@ -129,6 +179,7 @@ static int parse_trace_header(ltt_subbuffer_header_t *header,
     tf->reverse_bo = 1;
   else  /* invalid magic number, bad tracefile ! */
     return 1;
+  ltt_tracefile_specialized_decode(tf, 1);
  
   if(t) {
     t->ltt_major_version = header->major_version;
@@ -196,65 +247,333 @@ static int parse_trace_header(ltt_subbuffer_header_t *header,
 int get_block_offset_size(LttTracefile *tf, guint block_num,
                           uint64_t *offset, uint32_t *size)
 {
-  uint64_t offa, offb;
+  LttBlockIndex *entry;
 
   if (unlikely(block_num >= tf->num_blocks))
     return -1;
 
-  offa = g_array_index(tf->buf_index, uint64_t, block_num);
-  if (likely(block_num < tf->num_blocks - 1))
-    offb = g_array_index(tf->buf_index, uint64_t, block_num + 1);
-  else
-    offb = tf->file_size;
-  *offset = offa;
-  *size = offb - offa;
+  entry = &g_array_index(tf->buf_index, LttBlockIndex, block_num);
+  *offset = entry->offset;
+  *size = entry->size;
   return 0;
 }
 
-int ltt_trace_create_block_index(LttTracefile *tf)
+/*
+ * Block index sidecar file.
+ *
+ * Building the block index needs to read every subbuffer header of the
+ * tracefile, which means touching the whole file on large traces. The index is
+ * therefore saved next to the tracefile the first time it is built, in a hidden
+ * file (".<tracefile name>.idx") so find_tracefiles does not pick it up. It is
+ * only reused if the tracefile size and modification time match the ones
+ * recorded in its header.
+ */
+#define LTT_BLOCK_INDEX_MAGIC   0x4C545449  /* "LTTI", host byte order */
+#define LTT_BLOCK_INDEX_VERSION 1
+
+struct ltt_block_index_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entry_size;          /* sizeof(LttBlockIndex) */
+  uint32_t num_blocks;
+  uint64_t file_size;           /* Tracefile size when the index was built */
+  uint64_t mtime_sec;           /* Tracefile modification time */
+  uint64_t mtime_nsec;
+};
+
+static gchar *ltt_block_index_path(LttTracefile *tf)
 {
-  int page_size = getpagesize();
-  uint64_t offset = 0;
-  unsigned long i = 0;
-  unsigned int header_map_size = PAGE_ALIGN(ltt_subbuffer_header_size());
+  const gchar *long_name = g_quark_to_string(tf->long_name);
+  gchar *dirname, *basename, *path;
+
+  dirname = g_path_get_dirname(long_name);
+  basename = g_path_get_basename(long_name);
+  path = g_strdup_printf("%s/.%s.idx", dirname, basename);
+  g_free(dirname);
+  g_free(basename);
+  return path;
+}
 
-  tf->buf_index = g_array_sized_new(FALSE, TRUE, sizeof(uint64_t),
-                                    DEFAULT_N_BLOCKS);
+/* Return value : 0 if the index has been loaded from the sidecar file. */
+static int ltt_block_index_load(LttTracefile *tf, const struct stat *st)
+{
+  struct ltt_block_index_header header;
+  gchar *path;
+  ssize_t len;
+  int fd, ret = -1;
+
+  path = ltt_block_index_path(tf);
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    goto end;
 
-  g_assert(tf->buf_index->len == i);
+  len = read(fd, &header, sizeof(header));
+  if (len != sizeof(header))
+    goto close_file;
+  if (header.magic != LTT_BLOCK_INDEX_MAGIC
+      || header.version != LTT_BLOCK_INDEX_VERSION
+      || header.entry_size != sizeof(LttBlockIndex)
+      || header.file_size != (uint64_t)st->st_size
+      || header.mtime_sec != (uint64_t)st->st_mtim.tv_sec
+      || header.mtime_nsec != (uint64_t)st->st_mtim.tv_nsec) {
+    g_debug("Stale block index %s, rebuilding it", path);
+    goto close_file;
+  }
 
-  while (offset < tf->file_size) {
-    ltt_subbuffer_header_t *header;
-    uint64_t *off;
+  tf->buf_index = g_array_set_size(tf->buf_index, header.num_blocks);
+  len = read(fd, tf->buf_index->data,
+             (size_t)header.num_blocks * sizeof(LttBlockIndex));
+  if (len != (ssize_t)header.num_blocks * sizeof(LttBlockIndex)) {
+    tf->buf_index = g_array_set_size(tf->buf_index, 0);
+    goto close_file;
+  }
+  tf->num_blocks = header.num_blocks;
+  ret = 0;
 
-    tf->buf_index = g_array_set_size(tf->buf_index, i + 1);
-    off = &g_array_index(tf->buf_index, uint64_t, i);
-    *off = offset;
+close_file:
+  close(fd);
+end:
+  g_free(path);
+  return ret;
+}
 
-    /* map block header */
-    header = mmap(0, header_map_size, PROT_READ, 
-                  MAP_PRIVATE, tf->fd, (off_t)offset);
-    if(header == MAP_FAILED) {
-      perror("Error in allocating memory for buffer of tracefile");
+/*
+ * Save the block index. Failure is not an error : the trace directory may very
+ * well be read-only. The file is written under a temporary name and renamed so
+ * a concurrent reader never sees a partial index.
+ */
+static void ltt_block_index_save(LttTracefile *tf, const struct stat *st)
+{
+  struct ltt_block_index_header header;
+  gchar *path, *tmp_path;
+  size_t data_len;
+  int fd;
+
+  header.magic = LTT_BLOCK_INDEX_MAGIC;
+  header.version = LTT_BLOCK_INDEX_VERSION;
+  header.entry_size = sizeof(LttBlockIndex);
+  header.num_blocks = tf->num_blocks;
+  header.file_size = st->st_size;
+  header.mtime_sec = st->st_mtim.tv_sec;
+  header.mtime_nsec = st->st_mtim.tv_nsec;
+  data_len = (size_t)tf->num_blocks * sizeof(LttBlockIndex);
+
+  path = ltt_block_index_path(tf);
+  tmp_path = g_strdup_printf("%s.%d", path, getpid());
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    g_debug("Cannot create block index %s", tmp_path);
+    goto end;
+  }
+  if (write(fd, &header, sizeof(header)) != sizeof(header)
+      || write(fd, tf->buf_index->data, data_len) != (ssize_t)data_len) {
+    g_debug("Cannot write block index %s", tmp_path);
+    close(fd);
+    unlink(tmp_path);
+    goto end;
+  }
+  close(fd);
+  if (rename(tmp_path, path))
+    unlink(tmp_path);
+end:
+  g_free(tmp_path);
+  g_free(path);
+}
+
+/*
+ * Append to the block index of a tracefile the subbuffers which follow the
+ * last one indexed, up to size bytes of file. A subbuffer not completely
+ * written yet is left for a later call.
+ *
+ * Return value : number of subbuffers appended, -1 on error.
+ */
+static int block_index_append(LttTracefile *tf, uint64_t size)
+{
+  uint64_t offset = 0;
+  guint i = tf->buf_index->len;
+  int nb_new = 0;
+
+  if (i > 0) {
+    LttBlockIndex *last = &g_array_index(tf->buf_index, LttBlockIndex, i - 1);
+    offset = last->offset + last->size;
+  }
+
+  while (offset + ltt_subbuffer_header_size() <= size) {
+    ltt_subbuffer_header_t header;
+    LttBlockIndex *entry;
+    uint32_t sb_size;
+
+    /* read block header */
+    if (pread(tf->fd, &header, ltt_subbuffer_header_size(), (off_t)offset)
+        != (ssize_t)ltt_subbuffer_header_size()) {
+      perror("Error in reading subbuffer header of tracefile");
       return -1;
     }
 
-    /* read len, offset += len */
-    offset += ltt_get_uint32(LTT_GET_BO(tf), &header->sb_size);
-
-    /* unmap block header */
-    if(munmap(header, header_map_size)) {
-      g_warning("unmap size : %u\n", header_map_size);
-      perror("munmap error");
+    sb_size = ltt_get_uint32(LTT_GET_BO(tf), &header.sb_size);
+    if (unlikely(sb_size == 0)) {
+      g_warning("Null subbuffer size in tracefile %s at offset %" PRIu64,
+                g_quark_to_string(tf->long_name), offset);
       return -1;
     }
+    if (offset + sb_size > size) {
+      g_info("Subbuffer of tracefile %s at offset %" PRIu64
+             " incomplete, not indexed", g_quark_to_string(tf->long_name),
+             offset);
+      break;
+    }
+
+    tf->buf_index = g_array_set_size(tf->buf_index, i + 1);
+    entry = &g_array_index(tf->buf_index, LttBlockIndex, i);
+    entry->offset = offset;
+    entry->size = sb_size;
+    entry->cycle_count_begin = ltt_get_uint64(LTT_GET_BO(tf),
+                                              &header.cycle_count_begin);
+    entry->cycle_count_end = ltt_get_uint64(LTT_GET_BO(tf),
+                                            &header.cycle_count_end);
+    entry->events_lost = ltt_get_uint32(LTT_GET_BO(tf), &header.events_lost);
+
+    /* read len, offset += len */
+    offset += entry->size;
     ++i;
+    ++nb_new;
   }
   tf->num_blocks = i;
+  return nb_new;
+}
+
+/*
+ * Create the block index of a tracefile, from its sidecar file if it is up to
+ * date, else by reading each subbuffer header.
+ *
+ * Return value : 0 on success, -1 on error.
+ */
+int ltt_trace_create_block_index(LttTracefile *tf)
+{
+  struct stat st;
+
+  tf->buf_index = g_array_sized_new(FALSE, TRUE, sizeof(LttBlockIndex),
+                                    DEFAULT_N_BLOCKS);
+
+  if (fstat(tf->fd, &st) < 0) {
+    perror("Cannot stat tracefile");
+    return -1;
+  }
+
+  if (!ltt_block_index_load(tf, &st))
+    return 0;
+
+  if (block_index_append(tf, tf->file_size) < 0)
+    return -1;
+
+  ltt_block_index_save(tf, &st);
 
   return 0;
 }
 
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_update_block_index : index the subbuffers written since the
+ *                                       block index was built
+ *Input params
+ *    tf                  : the tracefile
+ *Return value
+ *                        : number of subbuffers appended, -1 on error.
+ ****************************************************************************/
+int ltt_tracefile_update_block_index(LttTracefile *tf)
+{
+  struct stat st;
+  LttBlockIndex *index;
+  LttBlockTime *entry;
+  guint i, old_num_blocks = tf->num_blocks;
+  int nb_new, ahead;
+
+  if (fstat(tf->fd, &st) < 0) {
+    perror("Cannot stat tracefile");
+    return -1;
+  }
+  if ((uint64_t)st.st_size <= (uint64_t)tf->file_size)
+    return 0;
+
+  /* The decode threads read the index : stop them while it grows */
+  ahead = tf->ahead != NULL;
+  if (ahead)
+    ltt_tracefile_decode_ahead(tf, 0);
+
+  tf->file_size = st.st_size;
+  nb_new = block_index_append(tf, tf->file_size);
+
+  /* Extend the block times, if they were computed */
+  if (nb_new > 0 && tf->buf_time != NULL) {
+    tf->buf_time = g_array_set_size(tf->buf_time, tf->num_blocks);
+    for (i = old_num_blocks; i < tf->num_blocks; i++) {
+      index = &g_array_index(tf->buf_index, LttBlockIndex, i);
+      entry = &g_array_index(tf->buf_time, LttBlockTime, i);
+      entry->begin = ltt_interpolate_time_from_tsc(tf,
+                                                   index->cycle_count_begin);
+      entry->end = ltt_interpolate_time_from_tsc(tf, index->cycle_count_end);
+    }
+  }
+
+  if (ahead)
+    ltt_tracefile_decode_ahead(tf, 1);
+  return nb_new;
+}
+
+/*****************************************************************************
+ *Function name
+ *    ltt_trace_update_metadata : read the marker registrations written since
+ *                                the metadata was last read
+ *Input params
+ *    t                   : the trace
+ *Return value
+ *                        : number of metadata subbuffers appended, -1 on error.
+ ****************************************************************************/
+int ltt_trace_update_metadata(LttTrace *t)
+{
+  LttTracefile *cursor;
+  guint i;
+  int ret, nb_new = 0;
+
+  for (i = 0; i < t->metadata->len; i++) {
+    cursor = g_ptr_array_index(t->metadata, i);
+    ret = ltt_tracefile_update_block_index(cursor->handle);
+    if (ret < 0)
+      return -1;
+    nb_new += ret;
+  }
+  if (nb_new == 0)
+    return 0;
+
+  /* The decode threads read the marker tables : stop them while they grow */
+  if (a_decode_threads > 0)
+    g_datalist_foreach(&t->tracefiles, group_decode_ahead, GINT_TO_POINTER(0));
+
+  for (i = 0; i < t->metadata->len; i++) {
+    cursor = g_ptr_array_index(t->metadata, i);
+    cursor->file_size = cursor->handle->file_size;
+    cursor->num_blocks = cursor->handle->num_blocks;
+    if (ltt_process_metadata_tracefile(cursor))
+      return -1;
+  }
+
+  if (a_decode_threads > 0)
+    g_datalist_foreach(&t->tracefiles, group_decode_ahead, GINT_TO_POINTER(1));
+  return nb_new;
+}
+
+/* Time at the end of the last subbuffer indexed */
+LttTime ltt_tracefile_indexed_end_time(LttTracefile *tf)
+{
+  LttBlockIndex *index;
+
+  /* No subbuffer yet : the tracefile has no event before the trace start */
+  if (tf->num_blocks == 0)
+    return ltt_interpolate_time_from_tsc(tf, tf->trace->start_tsc);
+  index = &g_array_index(tf->buf_index, LttBlockIndex, tf->num_blocks - 1);
+  return ltt_interpolate_time_from_tsc(tf, index->cycle_count_end);
+}
+
 /*****************************************************************************
  *Function name
  *    ltt_tracefile_open : open a trace file, construct a LttTracefile
@@ -277,6 +596,10 @@ static gint ltt_tracefile_open(LttTrace *t, gchar * fileName, LttTracefile *tf)
   tf->trace = t;
   tf->fd = open(fileName, O_RDONLY);
   tf->buf_index = NULL;
+  tf->buf_time = NULL;
+  tf->map_head = NULL;
+  tf->readahead_next = 0;
+  tf->ahead = NULL;
   if(tf->fd < 0){
     g_warning("Unable to open input data file %s\n", fileName);
     goto end;
@@ -328,19 +651,23 @@ static gint ltt_tracefile_open(LttTrace *t, gchar * fileName, LttTracefile *tf)
   tf->buffer.head = NULL;
 
   /* Create block index */
-  ltt_trace_create_block_index(tf);
+  if(ltt_trace_create_block_index(tf)) {
+    g_warning("Cannot create block index of tracefile %s", fileName);
+    goto close_file;
+  }
 
-  //read the first block
-  if(map_block(tf,0)) {
+  //read the first block, if any was written yet
+  if(tf->num_blocks > 0 && map_block(tf,0)) {
     perror("Cannot map block for tracefile");
     goto close_file;
   }
  
-  /* Create fields offset table */
-  tf->event.fields_offsets = g_array_sized_new(FALSE, FALSE,
-                                               sizeof(struct LttField), 1);
-  if (!tf->event.fields_offsets)
+  /* Create the field offsets table of the event */
+  tf->event.dynamic_offsets = g_array_sized_new(FALSE, FALSE,
+                                                sizeof(struct LttField), 1);
+  if (!tf->event.dynamic_offsets)
     goto close_file;
+  tf->event.fields_offsets = NULL;
 
   return 0;
 
@@ -373,7 +700,16 @@ static void ltt_tracefile_close(LttTracefile *t)
 {
   int page_size = getpagesize();
 
-  if(t->buffer.head != NULL)
+  ltt_tracefile_decode_ahead(t, 0);
+  prev_cache_free(t);
+
+  if(t->map_head != NULL) {
+    if(munmap(t->map_head, t->map_size)) {
+      g_warning("unmap size : %zu\n", t->map_size);
+      perror("munmap error");
+      g_assert(0);
+    }
+  } else if(t->buffer.head != NULL)
     if(munmap(t->buffer.head, PAGE_ALIGN(t->buffer.size))) {
     g_warning("unmap size : %u\n",
         PAGE_ALIGN(t->buffer.size));
@@ -384,7 +720,55 @@ static void ltt_tracefile_close(LttTracefile *t)
   close(t->fd);
   if (t->buf_index)
     g_array_free(t->buf_index, TRUE);
-  g_array_free(t->event.fields_offsets, TRUE);
+  if (t->buf_time)
+    g_array_free(t->buf_time, TRUE);
+  g_array_free(t->event.dynamic_offsets, TRUE);
+}
+
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_cursor_new : new cursor on a tracefile
+ *Input params
+ *    tf                  : the tracefile, or another cursor on it
+ *Return value
+ *                        : the cursor, to be positioned by a seek.
+ ****************************************************************************/
+LttTracefile *ltt_tracefile_cursor_new(LttTracefile *tf)
+{
+  LttTracefile *cursor;
+
+  /* The fd, block index and marker tables are shared, only read */
+  cursor = g_new(LttTracefile, 1);
+  *cursor = *tf->handle;
+  cursor->buffer.head = NULL;
+  cursor->map_head = NULL;
+  cursor->buf_time = NULL;
+  cursor->readahead_next = 0;
+  cursor->ahead = NULL;
+  cursor->prev_cache = NULL;
+  cursor->event.tracefile = cursor;
+  cursor->event.dynamic_offsets = g_array_sized_new(FALSE, FALSE,
+      sizeof(struct LttField), 1);
+  return cursor;
+}
+
+void ltt_tracefile_cursor_destroy(LttTracefile *cursor)
+{
+  int page_size = getpagesize();
+
+  g_assert(cursor->handle != cursor);
+
+  ltt_tracefile_decode_ahead(cursor, 0);
+  prev_cache_free(cursor);
+
+  if(cursor->map_head != NULL)
+    munmap(cursor->map_head, cursor->map_size);
+  else if(cursor->buffer.head != NULL)
+    munmap(cursor->buffer.head, PAGE_ALIGN(cursor->buffer.size));
+  if(cursor->buf_time != NULL)
+    g_array_free(cursor->buf_time, TRUE);
+  g_array_free(cursor->event.dynamic_offsets, TRUE);
+  g_free(cursor);
 }
 
 /****************************************************************************
@@ -578,24 +962,40 @@ static __attribute__ ((__unused__)) gboolean ltt_tracefile_group_has_cpu_online(
 }
 
 
-/* Open each tracefile under a specific directory. Put them in a
- * GData : permits to access them using their tracefile group pathname.
- * i.e. access control/modules tracefile group by index :
- * "control/module".
+/* Maximum number of threads used to open the tracefiles of a trace */
+#define LTT_OPEN_THREADS_MAX 8
+
+/* A tracefile found in the trace directory, waiting to be opened */
+struct tracefile_open_job {
+  gchar *path;
+  GQuark name;
+  guint num;
+  gulong tid, pgid;
+  guint64 creation;
+  int ret;                      /* ltt_tracefile_open return value */
+  LttTracefile tf;
+};
+
+struct tracefile_open_pool {
+  LttTrace *trace;
+  GArray *jobs;                 /* Array of struct tracefile_open_job */
+  guint *order;                 /* Job indexes, in the order they are opened */
+  guint next;                   /* Next entry of order to open */
+  pthread_mutex_t lock;         /* Protects next */
+};
+
+/* Walk the trace directory and list the tracefiles to open in jobs.
  * 
  * relative path is the path relative to the trace root
  * root path is the full path
- *
- * A tracefile group is simply an array where all the per cpu tracefiles sit.
  */
-
-static int open_tracefiles(LttTrace *trace, gchar *root_path, gchar *relative_path)
+static int find_tracefiles(GArray *jobs, gchar *root_path,
+                           gchar *relative_path)
 {
   DIR *dir = opendir(root_path);
   struct dirent *entry;
   struct stat stat_buf;
-  int ret, i;
-  struct marker_data *mdata;
+  int ret;
   
   gchar path[PATH_MAX];
   int path_len;
@@ -604,7 +1004,7 @@ static int open_tracefiles(LttTrace *trace, gchar *root_path, gchar *relative_pa
   int rel_path_len;
   gchar rel_path[PATH_MAX];
   gchar *rel_path_ptr;
-  LttTracefile tmp_tf;
+  struct tracefile_open_job *job;
 
   if(dir == NULL) {
     perror(root_path);
@@ -643,75 +1043,185 @@ static int open_tracefiles(LttTrace *trace, gchar *root_path, gchar *relative_pa
     if(S_ISDIR(stat_buf.st_mode)) {
 
       g_debug("Entering subdirectory...\n");
-      ret = open_tracefiles(trace, path, rel_path);
+      ret = find_tracefiles(jobs, path, rel_path);
       if(ret < 0) continue;
     } else if(S_ISREG(stat_buf.st_mode)) {
       GQuark name;
       guint num;
       gulong tid, pgid;
       guint64 creation;
-      GArray *group;
       num = 0;
       tid = pgid = 0;
       creation = 0;
       if(get_tracefile_name_number(rel_path, &name, &num, &tid, &pgid, &creation))
         continue; /* invalid name */
-      
-      g_debug("Opening file.\n");
-      if(ltt_tracefile_open(trace, path, &tmp_tf)) {
-        g_info("Error opening tracefile %s", path);
 
-        continue; /* error opening the tracefile : bad magic number ? */
-      }
+      jobs = g_array_set_size(jobs, jobs->len + 1);
+      job = &g_array_index(jobs, struct tracefile_open_job, jobs->len - 1);
+      job->path = g_strdup(path);
+      job->name = name;
+      job->num = num;
+      job->tid = tid;
+      job->pgid = pgid;
+      job->creation = creation;
+      /* Create the quark of the tracefile path here : the workers then only
+       * look it up. */
+      g_quark_from_string(path);
+    }
+  }
+  
+  closedir(dir);
 
-      g_debug("Tracefile name is %s and number is %u", 
-          g_quark_to_string(name), num);
-
-      mdata = NULL;
-      tmp_tf.cpu_online = 1;
-      tmp_tf.cpu_num = num;
-      tmp_tf.name = name;
-      tmp_tf.tid = tid;
-      tmp_tf.pgid = pgid;
-      tmp_tf.creation = creation;
-      group = g_datalist_id_get_data(&trace->tracefiles, name);
-      if(group == NULL) {
-        /* Elements are automatically cleared when the array is allocated.
-         * It makes the cpu_online variable set to 0 : cpu offline, by default.
-         */
-        group = g_array_sized_new (FALSE, TRUE, sizeof(LttTracefile), 10);
-        g_datalist_id_set_data_full(&trace->tracefiles, name,
-                                 group, ltt_tracefile_group_destroy);
-        mdata = allocate_marker_data();
-        if (!mdata)
-          g_error("Error in allocating marker data");
-      }
+  return 0;
+}
+
+static void *open_tracefiles_worker(void *data)
+{
+  struct tracefile_open_pool *pool = data;
+  struct tracefile_open_job *job;
+  guint i;
+
+  while(1) {
+    pthread_mutex_lock(&pool->lock);
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if(i >= pool->jobs->len)
+      break;
+
+    job = &g_array_index(pool->jobs, struct tracefile_open_job,
+                         pool->order[i]);
+    g_debug("Opening file %s.\n", job->path);
+    job->ret = ltt_tracefile_open(pool->trace, job->path, &job->tf);
+  }
+  return NULL;
+}
+
+/* Open each tracefile under a specific directory. Put them in a
+ * GData : permits to access them using their tracefile group pathname.
+ * i.e. access control/modules tracefile group by index :
+ * "control/module".
+ *
+ * A tracefile group is simply an array where all the per cpu tracefiles sit.
+ *
+ * Opening a tracefile and building its block index is independent of the
+ * other tracefiles, so it is done by a bounded pool of threads. The metadata
+ * tracefiles are handed out first, as the marker definitions are read from
+ * them once the trace is open. The tracefiles are then added to their groups
+ * in directory order by the calling thread, which keeps the result
+ * independent of thread scheduling.
+ */
+
+static int open_tracefiles(LttTrace *trace, gchar *root_path)
+{
+  GArray *jobs;
+  struct tracefile_open_job *job;
+  struct tracefile_open_pool pool;
+  pthread_t threads[LTT_OPEN_THREADS_MAX];
+  guint nb_threads, nb_started, i, j;
+  long nb_cpus;
+  int ret;
+  struct marker_data *mdata;
+  GArray *group;
 
-      /* Add the per cpu tracefile to the named group */
-      unsigned int old_len = group->len;
-      if(num+1 > old_len)
-        group = g_array_set_size(group, num+1);
+  jobs = g_array_new(FALSE, TRUE, sizeof(struct tracefile_open_job));
+  ret = find_tracefiles(jobs, root_path, "");
+  if(ret) {
+    g_array_free(jobs, TRUE);
+    return ret;
+  }
 
-      g_assert(group->len > 0);
+  pool.trace = trace;
+  pool.jobs = jobs;
+  pool.order = g_new(guint, jobs->len);
+  pool.next = 0;
+  pthread_mutex_init(&pool.lock, NULL);
+  j = 0;
+  for(i = 0; i < jobs->len; i++)
+    if(g_array_index(jobs, struct tracefile_open_job, i).name
+        == LTT_TRACEFILE_NAME_METADATA)
+      pool.order[j++] = i;
+  for(i = 0; i < jobs->len; i++)
+    if(g_array_index(jobs, struct tracefile_open_job, i).name
+        != LTT_TRACEFILE_NAME_METADATA)
+      pool.order[j++] = i;
+
+  nb_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  nb_threads = min((guint)max(nb_cpus, 1L), (guint)LTT_OPEN_THREADS_MAX);
+  nb_threads = min(nb_threads, jobs->len);
+  nb_started = 0;
+  /* The calling thread is part of the pool */
+  for(i = 1; i < nb_threads; i++) {
+    if(pthread_create(&threads[nb_started], NULL, open_tracefiles_worker,
+                      &pool))
+      break;
+    nb_started++;
+  }
+  open_tracefiles_worker(&pool);
+  for(i = 0; i < nb_started; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&pool.lock);
+  g_free(pool.order);
+
+  for(i = 0; i < jobs->len; i++) {
+    job = &g_array_index(jobs, struct tracefile_open_job, i);
+    if(job->ret) {
+      g_info("Error opening tracefile %s", job->path);
+      g_free(job->path);
+      continue; /* error opening the tracefile : bad magic number ? */
+    }
+    g_free(job->path);
+
+    g_debug("Tracefile name is %s and number is %u", 
+        g_quark_to_string(job->name), job->num);
+
+    mdata = NULL;
+    job->tf.cpu_online = 1;
+    job->tf.cpu_num = job->num;
+    job->tf.name = job->name;
+    job->tf.tid = job->tid;
+    job->tf.pgid = job->pgid;
+    job->tf.creation = job->creation;
+    group = g_datalist_id_get_data(&trace->tracefiles, job->name);
+    if(group == NULL) {
+      /* Elements are automatically cleared when the array is allocated.
+       * It makes the cpu_online variable set to 0 : cpu offline, by default.
+       */
+      group = g_array_sized_new (FALSE, TRUE, sizeof(LttTracefile), 10);
+      g_datalist_id_set_data_full(&trace->tracefiles, job->name,
+                               group, ltt_tracefile_group_destroy);
+      mdata = allocate_marker_data();
       if (!mdata)
-        mdata = g_array_index (group, LttTracefile, 0).mdata;
+        g_error("Error in allocating marker data");
+    }
 
-      g_array_index (group, LttTracefile, num) = tmp_tf;
-      g_array_index (group, LttTracefile, num).event.tracefile = 
-        &g_array_index (group, LttTracefile, num);
-      for (i = 0; i < group->len; i++)
-        g_array_index (group, LttTracefile, i).mdata = mdata;
+    /* Add the per cpu tracefile to the named group */
+    unsigned int old_len = group->len;
+    if(job->num+1 > old_len)
+      group = g_array_set_size(group, job->num+1);
+
+    g_assert(group->len > 0);
+    if (!mdata)
+      mdata = g_array_index (group, LttTracefile, 0).mdata;
+
+    g_array_index (group, LttTracefile, job->num) = job->tf;
+    g_array_index (group, LttTracefile, job->num).event.tracefile = 
+      &g_array_index (group, LttTracefile, job->num);
+    /* The group may have moved */
+    for (j = 0; j < group->len; j++) {
+      g_array_index (group, LttTracefile, j).mdata = mdata;
+      g_array_index (group, LttTracefile, j).handle =
+        &g_array_index (group, LttTracefile, j);
     }
   }
-  
-  closedir(dir);
+  g_array_free(jobs, TRUE);
 
   return 0;
 }
 
 
-/* Presumes the tracefile is already seeked at the beginning. It makes sense,
- * because it must be done just after the opening */
+/* Reads the marker registrations from the position of the tracefile to its
+ * end : the beginning just after the opening, then the position where the
+ * previous read stopped when the trace is followed */
 static int ltt_process_metadata_tracefile(LttTracefile *tf)
 {
   int err;
@@ -854,7 +1364,7 @@ LttTrace *ltt_trace_open(const gchar *pathname)
   
   /* Open all the tracefiles */
   t->start_freq= 0;
-  if(open_tracefiles(t, abs_path, "")) {
+  if(open_tracefiles(t, abs_path)) {
     g_warning("Error opening tracefile %s", abs_path);
     goto find_error;
   }
@@ -875,6 +1385,10 @@ LttTrace *ltt_trace_open(const gchar *pathname)
    */
   g_assert(group->len > 0);
   tf = &g_array_index (group, LttTracefile, 0);
+  if(tf->num_blocks == 0) {
+    g_warning("Trace %s has no metadata subbuffer yet", abs_path);
+    goto find_error;
+  }
   header = (ltt_subbuffer_header_t *)tf->buffer.head;
   ret = parse_trace_header(header, tf, t);
   g_assert(!ret);
@@ -882,24 +1396,36 @@ LttTrace *ltt_trace_open(const gchar *pathname)
   t->num_cpu = group->len;
   t->drift = 1.;
   t->offset = 0.;
+  ltt_trace_update_clock(t);
   
   //ret = allocate_marker_data(t);
   //if (ret)
   //  g_error("Error in allocating marker data");
 
+  /* The metadata is read by cursors of its own, which stay after the last
+   * marker registration to go on when the trace is followed */
+  t->metadata = g_ptr_array_sized_new(group->len);
   for(i=0; i<group->len; i++) {
     tf = &g_array_index (group, LttTracefile, i);
-    if (tf->cpu_online)
+    if (tf->cpu_online) {
+      tf = ltt_tracefile_cursor_new(tf);
+      g_ptr_array_add(t->metadata, tf);
       if(ltt_process_metadata_tracefile(tf))
-        goto find_error;
-      //  goto metadata_error;
+        goto metadata_error;
+    }
   }
 
+  /* The markers are known : the other tracefiles can be decoded ahead */
+  if(a_decode_threads > 0)
+    g_datalist_foreach(&t->tracefiles, group_decode_ahead,
+                       GINT_TO_POINTER(1));
+
   return t;
 
   /* Error handling */
-//metadata_error:
-//  destroy_marker_data(t);
+metadata_error:
+  g_ptr_array_foreach(t->metadata, (GFunc)ltt_tracefile_cursor_destroy, NULL);
+  g_ptr_array_free(t->metadata, TRUE);
 find_error:
   g_datalist_clear(&t->tracefiles);
 open_error:
@@ -928,6 +1454,8 @@ LttTrace *ltt_trace_copy(LttTrace *self)
 
 void ltt_trace_close(LttTrace *t)
 {
+  g_ptr_array_foreach(t->metadata, (GFunc)ltt_tracefile_cursor_destroy, NULL);
+  g_ptr_array_free(t->metadata, TRUE);
   g_datalist_clear(&t->tracefiles);
   g_free(t);
 }
@@ -942,6 +1470,13 @@ void ltt_tracefile_time_span_get(LttTracefile *tf,
 {
   int err;
 
+  /* Without subbuffer, the tracefile does not change the trace span */
+  if(tf->num_blocks == 0) {
+    *start = ltt_time_infinite;
+    *end = ltt_time_zero;
+    return;
+  }
+
   err = map_block(tf, 0);
   if(unlikely(err)) {
     g_error("Can not map block");
@@ -1031,22 +1566,70 @@ void ltt_trace_time_span_get(LttTrace *t, LttTime *start, LttTime *end)
  *
  * */
 
+/*
+ * Build the table of subbuffer begin and end timestamps from the cycle counts
+ * saved in the block index. The timestamps depend on the trace clock
+ * parameters, which are only known once the metadata has been read and can be
+ * changed afterward by trace synchronization. The table is therefore built on
+ * first use and rebuilt whenever the clock differs from the one it was built
+ * with.
+ */
+static void update_block_time(LttTracefile *tf)
+{
+  LttTrace *t = tf->trace;
+  LttBlockIndex *index;
+  LttBlockTime *entry;
+  guint i;
+
+  if(likely(tf->buf_time != NULL
+      && tf->buf_time_clock.freq_scale == t->freq_scale
+      && tf->buf_time_clock.start_freq == t->start_freq
+      && tf->buf_time_clock.drift == t->drift
+      && tf->buf_time_clock.offset == t->offset))
+    return;
+
+  if(tf->buf_time == NULL)
+    tf->buf_time = g_array_sized_new(FALSE, FALSE, sizeof(LttBlockTime),
+                                     tf->num_blocks);
+  tf->buf_time = g_array_set_size(tf->buf_time, tf->num_blocks);
+
+  for(i = 0; i < tf->num_blocks; i++) {
+    index = &g_array_index(tf->buf_index, LttBlockIndex, i);
+    entry = &g_array_index(tf->buf_time, LttBlockTime, i);
+    entry->begin = ltt_interpolate_time_from_tsc(tf, index->cycle_count_begin);
+    entry->end = ltt_interpolate_time_from_tsc(tf, index->cycle_count_end);
+  }
+
+  tf->buf_time_clock.freq_scale = t->freq_scale;
+  tf->buf_time_clock.start_freq = t->start_freq;
+  tf->buf_time_clock.drift = t->drift;
+  tf->buf_time_clock.offset = t->offset;
+}
+
 int ltt_tracefile_seek_time(LttTracefile *tf, LttTime time)
 {
   int ret = 0;
   int err;
   unsigned int block_num, high, low;
+  LttBlockTime *block_time;
 
-  /* seek at the beginning of trace */
-  err = map_block(tf, 0);  /* First block */
-  if(unlikely(err)) {
-    g_error("Can not map block");
-    goto fail;
-  }
+  /* No event yet */
+  if(unlikely(tf->num_blocks == 0))
+    return ERANGE;
+
+  /* The search is done on the block time table : only the block found is
+   * mapped. */
+  update_block_time(tf);
 
  /* If the time is lower or equal the beginning of the trace,
   * go to the first event. */
-  if(ltt_time_compare(time, tf->buffer.begin.timestamp) <= 0) {
+  block_time = &g_array_index(tf->buf_time, LttBlockTime, 0);
+  if(ltt_time_compare(time, block_time->begin) <= 0) {
+    err = map_block(tf, 0);  /* First block */
+    if(unlikely(err)) {
+      g_error("Can not map block");
+      goto fail;
+    }
     ret = ltt_tracefile_read(tf);
     if(ret == ERANGE) goto range;
     else if (ret) goto fail;
@@ -1054,14 +1637,14 @@ int ltt_tracefile_seek_time(LttTracefile *tf, LttTime time)
                    to the first event in the trace */
   }
 
-  err = map_block(tf, tf->num_blocks - 1);  /* Last block */
-  if(unlikely(err)) {
-    g_error("Can not map block");
-    goto fail;
-  }
-
  /* If the time is after the end of the trace, return ERANGE. */
-  if(ltt_time_compare(time, tf->buffer.end.timestamp) > 0) {
+  block_time = &g_array_index(tf->buf_time, LttBlockTime, tf->num_blocks - 1);
+  if(ltt_time_compare(time, block_time->end) > 0) {
+    err = map_block(tf, tf->num_blocks - 1);  /* Last block */
+    if(unlikely(err)) {
+      g_error("Can not map block");
+      goto fail;
+    }
     goto range;
   }
 
@@ -1071,19 +1654,22 @@ int ltt_tracefile_seek_time(LttTracefile *tf, LttTime time)
   
   while(1) {
     block_num = ((high-low) / 2) + low;
-
-    err = map_block(tf, block_num);
-    if(unlikely(err)) {
-      g_error("Can not map block");
-      goto fail;
-    }
-    if(high == low) {
-      /* We cannot divide anymore : this is what would happen if the time
-       * requested was exactly between two consecutive buffers'end and start 
-       * timestamps. This is also what would happend if we didn't deal with out
-       * of span cases prior in this function. */
-      /* The event is right in the buffer!
+    block_time = &g_array_index(tf->buf_time, LttBlockTime, block_num);
+
+    if(high == low
+        || (ltt_time_compare(time, block_time->begin) >= 0
+            && ltt_time_compare(time, block_time->end) <= 0)) {
+      /* Either we cannot divide anymore : this is what would happen if the
+       * time requested was exactly between two consecutive buffers'end and
+       * start timestamps. This is also what would happend if we didn't deal
+       * with out of span cases prior in this function.
+       * Or the event is right in the buffer!
        * (or in the next buffer first event) */
+      err = map_block(tf, block_num);
+      if(unlikely(err)) {
+        g_error("Can not map block");
+        goto fail;
+      }
       while(1) {
         ret = ltt_tracefile_read(tf);
         if(ret == ERANGE) goto range; /* ERANGE or EPERM */
@@ -1092,28 +1678,19 @@ int ltt_tracefile_seek_time(LttTracefile *tf, LttTime time)
         if(ltt_time_compare(time, tf->event.event_time) <= 0)
           goto found;
       }
-
-    } else if(ltt_time_compare(time, tf->buffer.begin.timestamp) < 0) {
+    } else if(ltt_time_compare(time, block_time->begin) < 0) {
       /* go to lower part */
       high = block_num - 1;
-    } else if(ltt_time_compare(time, tf->buffer.end.timestamp) > 0) {
+    } else {
       /* go to higher part */
       low = block_num + 1;
-    } else {/* The event is right in the buffer!
-               (or in the next buffer first event) */
-      while(1) {
-        ret = ltt_tracefile_read(tf);
-        if(ret == ERANGE) goto range; /* ERANGE or EPERM */
-        else if(ret) goto fail;
-
-        if(ltt_time_compare(time, tf->event.event_time) <= 0)
-          break;
-      }
-      goto found;
     }
   }
 
 found:
+  prefetch_blocks(tf);
+  if(tf->ahead != NULL)
+    decode_ahead_restart(tf);
   return 0;
 range:
   return ERANGE;
@@ -1132,7 +1709,7 @@ int ltt_tracefile_seek_position(LttTracefile *tf, const LttEventPosition *ep)
 {
   int err;
   
-  if(ep->tracefile != tf) {
+  if(ep->tracefile != tf && ep->tracefile->handle != tf->handle) {
     goto fail;
   }
 
@@ -1141,6 +1718,7 @@ int ltt_tracefile_seek_position(LttTracefile *tf, const LttEventPosition *ep)
     g_error("Can not map block");
     goto fail;
   }
+  prefetch_blocks(tf);
 
   tf->event.offset = ep->offset;
 
@@ -1156,6 +1734,8 @@ int ltt_tracefile_seek_position(LttTracefile *tf, const LttEventPosition *ep)
   if(err) goto fail;
   */
 
+  if(tf->ahead != NULL)
+    decode_ahead_restart(tf);
   return 0;
 
 fail:
@@ -1172,17 +1752,98 @@ guint64 tsc_to_uint64(guint32 freq_scale, uint64_t start_freq, guint64 tsc)
 	return (double) tsc * NANOSECONDS_PER_SECOND * freq_scale / start_freq;
 }
 
-/* Given a TSC value, return the LttTime (seconds,nanoseconds) it
- * corresponds to.
+/*
+ * Compute the fixed point equivalent of
+ * tsc_to_uint64(freq_scale, start_freq, drift * tsc + offset).
+ *
+ * The nanoseconds per cycle ratio is kept as a 64 bits multiplier normalized
+ * so its most significant bit is set, along with the matching shift. The
+ * product is computed on 128 bits, so the conversion keeps 64 bits of
+ * precision over the whole TSC range, where the double version only has 53.
  */
-LttTime ltt_interpolate_time_from_tsc(LttTracefile *tf, guint64 tsc)
+void ltt_trace_update_clock(LttTrace *t)
 {
-	return ltt_time_from_uint64(tsc_to_uint64(tf->trace->freq_scale,
-			tf->trace->start_freq, tf->trace->drift * tsc +
-			tf->trace->offset));
+	long double ns_per_cycle, frac;
+	int exp;
+
+	if(t->start_freq == 0) {
+		t->tsc_mult = 0;
+		t->tsc_shift = 0;
+		t->tsc_offset_ns = 0;
+		t->tsc_fixed = TRUE;
+		return;
+	}
+
+	ns_per_cycle = (long double)NANOSECONDS_PER_SECOND * t->freq_scale
+		/ t->start_freq;
+	t->tsc_offset_ns = llroundl(t->offset * ns_per_cycle);
+
+	/* ns_per_cycle * drift = frac * 2^exp, frac in [0.5, 1) */
+	frac = frexpl(ns_per_cycle * t->drift, &exp);
+	t->tsc_fixed = exp <= 64 && exp > 64 - 128;
+	if(unlikely(!t->tsc_fixed)) {
+		g_warning("Clock of trace %s out of the fixed point range, "
+				"converting timestamps with doubles",
+				g_quark_to_string(t->pathname));
+		return;
+	}
+	t->tsc_mult = (uint64_t)ldexpl(frac, 64);
+	t->tsc_shift = 64 - exp;
 }
 
-/* Calculate the real event time based on the buffer boundaries */
+/* Return (a * b) >> shift, computed on 128 bits */
+static inline guint64 mul_u64_u64_shr(guint64 a, guint64 b, guint32 shift)
+{
+#ifdef __SIZEOF_INT128__
+	return (guint64)(((unsigned __int128)a * b) >> shift);
+#else
+	guint64 a_lo = (guint32)a, a_hi = a >> 32;
+	guint64 b_lo = (guint32)b, b_hi = b >> 32;
+	guint64 lo, mid1, mid2, hi;
+
+	lo = a_lo * b_lo;
+	mid1 = a_hi * b_lo;
+	mid2 = a_lo * b_hi;
+	hi = a_hi * b_hi;
+
+	/* Sum the middle terms into the high and low 64 bits */
+	mid1 += lo >> 32;
+	mid1 += (guint32)mid2;
+	hi += (mid1 >> 32) + (mid2 >> 32);
+	lo = (mid1 << 32) | (guint32)lo;
+
+	if(shift == 0)
+		return lo;
+	else if(shift < 64)
+		return (hi << (64 - shift)) | (lo >> shift);
+	else
+		return hi >> (shift - 64);
+#endif
+}
+
+guint64 ltt_trace_tsc_to_ns(LttTrace *t, guint64 tsc)
+{
+	guint64 ns;
+
+	if(unlikely(!t->tsc_fixed))
+		return tsc_to_uint64(t->freq_scale, t->start_freq,
+				t->drift * tsc + t->offset);
+	ns = mul_u64_u64_shr(tsc, t->tsc_mult, t->tsc_shift);
+
+	if(unlikely(t->tsc_offset_ns < 0 && ns < (guint64)-t->tsc_offset_ns))
+		return 0;
+	return ns + t->tsc_offset_ns;
+}
+
+/* Given a TSC value, return the LttTime (seconds,nanoseconds) it
+ * corresponds to.
+ */
+LttTime ltt_interpolate_time_from_tsc(LttTracefile *tf, guint64 tsc)
+{
+	return ltt_time_from_uint64(ltt_trace_tsc_to_ns(tf->trace, tsc));
+}
+
+/* Calculate the real event time based on the buffer boundaries */
 LttTime ltt_interpolate_time(LttTracefile *tf, LttEvent *event)
 {
   return ltt_interpolate_time_from_tsc(tf, tf->buffer.tsc);
@@ -1223,6 +1884,9 @@ int ltt_tracefile_read(LttTracefile *tf)
 {
   int err;
 
+  if(tf->ahead != NULL)
+    return decode_ahead_read(tf);
+
   err = ltt_tracefile_read_seek(tf);
   if(err) return err;
   err = ltt_tracefile_read_update_event(tf);
@@ -1240,6 +1904,11 @@ int ltt_tracefile_read_seek(LttTracefile *tf)
 {
   int err;
 
+  if(unlikely(tf->buffer.head == NULL)) {
+    err = map_first_block(tf);
+    if(err) return err;
+  }
+
   /* Get next buffer until we finally have an event, or end of trace */
   while(1) {
     err = ltt_seek_next_event(tf);
@@ -1258,6 +1927,7 @@ int ltt_tracefile_read_seek(LttTracefile *tf)
           g_error("Can not map block");
           return EPERM;
         }
+        prefetch_blocks(tf);
       }
     } else break; /* We found an event ! */
   }
@@ -1316,55 +1986,49 @@ static void print_debug_event_header(LttEvent *ev, void *start_pos, void *end_po
 }
 
 
-/* same as ltt_tracefile_read, but does not seek to the next event nor call
- * event specific operation. */
-int ltt_tracefile_read_update_event(LttTracefile *tf)
+/*
+ * Decode the event header at pos, which is aligned, and update the tracefile
+ * tsc. Returns the position following the header. reverse_bo is a
+ * compile-time constant in the specialized decoders below, so the byte order
+ * tests of ltt_get_uint* are optimized away.
+ */
+static inline void *read_event_header(LttTracefile *tf, void *pos,
+                                      gboolean reverse_bo)
 {
-  void * pos;
-  LttEvent *event;
-  void *pos_aligned;
+  LttEvent *event = &tf->event;
   guint16 packed_evid;	/* event id reader from the 5 bits in header */
- 
-  event = &tf->event;
-  pos = tf->buffer.head + event->offset;
 
-  /* Read event header */
-  
-  /* Align the head */
-  pos += ltt_align((size_t)pos, sizeof(guint32), tf->alignment);
-  pos_aligned = pos;
-  
-  event->timestamp = ltt_get_uint32(LTT_GET_BO(tf), pos);
+  event->timestamp = ltt_get_uint32(reverse_bo, pos);
   event->event_id = packed_evid = event->timestamp >> tf->tscbits;
   event->timestamp = event->timestamp & tf->tsc_mask;
   pos += sizeof(guint32);
 
   switch (packed_evid) {
   case 29:  /* LTT_RFLAG_ID_SIZE_TSC */
-    event->event_id = ltt_get_uint16(LTT_GET_BO(tf), pos);
+    event->event_id = ltt_get_uint16(reverse_bo, pos);
     pos += sizeof(guint16);
-    event->event_size = ltt_get_uint16(LTT_GET_BO(tf), pos);
+    event->event_size = ltt_get_uint16(reverse_bo, pos);
     pos += sizeof(guint16);
     if (event->event_size == 0xFFFF) {
-      event->event_size = ltt_get_uint32(LTT_GET_BO(tf), pos);
+      event->event_size = ltt_get_uint32(reverse_bo, pos);
       pos += sizeof(guint32);
     }
     pos += ltt_align((size_t)pos, sizeof(guint64), tf->alignment);
-    tf->buffer.tsc = ltt_get_uint64(LTT_GET_BO(tf), pos);
+    tf->buffer.tsc = ltt_get_uint64(reverse_bo, pos);
     pos += sizeof(guint64);
     break;
   case 30:  /* LTT_RFLAG_ID_SIZE */
-    event->event_id = ltt_get_uint16(LTT_GET_BO(tf), pos);
+    event->event_id = ltt_get_uint16(reverse_bo, pos);
     pos += sizeof(guint16);
-    event->event_size = ltt_get_uint16(LTT_GET_BO(tf), pos);
+    event->event_size = ltt_get_uint16(reverse_bo, pos);
     pos += sizeof(guint16);
     if (event->event_size == 0xFFFF) {
-      event->event_size = ltt_get_uint32(LTT_GET_BO(tf), pos);
+      event->event_size = ltt_get_uint32(reverse_bo, pos);
       pos += sizeof(guint32);
     }
     break;
   case 31: /* LTT_RFLAG_ID */
-    event->event_id = ltt_get_uint16(LTT_GET_BO(tf), pos);
+    event->event_id = ltt_get_uint16(reverse_bo, pos);
     pos += sizeof(guint16);
     event->event_size = G_MAXUINT;
     break;
@@ -1383,6 +2047,53 @@ int ltt_tracefile_read_update_event(LttTracefile *tf)
         tf->buffer.tsc = (tf->buffer.tsc & ~tf->tsc_mask)   /* no overflow */
                                 | (guint64)event->timestamp;
   }
+  return pos;
+}
+
+static void *read_event_header_native(LttTracefile *tf, void *pos)
+{
+  return read_event_header(tf, pos, 0);
+}
+
+static void *read_event_header_reverse(LttTracefile *tf, void *pos)
+{
+  return read_event_header(tf, pos, 1);
+}
+
+static void *read_event_header_generic(LttTracefile *tf, void *pos)
+{
+  return read_event_header(tf, pos, LTT_GET_BO(tf));
+}
+
+void ltt_tracefile_specialized_decode(LttTracefile *tf, int state)
+{
+  if(!state)
+    tf->read_event_header = read_event_header_generic;
+  else if(LTT_GET_BO(tf))
+    tf->read_event_header = read_event_header_reverse;
+  else
+    tf->read_event_header = read_event_header_native;
+}
+
+/* same as ltt_tracefile_read, but does not seek to the next event nor call
+ * event specific operation. */
+int ltt_tracefile_read_update_event(LttTracefile *tf)
+{
+  void * pos;
+  LttEvent *event;
+  void *pos_aligned;
+ 
+  event = &tf->event;
+  pos = tf->buffer.head + event->offset;
+
+  /* Read event header */
+  
+  /* Align the head */
+  pos += ltt_align((size_t)pos, sizeof(guint32), tf->alignment);
+  pos_aligned = pos;
+  
+  pos = tf->read_event_header(tf, pos);
+
   event->tsc = tf->buffer.tsc;
 
   event->event_time = ltt_interpolate_time(tf, event);
@@ -1415,6 +2126,109 @@ int ltt_tracefile_read_update_event(LttTracefile *tf)
  *    EIO             : can not read from the file
  ****************************************************************************/
 
+/*
+ * Make sure the mapping window of the tracefile covers the file range
+ * [offset, offset + size). On 64-bit hosts, the window is the whole file and is
+ * mapped only once. Otherwise, windows of LTT_MAP_WINDOW_SIZE bytes are used.
+ */
+static gint map_window(LttTracefile *tf, uint64_t offset, uint32_t size)
+{
+  int page_size = getpagesize();
+  uint64_t win_offset, win_size;
+
+  if(likely(tf->map_head != NULL && offset >= tf->map_offset
+      && offset + size <= tf->map_offset + tf->map_size))
+    return 0;
+
+  if(tf->map_head != NULL) {
+    if(munmap(tf->map_head, tf->map_size)) {
+      g_warning("unmap size : %zu\n", tf->map_size);
+      perror("munmap error");
+      g_assert(0);
+    }
+    tf->map_head = NULL;
+  }
+
+  if(sizeof(void *) > sizeof(guint32)) {
+    win_offset = 0;
+    win_size = tf->file_size;
+  } else {
+    win_offset = offset & PAGE_MASK;
+    win_size = max((uint64_t)LTT_MAP_WINDOW_SIZE, offset + size - win_offset);
+    win_size = min(win_size, (uint64_t)tf->file_size - win_offset);
+  }
+
+  tf->map_head = mmap(0, (size_t)win_size, PROT_READ, MAP_PRIVATE,
+                      tf->fd, (off_t)win_offset);
+  if(tf->map_head == MAP_FAILED) {
+    perror("Error in allocating memory for tracefile mapping window");
+    tf->map_head = NULL;
+    return -errno;
+  }
+  tf->map_offset = win_offset;
+  tf->map_size = (size_t)win_size;
+  madvise(tf->map_head, tf->map_size, MADV_SEQUENTIAL);
+  return 0;
+}
+
+/*
+ * Start reading the subbuffers that follow the current one so they are in the
+ * page cache by the time sequential reading maps them. This is called after
+ * the block change of sequential reads and after seeks, not from map_block,
+ * so the blocks probed by the seek_time binary search are not prefetched.
+ *
+ * Blocks are requested a_readahead_blocks at a time, once half of the
+ * previous request has been consumed, to keep the number of system calls low.
+ */
+static void prefetch_blocks(LttTracefile *tf)
+{
+  guint cur = tf->buffer.index;
+  guint first, last;
+  LttBlockIndex *first_index, *last_index;
+
+  if(a_readahead_blocks == 0)
+    return;
+
+  if(tf->readahead_next > cur
+      && tf->readahead_next <= cur + a_readahead_blocks + 1) {
+    /* Still in the prefetched range (sequential reading) */
+    if(tf->readahead_next - cur > a_readahead_blocks / 2 + 1)
+      return;
+    first = tf->readahead_next;
+  } else {
+    /* We have been moved elsewhere by a seek */
+    first = cur + 1;
+  }
+  last = min(cur + a_readahead_blocks, tf->num_blocks - 1);
+  if(first > last)
+    return;
+
+  first_index = &g_array_index(tf->buf_index, LttBlockIndex, first);
+  last_index = &g_array_index(tf->buf_index, LttBlockIndex, last);
+  /* Only a hint : failure is harmless */
+  posix_fadvise(tf->fd, (off_t)first_index->offset,
+                (off_t)(last_index->offset + last_index->size
+                        - first_index->offset),
+                POSIX_FADV_WILLNEED);
+  tf->readahead_next = last + 1;
+}
+
+/*
+ * Map the first block of a tracefile which was not read yet, or which had no
+ * subbuffer when it was opened. Returns ERANGE while it still has none.
+ */
+static int map_first_block(LttTracefile *tf)
+{
+  if(tf->num_blocks == 0)
+    return ERANGE;
+  if(unlikely(map_block(tf, 0))) {
+    g_error("Can not map block");
+    return EPERM;
+  }
+  prefetch_blocks(tf);
+  return 0;
+}
+
 static gint map_block(LttTracefile * tf, guint block_num)
 {
   int page_size = getpagesize();
@@ -1425,29 +2239,66 @@ static gint map_block(LttTracefile * tf, guint block_num)
 
   g_assert(block_num < tf->num_blocks);
 
-  if(tf->buffer.head != NULL) {
-    if(munmap(tf->buffer.head, PAGE_ALIGN(tf->buffer.size))) {
-    g_warning("unmap size : %u\n",
-        PAGE_ALIGN(tf->buffer.size));
-      perror("munmap error");
-      g_assert(0);
-    }
-  }
-
   ret = get_block_offset_size(tf, block_num, &offset, &size);
   g_assert(!ret);
 
   g_debug("Map block %u, offset %llu, size %u\n", block_num,
           (unsigned long long)offset, (unsigned int)size);
 
-  /* Multiple of pages aligned head */
-  tf->buffer.head = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE,
-                         tf->fd, (off_t)offset);
+  if(a_map_whole) {
+    /* Release a block mapped while the mode was off */
+    if(tf->map_head == NULL && tf->buffer.head != NULL) {
+      if(munmap(tf->buffer.head, PAGE_ALIGN(tf->buffer.size))) {
+        g_warning("unmap size : %u\n", PAGE_ALIGN(tf->buffer.size));
+        perror("munmap error");
+        g_assert(0);
+      }
+    }
+    tf->buffer.head = NULL;
+    ret = map_window(tf, offset, size);
+    if(ret) {
+      g_assert(0);
+      return ret;
+    }
+    tf->buffer.head = (char*)tf->map_head + (offset - tf->map_offset);
 
-  if(tf->buffer.head == MAP_FAILED) {
-    perror("Error in allocating memory for buffer of tracefile");
-    g_assert(0);
-    goto map_error;
+    /* Ask for the next subbuffer, sequential reading will need it soon */
+    if(block_num + 1 < tf->num_blocks) {
+      uint64_t next_offset;
+      uint32_t next_size;
+
+      get_block_offset_size(tf, block_num + 1, &next_offset, &next_size);
+      if(next_offset + next_size <= tf->map_offset + tf->map_size)
+        madvise((char*)tf->map_head + (next_offset - tf->map_offset), next_size,
+                MADV_WILLNEED);
+    }
+  } else {
+    if(tf->map_head != NULL) {
+      /* Release the window mapped while the mode was on */
+      if(munmap(tf->map_head, tf->map_size)) {
+        g_warning("unmap size : %zu\n", tf->map_size);
+        perror("munmap error");
+        g_assert(0);
+      }
+      tf->map_head = NULL;
+    } else if(tf->buffer.head != NULL) {
+      if(munmap(tf->buffer.head, PAGE_ALIGN(tf->buffer.size))) {
+      g_warning("unmap size : %u\n",
+          PAGE_ALIGN(tf->buffer.size));
+        perror("munmap error");
+        g_assert(0);
+      }
+    }
+
+    /* Multiple of pages aligned head */
+    tf->buffer.head = mmap(0, (size_t)size, PROT_READ, MAP_PRIVATE,
+                           tf->fd, (off_t)offset);
+
+    if(tf->buffer.head == MAP_FAILED) {
+      perror("Error in allocating memory for buffer of tracefile");
+      g_assert(0);
+      goto map_error;
+    }
   }
   g_assert( ( (gulong)tf->buffer.head&(8-1) ) == 0); // make sure it's aligned.
 
@@ -1592,19 +2443,33 @@ void ltt_update_event_size(LttTracefile *tf)
 
   /* Do not update field offsets of core markers when initially reading the
    * metadata tracefile when the infos about these markers do not exist yet.
+   * The offsets of the previous event must not be left to this one.
    */
+  tf->event.fields_offsets = NULL;
   if (likely(info && info->fields)) {
     /* alignment */
     tf->event.data += ltt_align((off_t)(unsigned long)tf->event.data,
     			     info->largest_align,
                              info->alignment);
-    /* size, dynamically computed */
-    if (info->size != -1)
+    if (likely(info->size != -1)) {
+      /* Static layout : use the offsets of the marker */
       size = info->size;
-    else
-      size = marker_update_fields_offsets(info, tf->event.data);
-    /* Update per-tracefile offsets */
-    marker_update_event_fields_offsets(tf->event.fields_offsets, info);
+      tf->event.fields_offsets = info->static_offsets;
+    } else if (a_lazy_decode && !a_event_debug
+               && tf->event.event_size != G_MAXUINT) {
+      /* The header gives the size : the offsets are computed by
+       * ltt_event_resolve_fields if a field is ever read. */
+      size = tf->event.event_size;
+      tf->event.fields_offsets = NULL;
+    } else {
+      /* size and offsets, dynamically computed in the event table */
+      tf->event.dynamic_offsets = g_array_set_size(tf->event.dynamic_offsets,
+                                                   info->fields->len);
+      tf->event.fields_offsets =
+          (struct LttField *)tf->event.dynamic_offsets->data;
+      size = marker_layout_event_fields(info, tf->event.data,
+                                        tf->event.fields_offsets);
+    }
   }
 
   tf->event.data_size = size;
@@ -1632,6 +2497,717 @@ void ltt_update_event_size(LttTracefile *tf)
 }
 
 
+void ltt_event_resolve_fields(LttEvent *e)
+{
+  LttTracefile *tf = e->tracefile;
+  struct marker_info *info;
+  long size;
+
+  info = marker_get_info_from_id(tf->mdata, e->event_id);
+  if (info == NULL || info->fields == NULL)
+    g_error("No field description for event %hu in channel %s", e->event_id,
+        g_quark_to_string(tf->name));
+  g_assert(info->size == -1);
+  e->dynamic_offsets = g_array_set_size(e->dynamic_offsets, info->fields->len);
+  e->fields_offsets = (struct LttField *)e->dynamic_offsets->data;
+  size = marker_layout_event_fields(info, e->data, e->fields_offsets);
+  if (size != e->data_size)
+    g_error("Kernel/LTTV event size differs for event %s: kernel %u, LTTV %ld",
+        g_quark_to_string(info->name), e->data_size, size);
+}
+
+
+LttEventBatch *ltt_event_batch_new(void)
+{
+  return g_new0(LttEventBatch, 1);
+}
+
+void ltt_event_batch_destroy(LttEventBatch *batch)
+{
+  g_free(batch->tsc);
+  g_free(batch->time);
+  g_free(batch->event_id);
+  g_free(batch->offset);
+  g_free(batch->data_offset);
+  g_free(batch->data_size);
+  g_free(batch->event_size);
+  g_free(batch);
+}
+
+static void event_batch_grow(LttEventBatch *batch)
+{
+  batch->alloc = max(batch->alloc * 2, 256U);
+  batch->tsc = g_renew(guint64, batch->tsc, batch->alloc);
+  batch->time = g_renew(LttTime, batch->time, batch->alloc);
+  batch->event_id = g_renew(guint16, batch->event_id, batch->alloc);
+  batch->offset = g_renew(guint32, batch->offset, batch->alloc);
+  batch->data_offset = g_renew(guint32, batch->data_offset, batch->alloc);
+  batch->data_size = g_renew(guint32, batch->data_size, batch->alloc);
+  batch->event_size = g_renew(guint32, batch->event_size, batch->alloc);
+}
+
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_read_block_batch : Decode all the events of a block
+ *Input params
+ *    tf                  : tracefile
+ *    block_num           : block to decode
+ *    batch               : event batch filled with the events of the block
+ *Return value
+ *
+ *    Returns 0 on success, ERANGE if the block does not exist, EPERM on error.
+ *
+ *    The events are decoded by the same code as ltt_tracefile_read, using
+ *    tf->event as scratch space. The tracefile is left at the end of the
+ *    block, so ltt_tracefile_read continues with the next block. When the
+ *    tracefile is decoded ahead, the workers are waited for and restart
+ *    after the block.
+ ****************************************************************************/
+
+int ltt_tracefile_read_block_batch(LttTracefile *tf, guint block_num,
+    LttEventBatch *batch)
+{
+  LttEvent *event = &tf->event;
+  int err;
+  guint i;
+
+  batch->tracefile = tf;
+  batch->block = block_num;
+  batch->len = 0;
+  batch->next = 0;
+
+  if(unlikely(block_num >= tf->num_blocks))
+    return ERANGE;
+
+  /* The events replayed from the ring would not follow this block */
+  if(tf->ahead != NULL)
+    decode_ahead_move(tf, block_num + 1);
+
+  err = map_block(tf, block_num);
+  if(unlikely(err)) {
+    g_error("Can not map block");
+    return EPERM;
+  }
+  prefetch_blocks(tf);
+
+  while(1) {
+    err = ltt_seek_next_event(tf);
+    if(err == ERANGE)
+      break;
+    if(unlikely(err))
+      return EPERM;
+    err = ltt_tracefile_read_update_event(tf);
+    if(unlikely(err))
+      return EPERM;
+
+    if(unlikely(batch->len == batch->alloc))
+      event_batch_grow(batch);
+    i = batch->len++;
+    batch->tsc[i] = event->tsc;
+    batch->time[i] = event->event_time;
+    batch->event_id[i] = event->event_id;
+    batch->offset[i] = event->offset;
+    batch->data_offset[i] = event->data - tf->buffer.head;
+    batch->data_size[i] = event->data_size;
+    batch->event_size[i] = event->event_size;
+  }
+  return 0;
+}
+
+
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_read_batched : read the next event of a tracefile from the
+ *                                 events of its subbuffer decoded in bulk
+ *Input params
+ *    tf                  : tracefile
+ *    batch               : event batch of the tracefile, reused from one call
+ *                          to the next
+ *Return value
+ *
+ *    Same as ltt_tracefile_read.
+ *
+ *    The subbuffer of the next event is decoded into batch, whose events are
+ *    then made current one after the other. When the tracefile was moved
+ *    since the last event taken from batch, its subbuffer is decoded again
+ *    and reading goes on after its current event.
+ ****************************************************************************/
+
+int ltt_tracefile_read_batched(LttTracefile *tf, LttEventBatch *batch)
+{
+  guint block, low, high, mid;
+  guint32 offset;
+  int err;
+
+  /* The decode pipeline already reads in batches */
+  if(tf->ahead != NULL)
+    return decode_ahead_read(tf);
+
+  if(unlikely(tf->buffer.head == NULL)) {
+    err = map_first_block(tf);
+    if(err) return err;
+  }
+
+  if(likely(batch->tracefile == tf && batch->next > 0
+      && tf->buffer.index == batch->block
+      && tf->event.offset == batch->offset[batch->next - 1])) {
+    if(likely(batch->next < batch->len))
+      return batch_set_event(tf, batch, batch->next++);
+    block = batch->block + 1;
+    offset = 0;
+  } else {
+    block = tf->buffer.index;
+    offset = tf->event.offset;
+  }
+
+  while(1) {
+    err = ltt_tracefile_read_block_batch(tf, block, batch);
+    if(unlikely(err))
+      return err;
+    /* First event after offset */
+    low = 0;
+    high = batch->len;
+    while(low < high) {
+      mid = (low + high) / 2;
+      if(batch->offset[mid] <= offset)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    if(likely(low < batch->len)) {
+      batch->next = low + 1;
+      return batch_set_event(tf, batch, low);
+    }
+    block++;
+    offset = 0;
+  }
+}
+
+
+/*
+ * Backward reading.
+ *
+ * The events of a subbuffer can only be decoded forward : the offset and full
+ * timestamp counter of each of them are recorded the first time a tracefile
+ * goes backward in the subbuffer, by a private cursor. The tables of the last
+ * LTT_PREV_CACHE_BLOCKS subbuffers used are kept. Subbuffers never change once
+ * indexed, so the tables stay valid when the block index grows.
+ */
+#define LTT_PREV_CACHE_BLOCKS 8
+
+struct block_events {
+  guint block;                       /* G_MAXUINT when the entry is unused */
+  guint len;                         /* Number of events */
+  guint32 *offset;                   /* Event offset in the subbuffer */
+  guint64 *tsc;                      /* Full timestamp counter of the event */
+  guint64 last_use;
+};
+
+struct prev_cache {
+  LttTracefile *scan;                /* Cursor decoding the subbuffers */
+  LttEventBatch *batch;
+  guint64 clock;
+  struct block_events blocks[LTT_PREV_CACHE_BLOCKS];
+};
+
+static void prev_cache_free(LttTracefile *tf)
+{
+  struct prev_cache *c = tf->prev_cache;
+  guint i;
+
+  if(c == NULL)
+    return;
+  for(i = 0; i < LTT_PREV_CACHE_BLOCKS; i++) {
+    g_free(c->blocks[i].offset);
+    g_free(c->blocks[i].tsc);
+  }
+  if(c->scan != NULL) {
+    ltt_tracefile_cursor_destroy(c->scan);
+    ltt_event_batch_destroy(c->batch);
+  }
+  g_free(c);
+  tf->prev_cache = NULL;
+}
+
+/* Event table of a subbuffer, from the cache or decoded */
+static struct block_events *block_events_get(LttTracefile *tf, guint block)
+{
+  struct prev_cache *c = tf->prev_cache;
+  struct block_events *b, *lru;
+  guint i;
+
+  if(unlikely(c == NULL)) {
+    c = tf->prev_cache = g_new0(struct prev_cache, 1);
+    for(i = 0; i < LTT_PREV_CACHE_BLOCKS; i++)
+      c->blocks[i].block = G_MAXUINT;
+  }
+  c->clock++;
+
+  lru = &c->blocks[0];
+  for(i = 0; i < LTT_PREV_CACHE_BLOCKS; i++) {
+    b = &c->blocks[i];
+    if(b->block == block) {
+      b->last_use = c->clock;
+      return b;
+    }
+    if(b->last_use < lru->last_use)
+      lru = b;
+  }
+
+  if(c->scan == NULL) {
+    c->scan = ltt_tracefile_cursor_new(tf);
+    c->batch = ltt_event_batch_new();
+  }
+  c->scan->num_blocks = tf->num_blocks;
+  c->scan->file_size = tf->file_size;
+  if(ltt_tracefile_read_block_batch(c->scan, block, c->batch))
+    return NULL;
+
+  lru->block = block;
+  lru->len = c->batch->len;
+  lru->offset = g_renew(guint32, lru->offset, lru->len);
+  lru->tsc = g_renew(guint64, lru->tsc, lru->len);
+  memcpy(lru->offset, c->batch->offset, lru->len * sizeof(guint32));
+  memcpy(lru->tsc, c->batch->tsc, lru->len * sizeof(guint64));
+  lru->last_use = c->clock;
+  return lru;
+}
+
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_read_prev : Read the previous event in the tracefile
+ *Input params
+ *    tf                  : tracefile
+ *Return value
+ *
+ *    Returns 0 if the previous event became the current one, ERANGE if the
+ *    current event is the first of the tracefile, EPERM on error. The
+ *    tracefile is left unchanged on ERANGE.
+ *
+ *    After ltt_tracefile_seek_end, the previous event is the last one of the
+ *    tracefile. ltt_tracefile_read goes forward again from the event read.
+ ****************************************************************************/
+
+int ltt_tracefile_read_prev(LttTracefile *tf)
+{
+  struct block_events *b;
+  guint block = tf->buffer.index;
+  guint offset = tf->event.offset;
+  guint low, high, mid;
+  int err;
+
+  if(unlikely(tf->buffer.head == NULL))
+    return ERANGE;
+
+  while(1) {
+    b = block_events_get(tf, block);
+    if(unlikely(b == NULL))
+      return EPERM;
+    /* Count the events before offset */
+    low = 0;
+    high = b->len;
+    while(low < high) {
+      mid = (low + high) / 2;
+      if(b->offset[mid] < offset)
+        low = mid + 1;
+      else
+        high = mid;
+    }
+    if(likely(low > 0))
+      break;
+    if(block == 0)
+      return ERANGE;
+    block--;
+    offset = G_MAXUINT;
+  }
+
+  if(tf->buffer.index != block) {
+    err = map_block(tf, block);
+    if(unlikely(err)) {
+      g_error("Can not map block");
+      return EPERM;
+    }
+  }
+  tf->event.offset = b->offset[low - 1];
+  tf->event.tsc = tf->buffer.tsc = b->tsc[low - 1];
+  err = ltt_tracefile_read_update_event(tf);
+  if(unlikely(err))
+    return EPERM;
+
+  if(tf->ahead != NULL)
+    decode_ahead_restart(tf);
+  return 0;
+}
+
+/* Seek after the last event of the tracefile : ltt_tracefile_read then returns
+ * ERANGE and ltt_tracefile_read_prev the last event. */
+int ltt_tracefile_seek_end(LttTracefile *tf)
+{
+  int err;
+
+  /* Nothing was written : reads start at the first subbuffer to come */
+  if(unlikely(tf->num_blocks == 0))
+    return 0;
+
+  err = map_block(tf, tf->num_blocks - 1);
+  if(unlikely(err)) {
+    g_error("Can not map block");
+    return EPERM;
+  }
+  tf->event.offset = tf->buffer.data_size;
+  tf->event.data = (char*)tf->buffer.head + tf->buffer.data_size;
+  tf->event.data_size = 0;
+
+  if(tf->ahead != NULL)
+    decode_ahead_restart(tf);
+  return 0;
+}
+
+/*
+ * Decode pipeline.
+ *
+ * Worker threads decode the subbuffers following the one a tracefile is
+ * reading into a ring of event batches, using a private copy of the
+ * tracefile which has its own mapping and field offsets table. Reads replay
+ * the decoded events into the tracefile : it is left in the same state as if
+ * it had decoded them itself, so the events, their order and everything
+ * hooks can read from them are unchanged.
+ *
+ * The ring always holds consecutive subbuffers. When the tracefile needs a
+ * subbuffer which is not the first one of the ring, because it was seeked,
+ * the ring is emptied and decoding restarts from that subbuffer.
+ *
+ * All the ring fields are protected by the pool lock.
+ */
+#define LTT_DECODE_RING_BLOCKS 4
+
+struct decode_ahead {
+  LttTracefile *decoder;             /* Tracefile copy used by the workers */
+  LttEventBatch *ring[LTT_DECODE_RING_BLOCKS];
+  int ring_err[LTT_DECODE_RING_BLOCKS];
+  guint head;                        /* Slot of the first subbuffer */
+  guint count;                       /* Decoded slots, including the one being
+                                        replayed */
+  guint first_block;                 /* Subbuffer in the head slot */
+  guint next_block;                  /* Next subbuffer to decode */
+  gboolean busy;                     /* A worker is decoding a slot */
+  pthread_cond_t done;               /* A slot was decoded */
+
+  LttEventBatch *batch;              /* Batch being replayed (head slot), NULL
+                                        when reading from the tracefile */
+  guint batch_event;                 /* Next event of batch to replay */
+};
+
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;               /* A ring has room, or the workers are
+                                        stopped */
+  GPtrArray *tracefiles;             /* Tracefiles decoded ahead */
+  guint next;                        /* Where the workers look for work first */
+  pthread_t *threads;
+  guint nb_threads;
+  guint generation;                  /* Incremented to stop the workers : a
+                                        worker runs while it is the one it
+                                        was started with */
+} decode_pool = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+};
+
+static void *decode_pool_worker(void *data)
+{
+  guint generation = GPOINTER_TO_UINT(data);
+  struct decode_ahead *a;
+  LttTracefile *tf;
+  guint i, slot, block;
+  int err;
+
+  pthread_mutex_lock(&decode_pool.lock);
+  while(decode_pool.generation == generation) {
+    /* Find a ring with room, round robin among the tracefiles */
+    a = NULL;
+    for(i = 0; i < decode_pool.tracefiles->len; i++) {
+      tf = g_ptr_array_index(decode_pool.tracefiles,
+          (decode_pool.next + i) % decode_pool.tracefiles->len);
+      if(!tf->ahead->busy && tf->ahead->count < LTT_DECODE_RING_BLOCKS
+          && tf->ahead->next_block < tf->num_blocks) {
+        a = tf->ahead;
+        decode_pool.next += i + 1;
+        break;
+      }
+    }
+    if(a == NULL) {
+      pthread_cond_wait(&decode_pool.work, &decode_pool.lock);
+      continue;
+    }
+
+    slot = (a->head + a->count) % LTT_DECODE_RING_BLOCKS;
+    block = a->next_block++;
+    a->busy = TRUE;
+    pthread_mutex_unlock(&decode_pool.lock);
+
+    err = ltt_tracefile_read_block_batch(a->decoder, block, a->ring[slot]);
+
+    pthread_mutex_lock(&decode_pool.lock);
+    a->busy = FALSE;
+    a->ring_err[slot] = err;
+    a->count++;
+    pthread_cond_broadcast(&a->done);
+  }
+  pthread_mutex_unlock(&decode_pool.lock);
+  return NULL;
+}
+
+/* Empty the ring, decoding restarts at block. Called with the pool lock. */
+static void decode_ahead_reset(struct decode_ahead *a, guint block)
+{
+  while(a->busy)
+    pthread_cond_wait(&a->done, &decode_pool.lock);
+  a->head = 0;
+  a->count = 0;
+  a->first_block = a->next_block = block;
+  a->batch = NULL;
+  pthread_cond_broadcast(&decode_pool.work);
+}
+
+/* Restart decoding after the subbuffer the tracefile was seeked in */
+static void decode_ahead_restart(LttTracefile *tf)
+{
+  struct decode_ahead *a = tf->ahead;
+
+  pthread_mutex_lock(&decode_pool.lock);
+  if(a->batch != NULL || a->first_block != tf->buffer.index + 1)
+    decode_ahead_reset(a, tf->buffer.index + 1);
+  pthread_mutex_unlock(&decode_pool.lock);
+}
+
+/* Wait for the workers, then restart decoding at block */
+static void decode_ahead_move(LttTracefile *tf, guint block)
+{
+  pthread_mutex_lock(&decode_pool.lock);
+  decode_ahead_reset(tf->ahead, block);
+  pthread_mutex_unlock(&decode_pool.lock);
+}
+
+/* Give the slot of the batch replayed back to the workers */
+static void decode_ahead_release(LttTracefile *tf)
+{
+  struct decode_ahead *a = tf->ahead;
+
+  pthread_mutex_lock(&decode_pool.lock);
+  a->batch = NULL;
+  a->head = (a->head + 1) % LTT_DECODE_RING_BLOCKS;
+  a->count--;
+  a->first_block++;
+  pthread_cond_broadcast(&decode_pool.work);
+  pthread_mutex_unlock(&decode_pool.lock);
+}
+
+/* Wait for the batch of block, which becomes the batch replayed */
+static LttEventBatch *decode_ahead_take(LttTracefile *tf, guint block,
+    int *err)
+{
+  struct decode_ahead *a = tf->ahead;
+
+  pthread_mutex_lock(&decode_pool.lock);
+  if(a->first_block != block)
+    decode_ahead_reset(a, block);
+  while(a->count == 0)
+    pthread_cond_wait(&a->done, &decode_pool.lock);
+  a->batch = a->ring[a->head];
+  a->batch_event = 0;
+  *err = a->ring_err[a->head];
+  pthread_mutex_unlock(&decode_pool.lock);
+  return a->batch;
+}
+
+/* Make event i of batch the current event of the tracefile */
+static int batch_set_event(LttTracefile *tf, LttEventBatch *batch,
+    guint i)
+{
+  LttEvent *event = &tf->event;
+  struct marker_info *info;
+
+  if(unlikely(tf->buffer.index != batch->block)) {
+    if(unlikely(map_block(tf, batch->block))) {
+      g_error("Can not map block");
+      return EPERM;
+    }
+  }
+  event->offset = batch->offset[i];
+  event->tsc = tf->buffer.tsc = batch->tsc[i];
+  event->timestamp = batch->tsc[i] & tf->tsc_mask;
+  event->event_id = batch->event_id[i];
+  event->event_time = batch->time[i];
+  event->data = (char*)tf->buffer.head + batch->data_offset[i];
+  event->data_size = batch->data_size[i];
+  event->event_size = batch->event_size[i];
+  /* Dynamic layouts are computed by ltt_event_resolve_fields if needed */
+  info = marker_get_info_from_id(tf->mdata, event->event_id);
+  if(info != NULL && info->size != -1)
+    event->fields_offsets = info->static_offsets;
+  else
+    event->fields_offsets = NULL;
+  return 0;
+}
+
+static void group_decode_ahead(GQuark name, gpointer data, gpointer user_data)
+{
+  GArray *group = (GArray *)data;
+  guint i;
+
+  for(i = 0; i < group->len; i++)
+    ltt_tracefile_decode_ahead(&g_array_index(group, LttTracefile, i),
+                               GPOINTER_TO_INT(user_data));
+}
+
+/* ltt_tracefile_read for a tracefile decoded ahead */
+static int decode_ahead_read(LttTracefile *tf)
+{
+  struct decode_ahead *a = tf->ahead;
+  LttEventBatch *batch = a->batch;
+  guint block;
+  int err;
+
+  if(batch != NULL) {
+    /* Go on replaying, unless the tracefile was moved since the last event */
+    if(likely(a->batch_event < batch->len
+        && tf->buffer.index == batch->block
+        && tf->event.offset == batch->offset[a->batch_event - 1]))
+      return batch_set_event(tf, batch, a->batch_event++);
+    decode_ahead_release(tf);
+  }
+
+  if(unlikely(tf->buffer.head == NULL)) {
+    err = map_first_block(tf);
+    if(err) return err;
+  }
+
+  while(1) {
+    /* Events left in the subbuffer of the tracefile */
+    err = ltt_seek_next_event(tf);
+    if(unlikely(err == ENOPROTOOPT))
+      return EPERM;
+    if(err != ERANGE)
+      return ltt_tracefile_read_update_event(tf);
+    if(unlikely(tf->buffer.index == tf->num_blocks - 1))
+      return ERANGE;
+
+    batch = decode_ahead_take(tf, tf->buffer.index + 1, &err);
+    if(unlikely(err))
+      return EPERM;
+    if(likely(batch->len > 0)) {
+      a->batch_event = 1;
+      return batch_set_event(tf, batch, 0);
+    }
+    /* Empty subbuffer */
+    block = batch->block;
+    decode_ahead_release(tf);
+    if(unlikely(map_block(tf, block))) {
+      g_error("Can not map block");
+      return EPERM;
+    }
+  }
+}
+
+/*****************************************************************************
+ *Function name
+ *    ltt_tracefile_decode_ahead : attach or detach a tracefile from the
+ *                                 decode pipeline
+ *Input params
+ *    tf                  : tracefile
+ *    state               : 1 to decode ahead, 0 to stop
+ *Return value
+ *
+ *    Returns 0 on success, EPERM if the pipeline can not be used.
+ *
+ *    The first tracefile attached starts the worker threads (the number set
+ *    by ltt_tracefile_decode_threads, 1 if it is 0), the last one detached
+ *    stops them. The metadata tracefile is always decoded by the reader.
+ ****************************************************************************/
+
+int ltt_tracefile_decode_ahead(LttTracefile *tf, int state)
+{
+  int page_size = getpagesize();
+  struct decode_ahead *a = tf->ahead;
+  LttTracefile *decoder;
+  pthread_t *threads = NULL;
+  guint i, nb_threads = 0;
+
+  if(state && a == NULL) {
+    if(tf->name == LTT_TRACEFILE_NAME_METADATA || !tf->cpu_online)
+      return EPERM;
+
+    decoder = ltt_tracefile_cursor_new(tf);
+    /* Decode the blocks the reader's copy of the index has */
+    decoder->num_blocks = tf->num_blocks;
+    decoder->file_size = tf->file_size;
+
+    a = g_new0(struct decode_ahead, 1);
+    a->decoder = decoder;
+    for(i = 0; i < LTT_DECODE_RING_BLOCKS; i++)
+      a->ring[i] = ltt_event_batch_new();
+    pthread_cond_init(&a->done, NULL);
+    a->first_block = a->next_block = tf->buffer.index + 1;
+
+    pthread_mutex_lock(&decode_pool.lock);
+    if(decode_pool.tracefiles == NULL)
+      decode_pool.tracefiles = g_ptr_array_new();
+    if(decode_pool.nb_threads == 0) {
+      nb_threads = max(a_decode_threads, 1U);
+      decode_pool.threads = g_new(pthread_t, nb_threads);
+      for(i = 0; i < nb_threads; i++) {
+        if(pthread_create(&decode_pool.threads[decode_pool.nb_threads], NULL,
+                          decode_pool_worker,
+                          GUINT_TO_POINTER(decode_pool.generation)))
+          break;
+        decode_pool.nb_threads++;
+      }
+    }
+    if(decode_pool.nb_threads == 0) {
+      g_free(decode_pool.threads);
+      decode_pool.threads = NULL;
+      pthread_mutex_unlock(&decode_pool.lock);
+      g_warning("Can not start the decode threads");
+      goto free_decoder;
+    }
+    tf->ahead = a;
+    g_ptr_array_add(decode_pool.tracefiles, tf);
+    pthread_cond_broadcast(&decode_pool.work);
+    pthread_mutex_unlock(&decode_pool.lock);
+  } else if(!state && a != NULL) {
+    pthread_mutex_lock(&decode_pool.lock);
+    decode_ahead_reset(a, tf->num_blocks);
+    g_ptr_array_remove(decode_pool.tracefiles, tf);
+    tf->ahead = NULL;
+    if(decode_pool.tracefiles->len == 0) {
+      decode_pool.generation++;
+      pthread_cond_broadcast(&decode_pool.work);
+      threads = decode_pool.threads;
+      nb_threads = decode_pool.nb_threads;
+      decode_pool.threads = NULL;
+      decode_pool.nb_threads = 0;
+    }
+    pthread_mutex_unlock(&decode_pool.lock);
+    for(i = 0; i < nb_threads; i++)
+      pthread_join(threads[i], NULL);
+    g_free(threads);
+
+    decoder = a->decoder;
+    goto free_decoder;
+  }
+  return 0;
+
+free_decoder:
+  ltt_tracefile_cursor_destroy(decoder);
+  for(i = 0; i < LTT_DECODE_RING_BLOCKS; i++)
+    ltt_event_batch_destroy(a->ring[i]);
+  pthread_cond_destroy(&a->done);
+  g_free(a);
+  return state ? EPERM : 0;
+}
+
+
 /* Take the tf current event offset and use the event id to figure out where is
  * the next event offset.
  *
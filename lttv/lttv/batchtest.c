@@ -26,6 +26,8 @@
 
 #include <string.h>
 #include <inttypes.h>
+#include <float.h>
+#include <math.h>
 #include <lttv/lttv.h>
 #include <lttv/attribute.h>
 #include <lttv/hook.h>
@@ -34,6 +36,7 @@
 #include <lttv/tracecontext.h>
 #include <lttv/state.h>
 #include <lttv/stats.h>
+#include <lttv/eventindex.h>
 #include <ltt/trace.h>
 #include <ltt/event.h>
 
@@ -78,6 +81,12 @@ static gboolean
 	a_test8,
 	a_test9,
 	a_test10,
+	a_test11,
+	a_test12,
+	a_test13,
+	a_test14,
+	a_test15,
+	a_test16,
 	a_test_all;
 
 static GQuark QUARK_BLOCK_START,
@@ -96,26 +105,30 @@ typedef struct _save_state {
 } SaveState;
 
 
+static double get_time() 
+{
+	GTimeVal gt;
+
+	g_get_current_time(&gt);
+	return gt.tv_sec + (double)gt.tv_usec / (double)1000000.0;
+}
+
 static void lttv_trace_option(void __UNUSED__ *hook_data)
 { 
 	LttTrace *trace;
+	double t0, t1;
 
+	t0 = get_time();
 	trace = ltt_trace_open(a_trace);
+	t1 = get_time();
 	if(trace == NULL) {
 		g_critical("cannot open trace %s", a_trace);
 	} else {
+		g_message("Opened trace %s in %g seconds", a_trace, t1 - t0);
 		lttv_traceset_add(traceset, lttv_trace_new(trace));
 	}
 }
 
-static double get_time() 
-{
-	GTimeVal gt;
-
-	g_get_current_time(&gt);
-	return gt.tv_sec + (double)gt.tv_usec / (double)1000000.0;
-}
-
 static double run_one_test(LttvTracesetState *ts, LttTime start, LttTime end)
 {
 	double t0, t1;
@@ -280,6 +293,143 @@ gboolean save_state_event(void *hook_data, void *call_data)
 }
 
 
+/* Compare the fixed point TSC conversion of trace t with the double precision
+ * one for tsc. Values the double path cannot represent are skipped. They must
+ * match within 1 ns, plus the rounding error of the double path where it gets
+ * larger than that, plus the fraction of cycle the double path truncates when
+ * drift and offset are not integers. */
+static gboolean check_tsc_to_ns(LttTrace *t, guint64 tsc)
+{
+	double cycles = t->drift * tsc + t->offset;
+	double ns_per_cycle = 1000000000.0 * t->freq_scale / t->start_freq;
+	double estimate;
+	guint64 ref, ns, diff, tolerance;
+
+	if(cycles < 0 || cycles >= 18446744073709549568.0)	/* 2^64 - 2^11 */
+		return TRUE;
+	estimate = cycles * ns_per_cycle;
+	if(estimate >= 18446744073709549568.0)
+		return TRUE;
+
+	ref = tsc_to_uint64(t->freq_scale, t->start_freq, cycles);
+	ns = ltt_trace_tsc_to_ns(t, tsc);
+	diff = ns > ref ? ns - ref : ref - ns;
+	tolerance = 1 + (guint64)(estimate * 4 * DBL_EPSILON
+			+ (cycles - floor(cycles)) * ns_per_cycle);
+	if(diff > tolerance) {
+		g_warning("TSC %" PRIu64 " : fixed point %" PRIu64 " ns, double %" PRIu64
+			" ns (freq %" PRIu64 ", scale %u, drift %g, offset %g)",
+			tsc, ns, ref, t->start_freq, t->freq_scale, t->drift, t->offset);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+struct decode_tracefile_args {
+	int specialized;
+	guint count;
+};
+
+/* Read all the events of a tracefile with the requested header decoder */
+static void decode_tracefile(LttTracefile *tracefile, void *hook_data)
+{
+	struct decode_tracefile_args *args = hook_data;
+
+	ltt_tracefile_specialized_decode(tracefile, args->specialized);
+	if(!ltt_tracefile_seek_time(tracefile, ltt_time_zero)) {
+		do {
+			args->count++;
+		} while(!ltt_tracefile_read(tracefile));
+	}
+	ltt_tracefile_specialized_decode(tracefile, 1);
+}
+
+/* Attach the tracefile to the decode pipeline or detach it */
+static void decode_ahead_tracefile(LttTracefile *tracefile, void *hook_data)
+{
+	ltt_tracefile_decode_ahead(tracefile, *(int *)hook_data);
+}
+
+/* Hash the time, id and tracefile of the events, in the order they come */
+static gboolean hash_event(void *hook_data, void *call_data)
+{
+	LttvTracefileContext *tfc = (LttvTracefileContext *)call_data;
+	LttEvent *e = ltt_tracefile_get_event(tfc->tf);
+	guint64 *hash = (guint64 *)hook_data;
+
+	*hash = *hash * 31 + ltt_time_to_uint64(ltt_event_time(e));
+	*hash = *hash * 31 + ltt_event_id(e);
+	*hash = *hash * 31 + tfc->index;
+	return FALSE;
+}
+
+static gboolean merge_get_first(gpointer key, gpointer value,
+		gpointer user_data)
+{
+	*((LttvTracefileContext **)user_data) = (LttvTracefileContext *)value;
+	return TRUE;
+}
+
+/* Merge nb_events synthetic events from nb_tracefiles tracefile contexts,
+ * either with the traceset merge queue or with the GTree it replaced.
+ * Returns a hash of the order in which the tracefiles were visited. */
+static guint64 merge_tracefiles(guint nb_tracefiles, guint nb_events,
+		gboolean use_tree)
+{
+	LttvTraceContext *tc = g_object_new(LTTV_TRACE_CONTEXT_TYPE, NULL);
+	LttvTracefileContext **tfcs = g_new(LttvTracefileContext *, nb_tracefiles);
+	LttvTracefileContext *tfc;
+	LttvTracefileQueue *queue = NULL;
+	GTree *tree = NULL;
+	GRand *rand = g_rand_new_with_seed(nb_tracefiles);
+	guint64 hash = 0;
+	guint i;
+
+	if(use_tree)
+		tree = g_tree_new(compare_tracefile);
+	else
+		queue = lttv_tracefile_queue_new();
+	for(i = 0 ; i < nb_tracefiles ; i++) {
+		tfc = tfcs[i] = g_object_new(LTTV_TRACEFILE_CONTEXT_TYPE, NULL);
+		tfc->index = i;
+		tfc->t_context = tc;
+		tfc->timestamp = ltt_time_from_uint64(g_rand_int_range(rand, 0, 1000));
+		if(use_tree)
+			g_tree_insert(tree, tfc, tfc);
+		else
+			lttv_tracefile_queue_insert(queue, tfc);
+	}
+
+	/* Tracefiles get their next event a few microseconds later on average,
+	 * with some timestamp ties */
+	for(i = 0 ; i < nb_events ; i++) {
+		if(use_tree) {
+			tfc = NULL;
+			g_tree_foreach(tree, merge_get_first, &tfc);
+			g_tree_remove(tree, tfc);
+		} else
+			tfc = lttv_tracefile_queue_top(queue);
+		tfc->timestamp = ltt_time_add(tfc->timestamp,
+				ltt_time_from_uint64(g_rand_int_range(rand, 0, 4000)));
+		if(use_tree)
+			g_tree_insert(tree, tfc, tfc);
+		else
+			lttv_tracefile_queue_update(queue, tfc);
+		hash = hash * 31 + tfc->index;
+	}
+
+	if(use_tree)
+		g_tree_destroy(tree);
+	else
+		lttv_tracefile_queue_destroy(queue);
+	g_rand_free(rand);
+	for(i = 0 ; i < nb_tracefiles ; i++)
+		g_object_unref(G_OBJECT(tfcs[i]));
+	g_free(tfcs);
+	g_object_unref(G_OBJECT(tc));
+	return hash;
+}
+
 static void sanitize_name(gchar *name)
 {
 	while(*name != '\0') {
@@ -576,6 +726,9 @@ static gboolean process_traceset(void __UNUSED__ *hook_data,
 		if(lttv_profile_memory) {
 			g_message("Memory summary after computing/saving state");
 			g_mem_profile();
+			for(i = 0 ; i < lttv_traceset_number(traceset) ; i++)
+				lttv_state_write_saved_memory((LttvTraceState *)tc->traces[i],
+						stderr);
 		}
 	}
 
@@ -633,11 +786,14 @@ static gboolean process_traceset(void __UNUSED__ *hook_data,
 					time, G_MAXUINT, NULL);
 			g_info("Number of events to jump over : %u", count);
 
-			if(count > LTTV_STATE_SAVE_INTERVAL)
+			if(count > (guint)a_save_interval)
 				g_warning("Oops! Save interval is %u and it took %u events to seek to a time %lu.%lu supposed to be closer from the last saved state.",
-						LTTV_STATE_SAVE_INTERVAL, count, time.tv_sec, time.tv_nsec);
+						a_save_interval, count, time.tv_sec, time.tv_nsec);
 			time = ltt_time_add(time, interval);
 		}
+		for(i = 0 ; i < lttv_traceset_number(traceset) ; i++)
+			lttv_state_write_save_counters((LttvTraceState *)tc->traces[i],
+					stderr);
 
 	}
 
@@ -776,6 +932,225 @@ static gboolean process_traceset(void __UNUSED__ *hook_data,
 		lttv_traceset_context_position_destroy(saved_pos);
 	}
 
+	if(a_test11 || a_test_all) {
+		/* Compare per subbuffer and whole tracefile mappings */
+		LttvTracesetContext *tsc = &ts->parent;
+		TimeInterval span = tsc->time_span;
+		LttTime duration = ltt_time_sub(span.end_time, span.start_time);
+		LttTime seek_time;
+		double t0, t1;
+		int map_whole;
+
+		g_message("Running test 11 : tracefile mapping modes");
+		for(map_whole = 0 ; map_whole <= 1 ; map_whole++) {
+			ltt_tracefile_map_whole(map_whole);
+
+			count = 0;
+			lttv_hooks_add(event_hook, count_event, &count, LTTV_PRIO_DEFAULT);
+			t = run_one_test(ts, ltt_time_zero, max_time);
+			lttv_hooks_remove_data(event_hook, count_event, &count);
+			g_message("%s mapping : read %u events in %g seconds",
+				map_whole ? "Whole tracefile" : "Per subbuffer", count, t);
+
+			t0 = get_time();
+			for(i = 0 ; i < (guint)a_seek_number ; i++) {
+				seek_time = ltt_time_add(span.start_time,
+					ltt_time_mul(duration, (double)i / (double)a_seek_number));
+				lttv_process_traceset_seek_time(tsc, seek_time);
+			}
+			t1 = get_time();
+			g_message("%s mapping : %d seeks in %g seconds",
+				map_whole ? "Whole tracefile" : "Per subbuffer", a_seek_number,
+				t1 - t0);
+		}
+		ltt_tracefile_map_whole(0);
+	}
+
+	if(a_test12 || a_test_all) {
+		/* Clocks : freq_scale, start_freq, drift, offset */
+		static const struct {
+			guint32 freq_scale;
+			guint64 start_freq;
+			double drift, offset;
+		} clocks[] = {
+			{ 1, 1000000000ULL, 1., 0. },
+			{ 1, 2400000000ULL, 1., 0. },
+			{ 1, 33333333ULL, 1., 0. },
+			{ 1, 3000000000ULL, 1.0000123, -12345.6 },
+			{ 4, 1000000ULL, 0.99999, 1e9 },
+		};
+		LttTrace trace_clock = { 0 };
+		guint64 tsc;
+		guint errors = 0, nb_checks = 0;
+		unsigned int k;
+
+		g_message("Running test 12 : fixed point TSC to nanoseconds conversion");
+		for(i = 0 ; i < G_N_ELEMENTS(clocks) ; i++) {
+			trace_clock.freq_scale = clocks[i].freq_scale;
+			trace_clock.start_freq = clocks[i].start_freq;
+			trace_clock.drift = clocks[i].drift;
+			trace_clock.offset = clocks[i].offset;
+			ltt_trace_update_clock(&trace_clock);
+
+			/* Powers of two and their neighbours, then random values of
+			 * random magnitude */
+			for(k = 0 ; k < 64 ; k++) {
+				tsc = 1ULL << k;
+				errors += !check_tsc_to_ns(&trace_clock, tsc - 1);
+				errors += !check_tsc_to_ns(&trace_clock, tsc);
+				errors += !check_tsc_to_ns(&trace_clock, tsc + 1);
+				nb_checks += 3;
+			}
+			for(k = 0 ; k < 100000 ; k++) {
+				tsc = ((guint64)g_random_int() << 32) | g_random_int();
+				tsc >>= g_random_int_range(0, 64);
+				errors += !check_tsc_to_ns(&trace_clock, tsc);
+				nb_checks++;
+			}
+		}
+		g_message("TSC conversion : %u errors in %u checks", errors, nb_checks);
+	}
+
+	if(a_test13 || a_test_all) {
+		struct decode_tracefile_args decode_args;
+		double t0, t1;
+
+		g_message("Running test 13 : event header decoders");
+		args.func = decode_tracefile;
+		args.func_args = &decode_args;
+		for(decode_args.specialized = 0 ; decode_args.specialized <= 1 ;
+				decode_args.specialized++) {
+			decode_args.count = 0;
+			t0 = get_time();
+			for(i = 0 ; i < lttv_traceset_number(traceset) ; i++) {
+				trace = lttv_trace(lttv_traceset_get(traceset, i));
+				tracefiles_groups = ltt_trace_get_tracefiles_groups(trace);
+				g_datalist_foreach(tracefiles_groups,
+						(GDataForeachFunc)compute_tracefile_group, &args);
+			}
+			t1 = get_time();
+			g_message("%s header decoder : %u events in %g seconds",
+				decode_args.specialized ? "Specialized" : "Generic",
+				decode_args.count, t1 - t0);
+		}
+	}
+
+	if(a_test14 || a_test_all) {
+		static const guint nb_tracefiles[] = { 8, 64, 512 };
+		const guint nb_events = 2000000;
+		guint64 hash_tree, hash_queue;
+		double t0, t1, t2;
+
+		g_message("Running test 14 : tracefile merge");
+		for(i = 0 ; i < G_N_ELEMENTS(nb_tracefiles) ; i++) {
+			t0 = get_time();
+			hash_tree = merge_tracefiles(nb_tracefiles[i], nb_events, TRUE);
+			t1 = get_time();
+			hash_queue = merge_tracefiles(nb_tracefiles[i], nb_events, FALSE);
+			t2 = get_time();
+			if(hash_tree != hash_queue)
+				g_warning("Merge queue and GTree orders differ for %u tracefiles",
+						nb_tracefiles[i]);
+			g_message("%u tracefiles, %u events : GTree %g seconds, "
+					"merge queue %g seconds", nb_tracefiles[i], nb_events,
+					t1 - t0, t2 - t1);
+		}
+	}
+
+	if(a_test15 || a_test_all) {
+		LttvHooks *hash_hook = lttv_hooks_new();
+		guint64 hash, hashes[2];
+		int decode_ahead;
+		double t0, t1;
+
+		g_message("Running test 15 : decode pipeline");
+		lttv_hooks_add(hash_hook, hash_event, &hash, LTTV_PRIO_DEFAULT);
+		args.func = decode_ahead_tracefile;
+		args.func_args = &decode_ahead;
+		for(decode_ahead = 0 ; decode_ahead <= 1 ; decode_ahead++) {
+			for(i = 0 ; i < lttv_traceset_number(traceset) ; i++) {
+				trace = lttv_trace(lttv_traceset_get(traceset, i));
+				tracefiles_groups = ltt_trace_get_tracefiles_groups(trace);
+				g_datalist_foreach(tracefiles_groups,
+						(GDataForeachFunc)compute_tracefile_group, &args);
+			}
+			hash = 0;
+			t0 = get_time();
+			lttv_process_traceset_begin(tc, NULL, NULL, NULL, hash_hook, NULL);
+			lttv_process_traceset_seek_time(tc, ltt_time_zero);
+			count = lttv_process_traceset_middle(tc, ltt_time_infinite,
+					G_MAXULONG, NULL);
+			lttv_process_traceset_end(tc, NULL, NULL, NULL, hash_hook, NULL);
+			t1 = get_time();
+			hashes[decode_ahead] = hash;
+			g_message("%s : %u events in %g seconds",
+					decode_ahead ? "Decode pipeline" : "Reader decoding", count,
+					t1 - t0);
+		}
+		decode_ahead = 0;
+		for(i = 0 ; i < lttv_traceset_number(traceset) ; i++) {
+			trace = lttv_trace(lttv_traceset_get(traceset, i));
+			tracefiles_groups = ltt_trace_get_tracefiles_groups(trace);
+			g_datalist_foreach(tracefiles_groups,
+					(GDataForeachFunc)compute_tracefile_group, &args);
+		}
+		if(hashes[0] != hashes[1])
+			g_warning("The decode pipeline gives different events");
+		lttv_hooks_destroy(hash_hook);
+	}
+
+	if(a_test16 || a_test_all) {
+		LttvTracesetContextPosition *by_number, *by_reading;
+		guint64 total, number, numbers[6];
+		guint errors = 0;
+		double t0, t1;
+
+		g_message("Running test 16 : event index");
+		t0 = get_time();
+		lttv_process_traceset_seek_time(tc, ltt_time_zero);
+		lttv_event_index_add_event_hooks(tc);
+		count = lttv_process_traceset_middle(tc, ltt_time_infinite,
+				G_MAXULONG, NULL);
+		lttv_event_index_remove_event_hooks(tc);
+		t1 = get_time();
+		if(!lttv_event_index_traceset_count(tc, &total))
+			g_error("The event index is not complete");
+		if(total != count)
+			g_warning("Event index of %" G_GUINT64_FORMAT " events, %u read",
+					total, count);
+		g_message("Event index of %" G_GUINT64_FORMAT " events in %g seconds",
+				total, t1 - t0);
+
+		numbers[0] = 0;
+		numbers[1] = 1;
+		numbers[2] = LTTV_EVENT_INDEX_INTERVAL - 1;
+		numbers[3] = LTTV_EVENT_INDEX_INTERVAL;
+		numbers[4] = total / 2;
+		numbers[5] = total - 1;
+		by_number = lttv_traceset_context_position_new(tc);
+		by_reading = lttv_traceset_context_position_new(tc);
+		for(i = 0 ; i < G_N_ELEMENTS(numbers) ; i++) {
+			if(numbers[i] >= total)
+				continue;
+			lttv_process_traceset_seek_time(tc, ltt_time_zero);
+			lttv_process_traceset_seek_n_forward(tc, numbers[i],
+					NULL, NULL, NULL, NULL, NULL, NULL);
+			lttv_traceset_context_position_save(tc, by_reading);
+			lttv_event_index_seek_number(tc, numbers[i]);
+			lttv_traceset_context_position_save(tc, by_number);
+			lttv_event_index_get_number(tc, &number);
+			if(lttv_traceset_context_pos_pos_compare(by_number, by_reading) != 0
+					|| number != numbers[i]) {
+				g_warning("Event %" G_GUINT64_FORMAT " : seek by number differs, "
+						"number %" G_GUINT64_FORMAT, numbers[i], number);
+				errors++;
+			}
+		}
+		lttv_traceset_context_position_destroy(by_number);
+		lttv_traceset_context_position_destroy(by_reading);
+		g_message("Event index : %u errors", errors);
+	}
+
 	if(a_trace_event) lttv_hooks_remove_data(event_hook, trace_event, NULL);
 
 	g_free(save_state.write_time);
@@ -830,10 +1205,10 @@ static void init()
 	lttv_option_add("save-state-copy", 'S', "Write the state saved for seeking",
 			"", LTTV_OPT_NONE, &a_save_state_copy, NULL, NULL);
 
-	a_save_interval = 100000;
+	a_save_interval = LTTV_STATE_SAVE_INTERVAL;
 	lttv_option_add("save-interval", 'i',
 			"Interval between saving state",
-			"number of events before a block start triggers saving state",
+			"maximum number of events between saved states",
 			LTTV_OPT_INT, &a_save_interval, NULL, NULL);
 
 	a_sample_interval = 100000;
@@ -894,6 +1269,30 @@ static void init()
 	lttv_option_add("test10", ' ', "Test seeking traceset by position",
 			"", LTTV_OPT_NONE, &a_test10, NULL, NULL);
 
+	a_test11 = FALSE;
+	lttv_option_add("test11", ' ', "Compare tracefile mapping modes",
+			"", LTTV_OPT_NONE, &a_test11, NULL, NULL);
+
+	a_test12 = FALSE;
+	lttv_option_add("test12", ' ', "Check fixed point TSC conversion",
+			"", LTTV_OPT_NONE, &a_test12, NULL, NULL);
+
+	a_test13 = FALSE;
+	lttv_option_add("test13", ' ', "Compare event header decoders",
+			"", LTTV_OPT_NONE, &a_test13, NULL, NULL);
+
+	a_test14 = FALSE;
+	lttv_option_add("test14", ' ', "Benchmark the tracefile merge",
+			"", LTTV_OPT_NONE, &a_test14, NULL, NULL);
+
+	a_test15 = FALSE;
+	lttv_option_add("test15", ' ', "Compare the decode pipeline with the reader",
+			"", LTTV_OPT_NONE, &a_test15, NULL, NULL);
+
+	a_test16 = FALSE;
+	lttv_option_add("test16", ' ', "Seek by event number with the event index",
+			"", LTTV_OPT_NONE, &a_test16, NULL, NULL);
+
 
 
 	a_test_all = FALSE;
@@ -981,6 +1380,12 @@ static void destroy()
 	lttv_option_remove("test8");
 	lttv_option_remove("test9");
 	lttv_option_remove("test10");
+	lttv_option_remove("test11");
+	lttv_option_remove("test12");
+	lttv_option_remove("test13");
+	lttv_option_remove("test14");
+	lttv_option_remove("test15");
+	lttv_option_remove("test16");
 	lttv_option_remove("testall");
 
 	lttv_hooks_destroy(before_traceset);
@@ -1008,4 +1413,4 @@ static void destroy()
 
 LTTV_MODULE("batchtest", "Batch processing of a trace for tests", \
 		"Run through a trace calling all the registered hooks for tests", \
-		init, destroy, "state", "stats", "option" )
+		init, destroy, "state", "stats", "eventindex", "option" )
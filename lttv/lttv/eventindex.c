@@ -0,0 +1,646 @@
+/* This file is part of the Linux Trace Toolkit viewer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <lttv/lttv.h>
+#include <lttv/module.h>
+#include <lttv/attribute.h>
+#include <lttv/hook.h>
+#include <lttv/eventindex.h>
+#include <ltt/trace.h>
+#include <ltt/event.h>
+
+#define EVENT_INDEX_MAGIC 0x4C455649
+#define EVENT_INDEX_VERSION 1
+
+static GQuark LTTV_EVENT_INDEX;
+
+/* Position of the trace every interval events */
+struct event_index_entry {
+	LttTime time;                 /* Time of the next event */
+	guint64 number;               /* Number of the next event */
+};
+
+/* Position of a tracefile in an entry */
+struct event_index_position {
+	guint64 tsc;
+	guint32 block;                /* G_MAXUINT32 at the end of the tracefile */
+	guint32 offset;
+};
+
+struct _LttvEventIndex {
+	guint interval;
+	guint nb_tracefiles;
+	GArray *entries;              /* struct event_index_entry */
+	GArray *positions;            /* struct event_index_position, nb_tracefiles
+	                                 per entry */
+	guint64 count;                /* Events indexed */
+	gboolean complete;            /* Built up to the end of the trace */
+};
+
+/* Saved index : the header, one struct event_index_tracefile per tracefile
+ * to tell a stale index, the entries and the positions. Values are kept in
+ * host byte order, like the block index of the tracefiles. */
+struct event_index_header {
+	guint32 magic;
+	guint32 version;
+	guint32 interval;
+	guint32 nb_tracefiles;
+	guint64 nb_entries;
+	guint64 count;
+};
+
+struct event_index_tracefile {
+	guint32 name_hash;            /* Hash of the tracefile long name */
+	guint32 nb_blocks;
+};
+
+
+static LttvEventIndex *event_index_new(guint nb_tracefiles)
+{
+	LttvEventIndex *index = g_new(LttvEventIndex, 1);
+
+	index->interval = LTTV_EVENT_INDEX_INTERVAL;
+	index->nb_tracefiles = nb_tracefiles;
+	index->entries = g_array_new(FALSE, FALSE,
+			sizeof(struct event_index_entry));
+	index->positions = g_array_new(FALSE, FALSE,
+			sizeof(struct event_index_position));
+	index->count = 0;
+	index->complete = FALSE;
+	return index;
+}
+
+static void event_index_destroy(LttvEventIndex *index)
+{
+	g_array_free(index->entries, TRUE);
+	g_array_free(index->positions, TRUE);
+	g_free(index);
+}
+
+static LttvEventIndex **event_index_slot(LttvTraceContext *tc)
+{
+	LttvAttributeValue value;
+	gboolean retval;
+
+	retval = lttv_attribute_find(tc->t_a, LTTV_EVENT_INDEX, LTTV_POINTER,
+			&value);
+	g_assert(retval);
+	return (LttvEventIndex **)value.v_pointer;
+}
+
+static gchar *event_index_path(LttvTraceContext *tc)
+{
+	return g_strdup_printf("%s/.lttv-event-index",
+			g_quark_to_string(ltt_trace_name(tc->t)));
+}
+
+static void event_index_tracefiles(LttvTraceContext *tc,
+		struct event_index_tracefile *tracefiles)
+{
+	LttvTracefileContext *tfc;
+	guint i;
+
+	for(i = 0; i < tc->tracefiles->len; i++) {
+		tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, i);
+		tracefiles[i].name_hash = g_str_hash(
+				g_quark_to_string(ltt_tracefile_long_name(tfc->tf)));
+		tracefiles[i].nb_blocks = ltt_tracefile_block_number(tfc->tf);
+	}
+}
+
+/* Load the saved index of the trace, NULL if there is none or it is stale */
+static LttvEventIndex *event_index_load(LttvTraceContext *tc)
+{
+	struct event_index_header header;
+	struct event_index_tracefile *tracefiles, *saved;
+	LttvEventIndex *index = NULL;
+	guint nb_tracefiles = tc->tracefiles->len;
+	size_t len;
+	gchar *path;
+	int fd;
+
+	path = event_index_path(tc);
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		goto end;
+
+	tracefiles = g_new(struct event_index_tracefile, nb_tracefiles);
+	saved = g_new(struct event_index_tracefile, nb_tracefiles);
+	event_index_tracefiles(tc, tracefiles);
+	len = nb_tracefiles * sizeof(struct event_index_tracefile);
+	if(read(fd, &header, sizeof(header)) != sizeof(header)
+			|| header.magic != EVENT_INDEX_MAGIC
+			|| header.version != EVENT_INDEX_VERSION
+			|| header.interval == 0
+			|| header.nb_tracefiles != nb_tracefiles
+			|| read(fd, saved, len) != (ssize_t)len
+			|| memcmp(saved, tracefiles, len) != 0) {
+		g_debug("Stale event index %s, rebuilding it", path);
+		goto free_tracefiles;
+	}
+
+	index = event_index_new(nb_tracefiles);
+	index->interval = header.interval;
+	index->count = header.count;
+	index->complete = TRUE;
+	g_array_set_size(index->entries, header.nb_entries);
+	g_array_set_size(index->positions, header.nb_entries * nb_tracefiles);
+	len = index->entries->len * sizeof(struct event_index_entry);
+	if(read(fd, index->entries->data, len) != (ssize_t)len)
+		goto error;
+	len = index->positions->len * sizeof(struct event_index_position);
+	if(read(fd, index->positions->data, len) != (ssize_t)len)
+		goto error;
+	goto free_tracefiles;
+
+error:
+	event_index_destroy(index);
+	index = NULL;
+free_tracefiles:
+	g_free(saved);
+	g_free(tracefiles);
+	close(fd);
+end:
+	g_free(path);
+	return index;
+}
+
+/* Save the index of the trace. Failure is not an error : the trace directory
+ * may be read-only. */
+static void event_index_save(LttvTraceContext *tc, LttvEventIndex *index)
+{
+	struct event_index_header header;
+	struct event_index_tracefile *tracefiles;
+	gchar *path, *tmp_path;
+	size_t len[3];
+	int fd;
+
+	header.magic = EVENT_INDEX_MAGIC;
+	header.version = EVENT_INDEX_VERSION;
+	header.interval = index->interval;
+	header.nb_tracefiles = index->nb_tracefiles;
+	header.nb_entries = index->entries->len;
+	header.count = index->count;
+	tracefiles = g_new(struct event_index_tracefile, index->nb_tracefiles);
+	event_index_tracefiles(tc, tracefiles);
+	len[0] = index->nb_tracefiles * sizeof(struct event_index_tracefile);
+	len[1] = index->entries->len * sizeof(struct event_index_entry);
+	len[2] = index->positions->len * sizeof(struct event_index_position);
+
+	path = event_index_path(tc);
+	tmp_path = g_strdup_printf("%s.%d", path, getpid());
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		g_debug("Cannot create event index %s", tmp_path);
+		goto end;
+	}
+	if(write(fd, &header, sizeof(header)) != sizeof(header)
+			|| write(fd, tracefiles, len[0]) != (ssize_t)len[0]
+			|| write(fd, index->entries->data, len[1]) != (ssize_t)len[1]
+			|| write(fd, index->positions->data, len[2]) != (ssize_t)len[2]) {
+		g_debug("Cannot write event index %s", tmp_path);
+		close(fd);
+		unlink(tmp_path);
+		goto end;
+	}
+	close(fd);
+	if(rename(tmp_path, path))
+		unlink(tmp_path);
+end:
+	g_free(tmp_path);
+	g_free(path);
+	g_free(tracefiles);
+}
+
+/* Record the position of the trace, where event time comes next */
+static void event_index_add_entry(LttvEventIndex *index, LttvTraceContext *tc,
+		LttTime time)
+{
+	struct event_index_entry entry;
+	struct event_index_position *position;
+	LttvTracefileContext *tfc;
+	LttEventPosition ep;
+	LttTracefile *tf;
+	guint i, block, offset;
+	guint64 tsc;
+
+	entry.time = time;
+	entry.number = index->count;
+	g_array_append_val(index->entries, entry);
+
+	i = index->positions->len;
+	g_array_set_size(index->positions, i + index->nb_tracefiles);
+	position = &g_array_index(index->positions, struct event_index_position, i);
+	for(i = 0; i < index->nb_tracefiles; i++, position++) {
+		tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, i);
+		if(ltt_time_compare(tfc->timestamp, ltt_time_infinite) == 0) {
+			position->tsc = 0;
+			position->block = G_MAXUINT32;
+			position->offset = 0;
+			continue;
+		}
+		ltt_event_position(ltt_tracefile_get_event(tfc->tf), &ep);
+		ltt_event_position_get(&ep, &tf, &block, &offset, &tsc);
+		position->tsc = tsc;
+		position->block = block;
+		position->offset = offset;
+	}
+}
+
+static gboolean event_index_hook(void *hook_data, void *call_data)
+{
+	LttvEventIndex *index = (LttvEventIndex *)hook_data;
+	LttvTracefileContext *tfc = (LttvTracefileContext *)call_data;
+
+	if(unlikely(index->count % index->interval == 0))
+		event_index_add_entry(index, tfc->t_context, tfc->timestamp);
+	index->count++;
+	return FALSE;
+}
+
+
+void lttv_event_index_add_event_hooks(LttvTracesetContext *self)
+{
+	LttvTraceContext *tc;
+	LttvTracefileContext *tfc;
+	LttvEventIndex **slot;
+	guint i, j;
+
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		tc = self->traces[i];
+		slot = event_index_slot(tc);
+		if(*slot == NULL)
+			*slot = event_index_load(tc);
+		if(*slot != NULL && (*slot)->complete)
+			continue;
+
+		/* Start over, an index is only built from the start of the trace */
+		if(*slot != NULL)
+			event_index_destroy(*slot);
+		*slot = event_index_new(tc->tracefiles->len);
+
+		/* The index is specific to the trace */
+		lttv_hooks_declare_per_trace(event_index_hook);
+
+		for(j = 0; j < tc->tracefiles->len; j++) {
+			tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, j);
+			lttv_hooks_add(tfc->event, event_index_hook, *slot,
+					LTTV_PRIO_EVENT_INDEX);
+		}
+	}
+}
+
+gint lttv_event_index_hook_add_event_hooks(void *hook_data, void *call_data)
+{
+	LttvTracesetContext *tsc = (LttvTracesetContext*)call_data;
+
+	lttv_event_index_add_event_hooks(tsc);
+
+	return 0;
+}
+
+void lttv_event_index_remove_event_hooks(LttvTracesetContext *self)
+{
+	LttvTraceContext *tc;
+	LttvTracefileContext *tfc;
+	LttvEventIndex *index;
+	gboolean complete;
+	guint i, j;
+
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		tc = self->traces[i];
+		index = *event_index_slot(tc);
+		if(index == NULL || index->complete)
+			continue;
+
+		complete = TRUE;
+		for(j = 0; j < tc->tracefiles->len; j++) {
+			tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, j);
+			lttv_hooks_remove_data(tfc->event, event_index_hook, index);
+			if(ltt_time_compare(tfc->timestamp, ltt_time_infinite) != 0)
+				complete = FALSE;
+		}
+		if(complete) {
+			index->complete = TRUE;
+			event_index_save(tc, index);
+			g_info("Event index of trace %s : %" G_GUINT64_FORMAT " events",
+					g_quark_to_string(ltt_trace_name(tc->t)), index->count);
+		}
+	}
+}
+
+gint lttv_event_index_hook_remove_event_hooks(void *hook_data,
+		void *call_data)
+{
+	LttvTracesetContext *tsc = (LttvTracesetContext*)call_data;
+
+	lttv_event_index_remove_event_hooks(tsc);
+
+	return 0;
+}
+
+LttvEventIndex *lttv_event_index_get(LttvTraceContext *tc)
+{
+	LttvEventIndex **slot = event_index_slot(tc);
+
+	if(*slot == NULL)
+		*slot = event_index_load(tc);
+	if(*slot == NULL || !(*slot)->complete)
+		return NULL;
+	return *slot;
+}
+
+/* Last entry before time, the first one if none */
+static guint event_index_find_entry(LttvEventIndex *index, LttTime time)
+{
+	guint low = 0, high = index->entries->len, mid;
+
+	while(high - low > 1) {
+		mid = (low + high) / 2;
+		if(ltt_time_compare(g_array_index(index->entries,
+				struct event_index_entry, mid).time, time) < 0)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Events of a tracefile from the position of an entry, up to the event at
+ * position (block, offset) and before time */
+static guint64 tracefile_count(LttTracefile *tf,
+		const struct event_index_position *from,
+		guint to_block, guint to_offset, LttTime time)
+{
+	LttTracefile *cursor, *cursor_tf;
+	LttEventPosition ep;
+	LttEvent *e;
+	guint block, offset;
+	guint64 tsc, count = 0;
+	int ret;
+
+	if(from->block == G_MAXUINT32)
+		return 0;
+
+	/* Read with a cursor, the tracefile stays where it is */
+	cursor = ltt_tracefile_cursor_new(tf);
+	ltt_event_position_set(&ep, tf, from->block, from->offset, from->tsc);
+	if(ltt_tracefile_seek_position(cursor, &ep) != 0)
+		g_error("Cannot seek to an event index position");
+	do {
+		e = ltt_tracefile_get_event(cursor);
+		ltt_event_position(e, &ep);
+		ltt_event_position_get(&ep, &cursor_tf, &block, &offset, &tsc);
+		if(block == to_block && offset == to_offset)
+			break;
+		if(ltt_time_compare(ltt_event_time(e), time) >= 0)
+			break;
+		count++;
+		ret = ltt_tracefile_read(cursor);
+	} while(ret == 0);
+	ltt_tracefile_cursor_destroy(cursor);
+	return count;
+}
+
+/* Events of the trace before time, or before its current position when
+ * at_position is set */
+static guint64 trace_number(LttvTraceContext *tc, LttvEventIndex *index,
+		gboolean at_position, LttTime time)
+{
+	struct event_index_position *positions;
+	LttvTracefileContext *tfc;
+	LttEventPosition ep;
+	LttTracefile *tf;
+	LttTime limit;
+	guint i, k, block, offset;
+	guint64 number, tsc;
+
+	if(index->entries->len == 0)
+		return 0;
+
+	if(at_position) {
+		/* The entries before the time of the next event are before the
+		 * position */
+		time = ltt_time_infinite;
+		for(i = 0; i < tc->tracefiles->len; i++) {
+			tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, i);
+			if(ltt_time_compare(tfc->timestamp, time) < 0)
+				time = tfc->timestamp;
+		}
+		if(ltt_time_compare(time, ltt_time_infinite) == 0)
+			return index->count;
+		limit = ltt_time_infinite;
+	} else
+		limit = time;
+
+	k = event_index_find_entry(index, time);
+	number = g_array_index(index->entries, struct event_index_entry, k).number;
+	positions = &g_array_index(index->positions, struct event_index_position,
+			k * index->nb_tracefiles);
+	for(i = 0; i < tc->tracefiles->len; i++) {
+		tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, i);
+		block = offset = G_MAXUINT;
+		if(at_position
+				&& ltt_time_compare(tfc->timestamp, ltt_time_infinite) != 0) {
+			ltt_event_position(ltt_tracefile_get_event(tfc->tf), &ep);
+			ltt_event_position_get(&ep, &tf, &block, &offset, &tsc);
+		}
+		number += tracefile_count(tfc->tf, &positions[i], block, offset, limit);
+	}
+	return number;
+}
+
+gboolean lttv_event_index_traceset_count(LttvTracesetContext *self,
+		guint64 *count)
+{
+	LttvEventIndex *index;
+	guint i;
+
+	*count = 0;
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		index = lttv_event_index_get(self->traces[i]);
+		if(index == NULL)
+			return FALSE;
+		*count += index->count;
+	}
+	return TRUE;
+}
+
+gboolean lttv_event_index_get_number(LttvTracesetContext *self,
+		guint64 *number)
+{
+	LttvEventIndex *index;
+	guint i;
+
+	*number = 0;
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		index = lttv_event_index_get(self->traces[i]);
+		if(index == NULL)
+			return FALSE;
+		*number += trace_number(self->traces[i], index, TRUE,
+				ltt_time_infinite);
+	}
+	return TRUE;
+}
+
+/* Last entry of number at most number */
+static guint event_index_find_number(LttvEventIndex *index, guint64 number)
+{
+	guint low = 0, high = index->entries->len, mid;
+
+	while(high - low > 1) {
+		mid = (low + high) / 2;
+		if(g_array_index(index->entries, struct event_index_entry,
+				mid).number <= number)
+			low = mid;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/* Events of the traceset before entry k of trace i, the other traces being
+ * at the time of the entry. Only the other traces are read. */
+static guint64 entry_traceset_number(LttvTracesetContext *self, guint i,
+		guint k)
+{
+	struct event_index_entry *entry;
+	guint64 number;
+	guint j;
+
+	entry = &g_array_index(lttv_event_index_get(self->traces[i])->entries,
+			struct event_index_entry, k);
+	number = entry->number;
+	for(j = 0; j < lttv_traceset_number(self->ts); j++)
+		if(j != i)
+			number += trace_number(self->traces[j],
+					lttv_event_index_get(self->traces[j]), FALSE, entry->time);
+	return number;
+}
+
+/* Seek the tracefiles of a trace to the positions of entry k */
+static void event_index_seek_entry(LttvTraceContext *tc, LttvEventIndex *index,
+		guint k)
+{
+	struct event_index_position *positions;
+	LttvTracefileQueue *pqueue = tc->ts_context->pqueue;
+	LttvTracefileContext *tfc;
+	LttEventPosition ep;
+	guint i;
+
+	positions = &g_array_index(index->positions, struct event_index_position,
+			k * index->nb_tracefiles);
+	for(i = 0; i < tc->tracefiles->len; i++) {
+		tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, i);
+		lttv_tracefile_queue_remove(pqueue, tfc);
+		tfc->timestamp = ltt_time_infinite;
+		if(positions[i].block == G_MAXUINT32)
+			continue;
+		ltt_event_position_set(&ep, tfc->tf, positions[i].block,
+				positions[i].offset, positions[i].tsc);
+		if(ltt_tracefile_seek_position(tfc->tf, &ep) != 0)
+			g_error("Cannot seek to an event index position");
+		tfc->timestamp = ltt_event_time(ltt_tracefile_get_event(tfc->tf));
+		lttv_tracefile_queue_insert(pqueue, tfc);
+	}
+}
+
+gboolean lttv_event_index_seek_number(LttvTracesetContext *self,
+		guint64 number)
+{
+	struct event_index_entry *entry;
+	LttvEventIndex *index;
+	guint64 count, low_number, best_number = 0;
+	guint i, low, high, mid, best_trace = G_MAXUINT, best_entry = 0;
+
+	if(!lttv_event_index_traceset_count(self, &count))
+		return FALSE;
+	if(number >= count) {
+		lttv_process_traceset_seek_time(self, ltt_time_infinite);
+		return TRUE;
+	}
+
+	/* Search the entry closest before the event, among the entries of all
+	 * the traces. An entry of a trace is preceded by the events of the trace
+	 * it counts, plus the events of the other traces before its time : the
+	 * entries of number above the event are not searched. With a single
+	 * trace, no event is read. */
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		index = lttv_event_index_get(self->traces[i]);
+		if(index->entries->len == 0)
+			continue;
+		low_number = entry_traceset_number(self, i, 0);
+		if(low_number > number)
+			continue;
+		low = 0;
+		high = event_index_find_number(index, number) + 1;
+		while(high - low > 1) {
+			mid = (low + high) / 2;
+			count = entry_traceset_number(self, i, mid);
+			if(count <= number) {
+				low = mid;
+				low_number = count;
+			} else
+				high = mid;
+		}
+		if(best_trace == G_MAXUINT || low_number > best_number) {
+			best_trace = i;
+			best_entry = low;
+			best_number = low_number;
+		}
+	}
+
+	/* Seek the traces to the entry, then read up to the event */
+	if(best_trace == G_MAXUINT) {
+		lttv_process_traceset_seek_time(self, self->time_span.start_time);
+		best_number = 0;
+	} else {
+		index = lttv_event_index_get(self->traces[best_trace]);
+		entry = &g_array_index(index->entries, struct event_index_entry,
+				best_entry);
+		for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+			if(i == best_trace)
+				event_index_seek_entry(self->traces[i], index, best_entry);
+			else
+				lttv_process_trace_seek_time(self->traces[i], entry->time);
+		}
+	}
+	lttv_process_traceset_seek_n_forward(self, number - best_number,
+			NULL, NULL, NULL, NULL, NULL, NULL);
+	return TRUE;
+}
+
+static void module_init()
+{
+	LTTV_EVENT_INDEX = g_quark_from_string("event index");
+}
+
+static void module_destroy()
+{
+}
+
+
+LTTV_MODULE("eventindex", "Event index", \
+		"Number the events of the traces to seek by event number", \
+		module_init, module_destroy)
@@ -0,0 +1,85 @@
+/* This file is part of the Linux Trace Toolkit viewer
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License Version 2 as
+ * published by the Free Software Foundation;
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#ifndef EVENTINDEX_H
+#define EVENTINDEX_H
+
+#include <glib.h>
+#include <lttv/tracecontext.h>
+
+/* The event index of a trace numbers its events, in the order the traceset
+   merges them. It records the position of the trace every
+   LTTV_EVENT_INDEX_INTERVAL events : each entry holds the number of the next
+   event, its time and the position of every tracefile, packed in flat
+   arrays. The event of a given number, or the number of the current event,
+   are then found from the closest entry by reading less than an interval of
+   events.
+
+   The index is built by processing the whole trace from its start with the
+   event index hooks, as a background computation in the GUI. It is kept in
+   the trace attributes, shared by all the contexts of the trace, and saved
+   in the trace directory once complete so the next runs load it.
+
+   The number of an event in a traceset is the sum, for each trace, of the
+   number of its events which come before in the merge order. */
+
+#define LTTV_EVENT_INDEX_INTERVAL 10000
+
+#define LTTV_PRIO_EVENT_INDEX 20
+
+typedef struct _LttvEventIndex LttvEventIndex;
+
+/* Start building the event index of the traces which have none. The context
+   must be at the start of the traces. */
+
+void lttv_event_index_add_event_hooks(LttvTracesetContext *self);
+
+/* Stop building : the index of the traces processed up to their end is
+   complete. */
+
+void lttv_event_index_remove_event_hooks(LttvTracesetContext *self);
+
+gint lttv_event_index_hook_add_event_hooks(void *hook_data, void *call_data);
+
+gint lttv_event_index_hook_remove_event_hooks(void *hook_data,
+		void *call_data);
+
+/* The complete event index of the trace, NULL if it is not built */
+
+LttvEventIndex *lttv_event_index_get(LttvTraceContext *tc);
+
+/* The queries below return FALSE when a trace of the traceset has no complete
+   event index. */
+
+/* Number of events in the traceset */
+
+gboolean lttv_event_index_traceset_count(LttvTracesetContext *self,
+		guint64 *count);
+
+/* Number of the current event of the traceset, the number of events when it
+   is at its end */
+
+gboolean lttv_event_index_get_number(LttvTracesetContext *self,
+		guint64 *number);
+
+/* Seek the traceset to the event of the given number, or to its end when
+   there are fewer events */
+
+gboolean lttv_event_index_seek_number(LttvTracesetContext *self,
+		guint64 number);
+
+#endif // EVENTINDEX_H
@@ -20,6 +20,7 @@
 #include <config.h>
 #endif
 
+#include <pthread.h>
 #include <lttv/hook.h>
 #include <ltt/compiler.h>
 #include <ltt/ltt.h>
@@ -31,6 +32,29 @@ typedef struct _LttvHookClosure {
 	guint         ref_count;
 } LttvHookClosure;
 
+/* Incremented each time a hook list is modified, invalidates the dispatch
+ * tables built before. Atomic, contexts may be processed by several threads
+ * (each one dispatching through its own tables). */
+static volatile gint hooks_generation = 0;
+
+/* Hooks declared per trace, used as a set. Hooks may be declared while
+ * other threads process their traces. */
+static GHashTable *per_trace_hooks = NULL;
+static pthread_mutex_t per_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct _LttvHooksDispatch {
+	LttvHooks *hooks;
+	LttvHooksById *hooks_by_id;
+	gint generation;      /* hooks_generation when the tables were built */
+	gboolean observed;    /* Some hook is called for some id */
+	gboolean per_trace;   /* All the hooks are declared per trace */
+	GPtrArray *tables;    /* LttvHooks flattened for each id, NULL until the
+	                         id is dispatched */
+	LttvHooks *generic;   /* Shared table of the ids without hooks by id */
+	guint depth;          /* Calls of the tables in progress : the tables are
+	                         rebuilt once the outermost one returns */
+};
+
 gint lttv_hooks_prio_compare(LttvHookClosure *a, LttvHookClosure *b)
 {
 	gint ret=0;
@@ -48,6 +72,7 @@ LttvHooks *lttv_hooks_new()
 
 void lttv_hooks_destroy(LttvHooks *h) 
 {
+	g_atomic_int_inc(&hooks_generation);
 	g_log(G_LOG_DOMAIN, G_LOG_LEVEL_DEBUG, "lttv_hooks_destroy()");
 	g_array_free(h, TRUE);
 }
@@ -59,6 +84,7 @@ void lttv_hooks_add(LttvHooks *h, LttvHook f, void *hook_data, LttvHookPrio p)
 	guint i;
 
 	if(unlikely(h == NULL))g_error("Null hook added");
+	g_atomic_int_inc(&hooks_generation);
 
 	new_c.hook = f;
 	new_c.hook_data = hook_data;
@@ -105,6 +131,7 @@ void lttv_hooks_add_list(LttvHooks *h, const LttvHooks *list)
 	const LttvHookClosure *new_c;
 
 	if(unlikely(list == NULL)) return;
+	g_atomic_int_inc(&hooks_generation);
 
 	for(i = 0, j = 0 ; i < list->len; i++) {
 		new_c = &g_array_index(list, LttvHookClosure, i);
@@ -152,6 +179,7 @@ void *lttv_hooks_remove(LttvHooks *h, LttvHook f)
 
 	LttvHookClosure *c;
 
+	g_atomic_int_inc(&hooks_generation);
 	for(i = 0 ; i < h->len ; i++) {
 		c = &g_array_index(h, LttvHookClosure, i);
 		if(c->hook == f) {
@@ -177,6 +205,7 @@ void lttv_hooks_remove_data(LttvHooks *h, LttvHook f, void *hook_data)
 
 	LttvHookClosure *c;
 
+	g_atomic_int_inc(&hooks_generation);
 	for(i = 0 ; i < h->len ; i++) {
 		c = &g_array_index(h, LttvHookClosure, i);
 		if(c->hook == f && c->hook_data == hook_data) {
@@ -200,6 +229,7 @@ void lttv_hooks_remove_list(LttvHooks *h, LttvHooks *list)
 	LttvHookClosure *c, *c_list;
 
 	if(list == NULL) return;
+	g_atomic_int_inc(&hooks_generation);
 	for(i = 0, j = 0 ; i < h->len && j < list->len ;) {
 		c = &g_array_index(h, LttvHookClosure, i);
 		c_list = &g_array_index(list, LttvHookClosure, j);
@@ -255,6 +285,7 @@ void lttv_hooks_get(LttvHooks *h, unsigned i, LttvHook *f, void **hook_data,
 
 void lttv_hooks_remove_by_position(LttvHooks *h, unsigned i)
 {
+	g_atomic_int_inc(&hooks_generation);
 	g_array_remove_index(h, i);
 }
 
@@ -434,6 +465,7 @@ LttvHooks *lttv_hooks_by_id_find(LttvHooksById *h, unsigned id)
 {
 	if(unlikely(h->index->len <= id)) g_ptr_array_set_size(h->index, id + 1);
 	if(unlikely(h->index->pdata[id] == NULL)) {
+		g_atomic_int_inc(&hooks_generation);
 		h->index->pdata[id] = lttv_hooks_new();
 		g_array_append_val(h->array, id);
 	}
@@ -520,3 +552,166 @@ LttvHooks *lttv_hooks_by_id_channel_find(LttvHooksByIdChannelArray *h,
 	hid = lttv_hooks_by_id_channel_find_channel(h, channel);
 	return lttv_hooks_by_id_find(hid->hooks_by_id, id);
 }
+
+LttvHooksDispatch *lttv_hooks_dispatch_new(LttvHooks *h, LttvHooksById *h_by_id)
+{
+	LttvHooksDispatch *d = g_new(LttvHooksDispatch, 1);
+
+	d->hooks = h;
+	d->hooks_by_id = h_by_id;
+	/* Compute observed on first use */
+	d->generation = g_atomic_int_get(&hooks_generation) - 1;
+	d->tables = g_ptr_array_sized_new(PREALLOC_EVENTS);
+	d->generic = NULL;
+	d->depth = 0;
+	return d;
+}
+
+static void dispatch_clear(LttvHooksDispatch *d)
+{
+	guint i;
+
+	for(i = 0 ; i < d->tables->len ; i++) {
+		if(d->tables->pdata[i] != NULL && d->tables->pdata[i] != d->generic)
+			g_array_free(d->tables->pdata[i], TRUE);
+	}
+	g_ptr_array_set_size(d->tables, 0);
+	if(d->generic != NULL) {
+		g_array_free(d->generic, TRUE);
+		d->generic = NULL;
+	}
+}
+
+void lttv_hooks_dispatch_destroy(LttvHooksDispatch *d)
+{
+	dispatch_clear(d);
+	g_ptr_array_free(d->tables, TRUE);
+	g_free(d);
+}
+
+/* Merge h1 and h2 in the order of lttv_hooks_call_merge */
+static LttvHooks *dispatch_build(LttvHooks *h1, LttvHooks *h2)
+{
+	LttvHooks *table;
+	LttvHookClosure *c1, *c2;
+	guint i = 0, j = 0;
+	guint len1 = h1 == NULL ? 0 : h1->len;
+	guint len2 = h2 == NULL ? 0 : h2->len;
+
+	table = g_array_sized_new(FALSE, FALSE, sizeof(LttvHookClosure),
+			len1 + len2);
+	while(i < len1 || j < len2) {
+		c1 = i < len1 ? &g_array_index(h1, LttvHookClosure, i) : NULL;
+		c2 = j < len2 ? &g_array_index(h2, LttvHookClosure, j) : NULL;
+		if(c2 == NULL || (c1 != NULL && c1->prio <= c2->prio)) {
+			g_array_append_val(table, *c1);
+			i++;
+		} else {
+			g_array_append_val(table, *c2);
+			j++;
+		}
+	}
+	return table;
+}
+
+static LttvHooks *dispatch_get_table(LttvHooksDispatch *d, unsigned id)
+{
+	LttvHooks *h_id, *table;
+
+	if(unlikely(d->tables->len <= id))
+		g_ptr_array_set_size(d->tables, id + 1);
+	h_id = lttv_hooks_by_id_get(d->hooks_by_id, id);
+	if(h_id == NULL || h_id->len == 0) {
+		if(d->generic == NULL)
+			d->generic = dispatch_build(d->hooks, NULL);
+		table = d->generic;
+	} else
+		table = dispatch_build(d->hooks, h_id);
+	d->tables->pdata[id] = table;
+	return table;
+}
+
+void lttv_hooks_declare_per_trace(LttvHook h)
+{
+	pthread_mutex_lock(&per_trace_lock);
+	if(per_trace_hooks == NULL)
+		per_trace_hooks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	g_hash_table_insert(per_trace_hooks, (gpointer)h, (gpointer)h);
+	pthread_mutex_unlock(&per_trace_lock);
+}
+
+static gboolean hooks_per_trace(LttvHooks *h)
+{
+	gboolean per_trace = TRUE;
+	guint i;
+
+	if(h == NULL) return TRUE;
+	pthread_mutex_lock(&per_trace_lock);
+	for(i = 0 ; per_trace && i < h->len ; i++) {
+		per_trace = per_trace_hooks != NULL && g_hash_table_lookup(
+				per_trace_hooks,
+				(gpointer)g_array_index(h, LttvHookClosure, i).hook) != NULL;
+	}
+	pthread_mutex_unlock(&per_trace_lock);
+	return per_trace;
+}
+
+/* Drop the tables built from hook lists modified since. A hook modifying
+ * the lists then dispatching again must not free the table its caller is
+ * going through : the update waits for the outermost call to return. */
+static void dispatch_update(LttvHooksDispatch *d)
+{
+	LttvHooks *h_id;
+	guint i;
+
+	if(d->depth > 0)
+		return;
+	dispatch_clear(d);
+	d->generation = g_atomic_int_get(&hooks_generation);
+	d->observed = d->hooks != NULL && d->hooks->len > 0;
+	d->per_trace = hooks_per_trace(d->hooks);
+	for(i = 0 ; i < d->hooks_by_id->array->len ; i++) {
+		h_id = lttv_hooks_by_id_get(d->hooks_by_id,
+				g_array_index(d->hooks_by_id->array, guint, i));
+		d->observed = d->observed || (h_id != NULL && h_id->len > 0);
+		d->per_trace = d->per_trace && hooks_per_trace(h_id);
+	}
+}
+
+gint lttv_hooks_dispatch_call(LttvHooksDispatch *d, unsigned id,
+		void *call_data)
+{
+	gint sum_ret = 0;
+	LttvHooks *table;
+	LttvHookClosure *c;
+	guint i;
+
+	if(unlikely(d->generation != g_atomic_int_get(&hooks_generation)))
+		dispatch_update(d);
+	if(likely(id < d->tables->len && d->tables->pdata[id] != NULL))
+		table = d->tables->pdata[id];
+	else
+		table = dispatch_get_table(d, id);
+
+	d->depth++;
+	for(i = 0 ; i < table->len ; i++) {
+		c = &g_array_index(table, LttvHookClosure, i);
+		sum_ret = sum_ret | c->hook(c->hook_data, call_data);
+	}
+	d->depth--;
+	return sum_ret;
+}
+
+gboolean lttv_hooks_dispatch_observed(LttvHooksDispatch *d)
+{
+	if(unlikely(d->generation != g_atomic_int_get(&hooks_generation)))
+		dispatch_update(d);
+	return d->observed;
+}
+
+gboolean lttv_hooks_dispatch_per_trace(LttvHooksDispatch *d)
+{
+	if(unlikely(d->generation != g_atomic_int_get(&hooks_generation)))
+		dispatch_update(d);
+	return d->per_trace;
+}
@@ -162,6 +162,42 @@ void lttv_hooks_by_id_remove(LttvHooksById *h, unsigned id);
 
 void lttv_hooks_by_id_copy(LttvHooksById *dest, LttvHooksById *src);
 
+
+/* A dispatch table flattens the merge of a generic hook list with the hooks
+ * by id of each id, in the order lttv_hooks_call_merge would call them. The
+ * table of an id is built the first time it is dispatched, and all tables
+ * are rebuilt after any hook list is modified. Hooks added or removed while
+ * a table is being called take effect at the first call after it returns,
+ * calls nested in its hooks keep the tables already built. */
+
+typedef struct _LttvHooksDispatch LttvHooksDispatch;
+
+LttvHooksDispatch *lttv_hooks_dispatch_new(LttvHooks *h, LttvHooksById *h_by_id);
+
+void lttv_hooks_dispatch_destroy(LttvHooksDispatch *d);
+
+/* Same as lttv_hooks_call_merge(h, call_data, lttv_hooks_by_id_get(h_by_id,
+ * id), call_data) */
+
+gint lttv_hooks_dispatch_call(LttvHooksDispatch *d, unsigned id,
+		void *call_data);
+
+/* FALSE when no hook would be called whatever the id */
+
+gboolean lttv_hooks_dispatch_observed(LttvHooksDispatch *d);
+
+/* A hook declared per trace only uses the contexts of the trace its call data
+ * belongs to, and hook data not shared with the hooks of other traces. The
+ * traces may then be processed at once, each in its own thread, see
+ * lttv_process_traceset_middle. Hooks not declared correlate events across
+ * traces and keep them merged in time order. */
+
+void lttv_hooks_declare_per_trace(LttvHook h);
+
+/* TRUE when all the hooks which may be called are declared per trace */
+
+gboolean lttv_hooks_dispatch_per_trace(LttvHooksDispatch *d);
+
 /*
  * Hooks per channel per id. Useful for GUI to save/restore hooks
  * on a per trace basis (rather than per tracefile).
@@ -53,6 +53,8 @@ static gboolean
 	a_debug,
 	a_fatal;
 
+static int a_decode_threads;
+
 gboolean lttv_profile_memory;
 
 int lttv_argc;
@@ -69,6 +71,10 @@ static void lttv_debug(void *hook_data);
 
 static void lttv_event_debug(void *hook_data);
 
+static void lttv_lazy_decode(void *hook_data);
+
+static void lttv_decode_threads(void *hook_data);
+
 static void lttv_fatal(void *hook_data);
 
 static void lttv_help(void *hook_data);
@@ -117,8 +123,13 @@ int main(int argc, char **argv)
 	}
 
 
-	/* Initialize glib and by default ignore info and debug messages */
+	/* Initialize glib and by default ignore info and debug messages. The
+	   trace reader threads (tracefile opening, decode ahead) and the
+	   analysis threads use glib. */
 
+#if !GLIB_CHECK_VERSION(2,32,0)
+	if(!g_thread_supported()) g_thread_init(NULL);
+#endif
 	g_type_init();
 	//g_type_init_with_debug_flags (G_TYPE_DEBUG_OBJECTS | G_TYPE_DEBUG_SIGNALS);
 	g_log_set_handler(NULL, G_LOG_LEVEL_INFO, ignore_and_drop_message, NULL);
@@ -195,6 +206,16 @@ int main(int argc, char **argv)
 	lttv_option_add("edebug",'e', "print event debugging", "none",
 			LTTV_OPT_NONE, NULL, lttv_event_debug, NULL);
 
+	lttv_option_add("lazy-decode", ' ',
+			"compute event field offsets only when fields are read", "none",
+			LTTV_OPT_NONE, NULL, lttv_lazy_decode, NULL);
+
+	a_decode_threads = 0;
+	lttv_option_add("decode-threads", ' ',
+			"decode the tracefiles of the traces added next in this many threads",
+			"number of threads", LTTV_OPT_INT, &a_decode_threads,
+			lttv_decode_threads, NULL);
+
 	a_fatal = FALSE;
 	lttv_option_add("fatal",'f', "make critical messages fatal", "none",
 			LTTV_OPT_NONE, NULL, lttv_fatal, NULL);
@@ -282,6 +303,20 @@ void lttv_event_debug(void *hook_data)
 	g_info("Output event detailed debug");
 }
 
+void lttv_lazy_decode(void *hook_data)
+{
+	ltt_event_lazy_decode(1);
+	g_info("Event field offsets computed only when fields are read");
+}
+
+void lttv_decode_threads(void *hook_data)
+{
+	if(a_decode_threads < 0)
+		a_decode_threads = 0;
+	ltt_tracefile_decode_threads(a_decode_threads);
+	g_info("Tracefiles decoded ahead by %d threads", a_decode_threads);
+}
+
 void lttv_fatal(void *hook_data)
 {
 	g_log_set_always_fatal(G_LOG_LEVEL_WARNING | G_LOG_LEVEL_CRITICAL);
@@ -31,6 +31,10 @@
 #include <ltt/marker-desc.h>
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ltt/ltt-private.h>
 #include <inttypes.h>
 
@@ -196,6 +200,9 @@ static GQuark
 	LTTV_STATE_EVENT,
 	LTTV_STATE_SAVED_STATES,
 	LTTV_STATE_SAVED_STATES_TIME,
+	LTTV_STATE_SAVED_COPIED,
+	LTTV_STATE_SAVED_MEMORY,
+	LTTV_STATE_CHECKPOINTS,
 	LTTV_STATE_TIME,
 	LTTV_STATE_HOOKS,
 	LTTV_STATE_NAME_TABLES,
@@ -221,7 +228,11 @@ static void free_name_tables(LttvTraceState *tcs);
 
 static void free_saved_state(LttvTraceState *tcs);
 
-static void lttv_state_free_process_table(GHashTable *processes);
+static gboolean checkpoint_store_load(LttvTraceState *tcs);
+
+static void free_checkpoint_store(LttvTraceState *tcs);
+
+static void lttv_state_free_process_table(LttvProcessTable *processes);
 
 static void lttv_trace_states_read_raw(LttvTraceState *tcs, FILE *fp,
 		GPtrArray *quarktable);
@@ -270,28 +281,363 @@ void lttv_state_state_saved_free(LttvTraceState *self,
 }
 
 
-guint process_hash(gconstpointer key) 
+/* Process table. The processes are indexed by open addressing on a 64 bits key
+ * packing the pid with the cpu, which only distinguishes the idle processes of
+ * pid 0. Slots are probed linearly and removals shift the following entries
+ * back, so there are no tombstones. The LttvProcessState structures are carved
+ * from chunks owned by the table. When a process exits, it goes to a free list
+ * with its execution stack, user stack and fd table emptied but allocated, for
+ * the next process created.
+ *
+ * Saved states share the processes which did not change between them. A
+ * process of a saved state is a read-only record, reference counted by the
+ * saved states holding it and by the current process it is a copy of
+ * (LttvProcessState.saved). Any access to a current process through
+ * lttv_state_find_process or lttv_process_table_foreach may change it and
+ * drops that link : the next saved state then copies the process again. The
+ * running processes change through running_process without being looked up,
+ * so they are never linked : each saved state copies them, and push_state,
+ * pop_state and schedchange drop the link all the same. */
+
+#define PROCESS_TABLE_MIN_SIZE 64
+#define PROCESS_POOL_CHUNK 256
+
+struct process_slot {
+	guint64 key;
+	LttvProcessState *process;	/* NULL for a free slot */
+};
+
+struct _LttvProcessTable {
+	struct process_slot *slots;
+	guint size;			/* Number of slots, a power of two */
+	guint shift;			/* 64 - log2(size) */
+	guint count;			/* Number of processes in the table */
+
+	GSList *chunks;			/* Arrays of LttvProcessState allocated */
+	LttvProcessState *chunk;	/* Chunk processes are taken from */
+	guint chunk_used, chunk_len;
+	GPtrArray *free_processes;	/* Exited processes, for reuse */
+
+	gboolean saved;			/* Table of a saved state : its processes
+					   are shared records */
+};
+
+struct saved_process {
+	LttvProcessState process;	/* First, records are used as processes */
+	volatile gint ref_count;	/* Atomic : the contexts of the slice
+					   threads restore the same states */
+};
+
+/* Copy of process with its own stacks and fd table */
+
+static void process_copy(LttvProcessState *new_process,
+		const LttvProcessState *process)
 {
-	guint pid = ((const LttvProcessState *)key)->pid;
-	return (pid>>8 ^ pid>>4 ^ pid>>2 ^ pid) ;
+	guint i;
+
+	*new_process = *process;
+	new_process->execution_stack = g_array_sized_new(FALSE, FALSE,
+			sizeof(LttvExecutionState), MAX(PREALLOCATED_EXECUTION_STACK,
+			process->execution_stack->len));
+	new_process->execution_stack =
+			g_array_set_size(new_process->execution_stack,
+			process->execution_stack->len);
+	for(i = 0 ; i < process->execution_stack->len; i++) {
+		g_array_index(new_process->execution_stack, LttvExecutionState, i) =
+				g_array_index(process->execution_stack, LttvExecutionState, i);
+	}
+	new_process->state = &g_array_index(new_process->execution_stack,
+			LttvExecutionState, new_process->execution_stack->len - 1);
+	new_process->user_stack = g_array_sized_new(FALSE, FALSE,
+			sizeof(guint64), process->user_stack->len);
+	new_process->user_stack = g_array_set_size(new_process->user_stack,
+			process->user_stack->len);
+	for(i = 0 ; i < process->user_stack->len; i++) {
+		g_array_index(new_process->user_stack, guint64, i) =
+				g_array_index(process->user_stack, guint64, i);
+	}
+	new_process->current_function = process->current_function;
+
+	/* fd hash table stuff */
+	{
+		GHashTableIter it;
+		gpointer key;
+		gpointer value;
+
+		/* copy every item in the hash table */
+		new_process->fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+		g_hash_table_iter_init(&it, process->fds);
+		while (g_hash_table_iter_next (&it, (void *)&key, (void *)&value)) {
+			g_hash_table_insert(new_process->fds, key, value);
+		}
+	}
+	new_process->saved = NULL;
 }
 
+static void process_free_content(LttvProcessState *process)
+{
+	g_array_free(process->execution_stack, TRUE);
+	g_array_free(process->user_stack, TRUE);
 
-/* If the hash table hash function is well distributed,
- * the process_equal should compare different pid */
-gboolean process_equal(gconstpointer a, gconstpointer b)
+	/* the following also clears the content */
+	g_hash_table_destroy(process->fds);
+}
+
+/* Approximate memory used by a saved process record */
+
+static gsize saved_process_memory(const LttvProcessState *process)
 {
-	const LttvProcessState *process_a, *process_b;
-	gboolean ret = TRUE;
+	return sizeof(struct saved_process)
+			+ process->execution_stack->len * sizeof(LttvExecutionState)
+			+ process->user_stack->len * sizeof(guint64)
+			+ g_hash_table_size(process->fds) * 4 * sizeof(gpointer);
+}
 
-	process_a = (const LttvProcessState *)a;
-	process_b = (const LttvProcessState *)b;
+static void saved_process_unref(LttvProcessState *process)
+{
+	struct saved_process *record = (struct saved_process *)process;
+
+	if(!g_atomic_int_dec_and_test(&record->ref_count))
+		return;
+	process_free_content(&record->process);
+	g_free(record);
+}
+
+static void saved_process_ref(LttvProcessState *process)
+{
+	g_atomic_int_inc(&((struct saved_process *)process)->ref_count);
+}
+
+/* The process may change : the next saved state will need a new copy */
+
+static inline void process_changed(LttvProcessState *process)
+{
+	if(process->saved != NULL) {
+		saved_process_unref(process->saved);
+		process->saved = NULL;
+	}
+}
 
-	if(likely(process_a->pid != process_b->pid)) ret = FALSE;
-	else if(likely(process_a->pid == 0 &&
-			process_a->cpu != process_b->cpu)) ret = FALSE;
+static inline guint64 process_key(guint pid, guint cpu)
+{
+	return ((guint64)pid << 32) | (pid == 0 ? cpu : 0);
+}
 
-	return ret;
+static inline guint process_slot_index(const LttvProcessTable *table,
+		guint64 key)
+{
+	return (guint)((key * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15))
+			>> table->shift);
+}
+
+static void process_table_init_slots(LttvProcessTable *table, guint size)
+{
+	table->size = size;
+	table->shift = 64 - g_bit_storage(size - 1);
+	table->slots = g_new0(struct process_slot, size);
+}
+
+/* New empty table, with room for nb_processes processes before it grows */
+
+static LttvProcessTable *process_table_new(guint nb_processes)
+{
+	LttvProcessTable *table = g_new0(LttvProcessTable, 1);
+	guint size = PROCESS_TABLE_MIN_SIZE;
+
+	while(size * 3 < nb_processes * 4)
+		size <<= 1;
+	process_table_init_slots(table, size);
+	table->chunk_len = MAX(nb_processes, 1);
+	table->chunk = g_new0(LttvProcessState, table->chunk_len);
+	table->chunks = g_slist_prepend(NULL, table->chunk);
+	table->free_processes = g_ptr_array_new();
+	return table;
+}
+
+static struct process_slot *process_table_lookup(
+		const LttvProcessTable *table, guint64 key)
+{
+	guint mask = table->size - 1;
+	guint i = process_slot_index(table, key);
+
+	while(table->slots[i].process != NULL) {
+		if(table->slots[i].key == key)
+			break;
+		i = (i + 1) & mask;
+	}
+	return &table->slots[i];
+}
+
+static void process_table_grow(LttvProcessTable *table)
+{
+	struct process_slot *old_slots = table->slots;
+	guint old_size = table->size;
+	struct process_slot *slot;
+	guint i;
+
+	process_table_init_slots(table, old_size << 1);
+	for(i = 0; i < old_size; i++) {
+		if(old_slots[i].process == NULL)
+			continue;
+		slot = process_table_lookup(table, old_slots[i].key);
+		*slot = old_slots[i];
+	}
+	g_free(old_slots);
+}
+
+/* Index the process, replacing the one with the same key if any */
+
+static void process_table_insert(LttvProcessTable *table,
+		LttvProcessState *process)
+{
+	guint64 key = process_key(process->pid, process->cpu);
+	struct process_slot *slot;
+
+	if(unlikely((table->count + 1) * 4 > table->size * 3))
+		process_table_grow(table);
+	slot = process_table_lookup(table, key);
+	if(slot->process == NULL)
+		table->count++;
+	slot->key = key;
+	slot->process = process;
+}
+
+static void process_table_remove(LttvProcessTable *table, guint64 key)
+{
+	guint mask = table->size - 1;
+	struct process_slot *slot = process_table_lookup(table, key);
+	guint i, j, k;
+
+	if(slot->process == NULL)
+		return;
+
+	/* Shift back the entries of the probe sequence which follow, unless
+	 * their home slot k lies cyclically in (i, j] */
+	i = j = slot - table->slots;
+	for(;;) {
+		j = (j + 1) & mask;
+		if(table->slots[j].process == NULL)
+			break;
+		k = process_slot_index(table, table->slots[j].key);
+		if(i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		table->slots[i] = table->slots[j];
+		i = j;
+	}
+	table->slots[i].process = NULL;
+	table->count--;
+}
+
+/* A process structure from the pool. A recycled one keeps its stacks and fd
+ * table, empty, a new one has them NULL. */
+
+static LttvProcessState *process_table_alloc(LttvProcessTable *table)
+{
+	if(table->free_processes->len > 0)
+		return g_ptr_array_remove_index_fast(table->free_processes,
+				table->free_processes->len - 1);
+
+	if(unlikely(table->chunk_used == table->chunk_len)) {
+		table->chunk_len = PROCESS_POOL_CHUNK;
+		table->chunk = g_new0(LttvProcessState, table->chunk_len);
+		table->chunks = g_slist_prepend(table->chunks, table->chunk);
+		table->chunk_used = 0;
+	}
+	return &table->chunk[table->chunk_used++];
+}
+
+static void process_table_release(LttvProcessTable *table,
+		LttvProcessState *process)
+{
+	process_changed(process);
+	g_array_set_size(process->execution_stack, 0);
+	g_array_set_size(process->user_stack, 0);
+	g_hash_table_remove_all(process->fds);
+	g_ptr_array_add(table->free_processes, process);
+}
+
+static void process_table_foreach(LttvProcessTable *table, GHFunc func,
+		gpointer user_data)
+{
+	guint i;
+
+	for(i = 0; i < table->size; i++) {
+		if(table->slots[i].process != NULL)
+			func(table->slots[i].process, table->slots[i].process, user_data);
+	}
+}
+
+void lttv_process_table_foreach(LttvProcessTable *table, GHFunc func,
+		gpointer user_data)
+{
+	guint i;
+
+	for(i = 0; i < table->size; i++) {
+		if(table->slots[i].process != NULL)
+			process_changed(table->slots[i].process);
+	}
+	process_table_foreach(table, func, user_data);
+}
+
+/* Table of a saved state, with the slots of the current one. The processes
+ * unchanged since the last saved state are shared with it, the others are
+ * copied. Adds the number of copies and the memory taken to the counters. */
+
+static LttvProcessTable *process_table_save(LttvProcessTable *processes,
+		guint *nb_copied, gsize *memory)
+{
+	LttvProcessTable *saved = g_new0(LttvProcessTable, 1);
+	LttvProcessState *process;
+	struct saved_process *record;
+	guint i;
+
+	process_table_init_slots(saved, processes->size);
+	saved->count = processes->count;
+	saved->saved = TRUE;
+	*memory += sizeof(LttvProcessTable)
+			+ saved->size * sizeof(struct process_slot);
+
+	for(i = 0; i < processes->size; i++) {
+		process = processes->slots[i].process;
+		if(process == NULL)
+			continue;
+		if(process->saved == NULL) {
+			record = g_new(struct saved_process, 1);
+			process_copy(&record->process, process);
+			record->ref_count = 1;
+			process->saved = &record->process;
+			(*nb_copied)++;
+			*memory += saved_process_memory(process);
+		}
+		saved_process_ref(process->saved);
+		saved->slots[i].key = processes->slots[i].key;
+		saved->slots[i].process = process->saved;
+	}
+	return saved;
+}
+
+/* Memory freed with the table of a saved state : its slots and the processes
+ * no other saved state or current process shares */
+
+static gsize process_table_saved_memory(LttvProcessTable *saved)
+{
+	gsize memory = sizeof(LttvProcessTable)
+			+ saved->size * sizeof(struct process_slot);
+	guint i;
+
+	for(i = 0; i < saved->size; i++) {
+		if(saved->slots[i].process != NULL
+				&& g_atomic_int_get(
+				&((struct saved_process *)saved->slots[i].process)->ref_count) == 1)
+			memory += saved_process_memory(saved->slots[i].process);
+	}
+	return memory;
+}
+
+guint lttv_process_table_size(LttvProcessTable *table)
+{
+	return table->count;
 }
 
 static void delete_usertrace(gpointer key, gpointer value, gpointer user_data)
@@ -452,7 +798,7 @@ static void restore_init_state(LttvTraceState *self)
 	/* Free the process tables */
 	if(self->processes != NULL) lttv_state_free_process_table(self->processes);
 	if(self->usertraces != NULL) lttv_state_free_usertraces(self->usertraces);
-	self->processes = g_hash_table_new(process_hash, process_equal);
+	self->processes = process_table_new(0);
 	self->usertraces = g_hash_table_new(g_direct_hash, g_direct_equal);
 	self->nb_event = 0;
 
@@ -579,6 +925,14 @@ static void state_load_saved_states(LttvTraceState *tcs)
 	gchar buf[MAX_STRING_LEN];
 	guint len;
 
+	/* A checkpoint file is only mapped, the seeks read its records */
+	if(checkpoint_store_load(tcs)) {
+		tcs->has_precomputed_states = TRUE;
+		*(tcs->max_time_state_recomputed_in_seek) =
+				tcs->parent.time_span.end_time;
+		return;
+	}
+
 	trace_path = g_quark_to_string(ltt_trace_name(tcs->parent.t));
 	strncpy(path, trace_path, PATH_MAX-1);
 	count = strnlen(trace_path, PATH_MAX-1);
@@ -659,6 +1013,9 @@ static void init(LttvTracesetState *self, LttvTraceset *ts)
 		tc = self->parent.traces[i];
 		tcs = LTTV_TRACE_STATE(tc);
 		tcs->save_interval = LTTV_STATE_SAVE_INTERVAL;
+		tcs->save_max_bytes = LTTV_STATE_SAVE_MAX_BYTES;
+		tcs->save_max_memory = LTTV_STATE_SAVE_MAX_MEMORY;
+		memset(&tcs->save_counters, 0, sizeof(tcs->save_counters));
 		lttv_attribute_find(tcs->parent.t_a, LTTV_STATE_TRACE_STATE_USE_COUNT,
 				LTTV_UINT, &v);
 		(*v.v_uint)++;
@@ -758,6 +1115,7 @@ static void fini(LttvTracesetState *self)
 			free_name_tables(tcs);
 			free_max_time(tcs);
 			free_saved_state(tcs);
+			free_checkpoint_store(tcs);
 		}
 		g_free(tcs->running_process);
 		tcs->running_process = NULL;
@@ -857,7 +1215,7 @@ void lttv_state_write(LttvTraceState *self, LttTime t, FILE *fp)
 
 	fprintf(fp,"<PROCESS_STATE TIME_S=%lu TIME_NS=%lu>\n", t.tv_sec, t.tv_nsec);
 
-	g_hash_table_foreach(self->processes, write_process_state, fp);
+	process_table_foreach(self->processes, write_process_state, fp);
 
 	nb_cpus = ltt_trace_get_num_cpu(self->parent.t);
 	for(i=0;i<nb_cpus;i++) {
@@ -984,6 +1342,241 @@ static void write_process_state_raw(gpointer key, gpointer value,
 }
 
 
+/* Position of a tracefile in a saved state or a checkpoint */
+struct state_position {
+	guint64 tsc;
+	guint32 block;                /* G_MAXUINT32 at the end of the tracefile */
+	guint32 offset;
+};
+
+/* Get the position of each tracefile of the trace */
+static void state_get_positions(LttvTraceState *self,
+		struct state_position *positions)
+{
+	LttvTracefileContext *tfc;
+	LttEventPosition *ep;
+	LttTracefile *tf;
+	LttEvent *e;
+	guint i, block, offset;
+	guint64 tsc;
+
+	ep = ltt_event_position_new();
+	for(i = 0 ; i < self->parent.tracefiles->len ; i++) {
+		tfc = g_array_index(self->parent.tracefiles, LttvTracefileContext*, i);
+		e = ltt_tracefile_get_event(tfc->tf);
+		if(e == NULL
+				|| ltt_time_compare(tfc->timestamp, ltt_time_infinite) == 0) {
+			positions[i].tsc = 0;
+			positions[i].block = G_MAXUINT32;
+			positions[i].offset = 0;
+			continue;
+		}
+		ltt_event_position(e, ep);
+		ltt_event_position_get(ep, &tf, &block, &offset, &tsc);
+		positions[i].tsc = tsc;
+		positions[i].block = block;
+		positions[i].offset = offset;
+	}
+	g_free(ep);
+}
+
+/* Seek each tracefile of the trace to its position and requeue it. Returns
+ * FALSE if a position is not in its tracefile, which is then left at its
+ * end. */
+static gboolean state_seek_positions(LttvTraceState *self,
+		const struct state_position *positions)
+{
+	LttvTracesetContext *tsc = self->parent.ts_context;
+	LttvTracefileContext *tfc;
+	LttEventPosition *ep;
+	gboolean ok = TRUE;
+	guint i;
+
+	ep = ltt_event_position_new();
+	for(i = 0 ; i < self->parent.tracefiles->len ; i++) {
+		tfc = g_array_index(self->parent.tracefiles, LttvTracefileContext*, i);
+		LTTV_TRACEFILE_STATE(tfc)->cpu_state =
+				&self->cpu_states[LTTV_TRACEFILE_STATE(tfc)->cpu];
+		lttv_tracefile_queue_remove(tsc->pqueue, tfc);
+		tfc->timestamp = ltt_time_infinite;
+		if(positions[i].block == G_MAXUINT32)
+			continue;
+		ltt_event_position_set(ep, tfc->tf, positions[i].block,
+				positions[i].offset, positions[i].tsc);
+		if(ltt_tracefile_seek_position(tfc->tf, ep) != 0) {
+			ok = FALSE;
+			continue;
+		}
+		tfc->timestamp = ltt_event_time(ltt_tracefile_get_event(tfc->tf));
+		lttv_tracefile_queue_insert(tsc->pqueue, tfc);
+	}
+	g_free(ep);
+	return ok;
+}
+
+
+/* Saved states of a trace, shared by its contexts. They are kept sorted by
+ * time in a flat array, with the positions of the tracefiles of each state,
+ * so a seek finds the closest one by a binary search on the times and seeks
+ * the tracefiles without walking attribute trees. The attribute tree of each
+ * state is the container of lttv_state_save, for lttv_state_restore and
+ * lttv_state_find_saved_state : it holds the positions as one array of
+ * struct state_position, in the order of the tracefiles of the trace. */
+
+struct saved_state {
+	LttTime time;
+	guint64 nb_events;            /* Events of the trace read before the state,
+	                                 0 if unknown */
+	gsize memory;                 /* Memory of the processes copied */
+	guint nb_copied;              /* Processes copied */
+	LttvAttribute *tree;
+	const struct state_position *positions; /* Of the tree, NULL if the class
+	                                 saves the states its own way */
+};
+
+typedef struct _SavedStates {
+	GArray *states;               /* struct saved_state */
+} SavedStates;
+
+static SavedStates **saved_states_slot(LttvTraceState *tcs)
+{
+	LttvAttributeValue value;
+	gboolean retval;
+
+	retval = lttv_attribute_find(tcs->parent.t_a, LTTV_STATE_SAVED_STATES,
+			LTTV_POINTER, &value);
+	g_assert(retval);
+	return (SavedStates **)value.v_pointer;
+}
+
+/* The saved states of the trace, NULL if there are none */
+static SavedStates *saved_states_get(LttvTraceState *tcs)
+{
+	return *(saved_states_slot(tcs));
+}
+
+static inline struct saved_state *saved_states_index(SavedStates *saved,
+		guint pos)
+{
+	return &g_array_index(saved->states, struct saved_state, pos);
+}
+
+/* Save the current state of the trace at time t, after the others */
+static struct saved_state *saved_states_add(LttvTraceState *tcs, LttTime t,
+		guint64 nb_events)
+{
+	SavedStates **slot = saved_states_slot(tcs);
+	SavedStates *saved = *slot;
+	struct saved_state state;
+	LttvAttributeValue value;
+	LttvAttributeType type;
+
+	if(saved == NULL) {
+		saved = *slot = g_new(SavedStates, 1);
+		saved->states = g_array_new(FALSE, FALSE, sizeof(struct saved_state));
+	}
+	g_assert(saved->states->len == 0 || ltt_time_compare(t,
+			saved_states_index(saved, saved->states->len - 1)->time) >= 0);
+
+	state.time = t;
+	state.nb_events = nb_events;
+	state.tree = g_object_new(LTTV_ATTRIBUTE_TYPE, NULL);
+	value = lttv_attribute_add(state.tree, LTTV_STATE_TIME, LTTV_TIME);
+	*(value.v_time) = t;
+	lttv_state_save(tcs, state.tree);
+	type = lttv_attribute_get_by_name(state.tree, LTTV_STATE_SAVED_COPIED,
+			&value);
+	state.nb_copied = type == LTTV_UINT ? *(value.v_uint) : 0;
+	type = lttv_attribute_get_by_name(state.tree, LTTV_STATE_SAVED_MEMORY,
+			&value);
+	state.memory = type == LTTV_ULONG ? *(value.v_ulong) : 0;
+	type = lttv_attribute_get_by_name(state.tree, LTTV_STATE_TRACEFILES,
+			&value);
+	state.positions = type == LTTV_POINTER ? *(value.v_pointer) : NULL;
+	g_array_append_val(saved->states, state);
+	return saved_states_index(saved, saved->states->len - 1);
+}
+
+/* Position of the last state saved before t, -1 if there is none */
+static gint saved_states_find(SavedStates *saved, LttTime t)
+{
+	gint min_pos = -1, max_pos, mid_pos;
+
+	if(saved == NULL)
+		return -1;
+	max_pos = saved->states->len - 1;
+	while(min_pos < max_pos) {
+		mid_pos = (min_pos + max_pos + 1) / 2;
+		if(ltt_time_compare(saved_states_index(saved, mid_pos)->time, t) < 0)
+			min_pos = mid_pos;
+		else
+			max_pos = mid_pos - 1;
+	}
+	return min_pos;
+}
+
+/* Free the saved state at pos, leaving its entry */
+static void saved_states_free_state(LttvTraceState *tcs, SavedStates *saved,
+		guint pos)
+{
+	struct saved_state *state = saved_states_index(saved, pos);
+
+	lttv_state_state_saved_free(tcs, state->tree);
+	g_object_unref(G_OBJECT(state->tree));
+	state->tree = NULL;
+}
+
+
+void lttv_state_write_saved_memory(LttvTraceState *self, FILE *fp)
+{
+	guint i, nb = 0, nb_processes;
+
+	unsigned long total = 0;
+
+	LttvAttributeType type;
+
+	LttvAttributeValue value;
+
+	SavedStates *saved = saved_states_get(self);
+
+	struct saved_state *state;
+
+	if(saved != NULL)
+		nb = saved->states->len;
+
+	for(i = 0 ; i < nb ; i++) {
+		state = saved_states_index(saved, i);
+		type = lttv_attribute_get_by_name(state->tree, LTTV_STATE_PROCESSES,
+				&value);
+		g_assert(type == LTTV_POINTER);
+		nb_processes = lttv_process_table_size(*(value.v_pointer));
+		total += state->memory;
+
+		fprintf(fp, "Saved state %u at %lu.%09lu : %u processes, %u copied, "
+				"%lu bytes\n", i, state->time.tv_sec, state->time.tv_nsec,
+				nb_processes, state->nb_copied, (unsigned long)state->memory);
+	}
+	fprintf(fp, "%u saved states : %lu bytes\n", nb, total);
+}
+
+
+void lttv_state_write_save_counters(LttvTraceState *self, FILE *fp)
+{
+	LttvStateSaveCounters *counters = &self->save_counters;
+
+	fprintf(fp, "States saved %u, thinned %u, memory %lu bytes\n",
+			counters->nb_saved, counters->nb_thinned,
+			(unsigned long)counters->memory);
+	fprintf(fp, "Seeks from a saved state %u, from the start %u\n",
+			counters->nb_seeks, counters->nb_seeks_from_start);
+	fprintf(fp, "Replay time total %lu.%09lu max %lu.%09lu\n",
+			counters->replay_time.tv_sec, counters->replay_time.tv_nsec,
+			counters->max_replay_time.tv_sec, counters->max_replay_time.tv_nsec);
+	fprintf(fp, "Replay events total %" PRIu64 " max %" PRIu64 "\n",
+			counters->replay_events, counters->max_replay_events);
+}
+
+
 void lttv_state_write_raw(LttvTraceState *self, LttTime t, FILE *fp)
 {
 	guint i, nb_tracefile, nb_block, offset;
@@ -1003,7 +1596,7 @@ void lttv_state_write_raw(LttvTraceState *self, LttTime t, FILE *fp)
 	fputc(HDR_PROCESS_STATE, fp);
 	fwrite(&t, sizeof(t), 1, fp);
 
-	g_hash_table_foreach(self->processes, write_process_state_raw, fp);
+	process_table_foreach(self->processes, write_process_state_raw, fp);
 
 	nb_cpus = ltt_trace_get_num_cpu(self->parent.t);
 	for(i=0;i<nb_cpus;i++) {
@@ -1163,10 +1756,7 @@ void lttv_state_read_raw(LttvTraceState *self, FILE *fp, GPtrArray *quarktable)
 
 	LttTime t;
 
-	LttvAttribute *saved_states_tree, *saved_state_tree;
-
-	LttvAttributeValue value;
-	GTree *pqueue = self->parent.ts_context->pqueue;
+	LttvTracefileQueue *pqueue = self->parent.ts_context->pqueue;
 	ep = ltt_event_position_new();
 
 	restore_init_state(self);
@@ -1223,7 +1813,7 @@ end_loop:
 	//	fprintf(fp, "  <TRACEFILE TIMESTAMP_S=%lu TIMESTAMP_NS=%lu",
 	//			tfcs->parent.timestamp.tv_sec,
 	//			tfcs->parent.timestamp.tv_nsec);
-		g_tree_remove(pqueue, &tfcs->parent);
+		lttv_tracefile_queue_remove(pqueue, &tfcs->parent);
 		hdr = fgetc(fp);
 		g_assert(hdr == HDR_TRACEFILE);
 		fread(&tfcs->parent.timestamp, sizeof(tfcs->parent.timestamp), 1, fp);
@@ -1236,20 +1826,12 @@ end_loop:
 			ltt_event_position_set(ep, tfcs->parent.tf, nb_block, offset, tsc);
 			gint ret = ltt_tracefile_seek_position(tfcs->parent.tf, ep);
 			g_assert(ret == 0);
-			g_tree_insert(pqueue, &tfcs->parent, &tfcs->parent);
+			lttv_tracefile_queue_insert(pqueue, &tfcs->parent);
 		}
 	}
 	g_free(ep);
 
-	saved_states_tree = lttv_attribute_find_subdir(self->parent.t_a,
-			LTTV_STATE_SAVED_STATES);
-	saved_state_tree = g_object_new(LTTV_ATTRIBUTE_TYPE, NULL);
-	value = lttv_attribute_add(saved_states_tree,
-			lttv_attribute_get_number(saved_states_tree), LTTV_GOBJECT);
-	*(value.v_gobject) = (GObject *)saved_state_tree;
-	value = lttv_attribute_add(saved_state_tree, LTTV_STATE_TIME, LTTV_TIME);
-	*(value.v_time) = t;
-	lttv_state_save(self, saved_state_tree);
+	saved_states_add(self, t, 0);
 	g_debug("Saving state at time %lu.%lu", t.tv_sec,
 			t.tv_nsec);
 
@@ -1301,66 +1883,579 @@ end_loop:
 
 
 
-/* Copy each process from an existing hash table to a new one */
+/* Checkpoint file. All the structures are multiples of 8 bytes and the
+ * records start at multiples of 8, so they can be read in place from the
+ * mapping. */
+
+#define CHECKPOINT_MAGIC 0x4C545643
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_header {
+	guint32 magic;
+	guint32 version;
+	guint32 nb_cpus;
+	guint32 nb_tracefiles;
+	guint64 nb_checkpoints;
+	guint64 index_offset;         /* struct checkpoint_index, nb_checkpoints */
+	guint64 nb_strings;
+	guint64 strings_offset;       /* guint64 file offset of each string */
+	guint64 file_size;
+};
+
+struct checkpoint_time {
+	guint64 tv_sec;
+	guint64 tv_nsec;
+};
+
+struct checkpoint_index {
+	struct checkpoint_time time;
+	guint64 offset;
+	guint64 size;
+};
+
+/* Record : the header, the running pid of each cpu padded to 8 bytes, the
+ * tracefile positions, then each process followed by its execution stack and
+ * user stack */
+struct checkpoint_record {
+	struct checkpoint_time time;
+	guint32 nb_processes;
+	guint32 nb_cpus;
+};
+
+/* Names are numbers in the string table, 0 for none */
+struct checkpoint_process {
+	guint32 pid;
+	guint32 tgid;
+	guint32 ppid;
+	guint32 cpu;
+	guint32 name;
+	guint32 brand;
+	guint32 type;
+	guint32 free_events;
+	struct checkpoint_time creation_time;
+	struct checkpoint_time insertion_time;
+	guint64 current_function;
+	guint32 nb_execution_states;
+	guint32 nb_user_stack;
+};
+
+struct checkpoint_execution_state {
+	guint32 t;
+	guint32 n;
+	guint32 s;
+	guint32 pad;
+	struct checkpoint_time entry;
+	struct checkpoint_time change;
+	struct checkpoint_time cum_cpu_time;
+};
+
+struct _LttvStateCheckpointWriter {
+	FILE *fp;
+	gchar *path;
+	gchar *tmp_path;
+	struct checkpoint_header header;
+	GArray *index;                /* struct checkpoint_index */
+	GPtrArray *strings;           /* const gchar *, from the quarks */
+	GHashTable *string_numbers;   /* GQuark -> number in strings */
+	GByteArray *record;
+	gboolean error;
+};
+
+/* Checkpoint file of a trace, mapped and shared by its contexts */
+typedef struct _CheckpointStore {
+	void *map;
+	size_t size;
+	const struct checkpoint_header *header;
+	const struct checkpoint_index *index;
+	const guint64 *strings;
+	GQuark *quarks;               /* Quark of each string, 0 until needed */
+} CheckpointStore;
+
+
+static inline struct checkpoint_time to_checkpoint_time(LttTime t)
+{
+	struct checkpoint_time ct = { t.tv_sec, t.tv_nsec };
+	return ct;
+}
+
+static inline LttTime from_checkpoint_time(struct checkpoint_time ct)
+{
+	LttTime t = { ct.tv_sec, ct.tv_nsec };
+	return t;
+}
+
+static guint32 checkpoint_string(LttvStateCheckpointWriter *writer, GQuark q)
+{
+	guint32 number;
+
+	if(q == 0)
+		return 0;
+	number = GPOINTER_TO_UINT(g_hash_table_lookup(writer->string_numbers,
+			GUINT_TO_POINTER(q)));
+	if(number == 0) {
+		number = writer->strings->len;
+		g_ptr_array_add(writer->strings, (gpointer)g_quark_to_string(q));
+		g_hash_table_insert(writer->string_numbers, GUINT_TO_POINTER(q),
+				GUINT_TO_POINTER(number));
+	}
+	return number;
+}
+
+static void checkpoint_write_process(gpointer key, gpointer value,
+		gpointer user_data)
+{
+	LttvStateCheckpointWriter *writer = (LttvStateCheckpointWriter *)user_data;
+	LttvProcessState *process = (LttvProcessState *)value;
+	LttvExecutionState *es;
+	struct checkpoint_process cp;
+	struct checkpoint_execution_state ces;
+	guint i;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.pid = process->pid;
+	cp.tgid = process->tgid;
+	cp.ppid = process->ppid;
+	cp.cpu = process->cpu;
+	cp.name = checkpoint_string(writer, process->name);
+	cp.brand = checkpoint_string(writer, process->brand);
+	cp.type = checkpoint_string(writer, process->type);
+	cp.free_events = process->free_events;
+	cp.creation_time = to_checkpoint_time(process->creation_time);
+	cp.insertion_time = to_checkpoint_time(process->insertion_time);
+	cp.current_function = process->current_function;
+	cp.nb_execution_states = process->execution_stack->len;
+	cp.nb_user_stack = process->user_stack->len;
+	g_byte_array_append(writer->record, (guint8 *)&cp, sizeof(cp));
+
+	memset(&ces, 0, sizeof(ces));
+	for(i = 0 ; i < process->execution_stack->len ; i++) {
+		es = &g_array_index(process->execution_stack, LttvExecutionState, i);
+		ces.t = checkpoint_string(writer, es->t);
+		ces.n = checkpoint_string(writer, es->n);
+		ces.s = checkpoint_string(writer, es->s);
+		ces.entry = to_checkpoint_time(es->entry);
+		ces.change = to_checkpoint_time(es->change);
+		ces.cum_cpu_time = to_checkpoint_time(es->cum_cpu_time);
+		g_byte_array_append(writer->record, (guint8 *)&ces, sizeof(ces));
+	}
+	g_byte_array_append(writer->record, (guint8 *)process->user_stack->data,
+			process->user_stack->len * sizeof(guint64));
+}
+
+
+LttvStateCheckpointWriter *lttv_state_checkpoint_writer_new(
+		LttvTraceState *self, const gchar *path)
+{
+	LttvStateCheckpointWriter *writer = g_new0(LttvStateCheckpointWriter, 1);
+
+	writer->path = g_strdup(path);
+	writer->tmp_path = g_strdup_printf("%s.%d", path, getpid());
+	writer->fp = fopen(writer->tmp_path, "w");
+	if(writer->fp == NULL) {
+		g_warning("Cannot create checkpoint file %s", writer->tmp_path);
+		g_free(writer->tmp_path);
+		g_free(writer->path);
+		g_free(writer);
+		return NULL;
+	}
+
+	writer->header.magic = CHECKPOINT_MAGIC;
+	writer->header.version = CHECKPOINT_VERSION;
+	writer->header.nb_cpus = ltt_trace_get_num_cpu(self->parent.t);
+	writer->header.nb_tracefiles = self->parent.tracefiles->len;
+	writer->index = g_array_new(FALSE, FALSE, sizeof(struct checkpoint_index));
+	writer->strings = g_ptr_array_new();
+	g_ptr_array_add(writer->strings, "");
+	writer->string_numbers = g_hash_table_new(g_direct_hash, g_direct_equal);
+	writer->record = g_byte_array_new();
+
+	/* The header is written again once complete */
+	writer->error = fwrite(&writer->header, sizeof(writer->header), 1,
+			writer->fp) != 1;
+	writer->header.file_size = sizeof(writer->header);
+	return writer;
+}
+
+
+void lttv_state_checkpoint_write(LttvStateCheckpointWriter *writer,
+		LttvTraceState *self, LttTime t)
+{
+	struct checkpoint_record record;
+	struct checkpoint_index entry;
+	guint32 pid;
+	guint i, len;
+
+	/* The index must stay sorted */
+	if(writer->index->len > 0) {
+		entry = g_array_index(writer->index, struct checkpoint_index,
+				writer->index->len - 1);
+		if(ltt_time_compare(t, from_checkpoint_time(entry.time)) < 0) {
+			g_warning("Checkpoint at %lu.%09lu before the previous one, dropped",
+					t.tv_sec, t.tv_nsec);
+			return;
+		}
+	}
+
+	g_byte_array_set_size(writer->record, 0);
+	record.time = to_checkpoint_time(t);
+	record.nb_processes = lttv_process_table_size(self->processes);
+	record.nb_cpus = writer->header.nb_cpus;
+	g_byte_array_append(writer->record, (guint8 *)&record, sizeof(record));
+
+	for(i = 0 ; i < writer->header.nb_cpus ; i++) {
+		pid = self->running_process[i]->pid;
+		g_byte_array_append(writer->record, (guint8 *)&pid, sizeof(pid));
+	}
+	if(writer->header.nb_cpus % 2) {
+		pid = 0;
+		g_byte_array_append(writer->record, (guint8 *)&pid, sizeof(pid));
+	}
+
+	len = writer->record->len;
+	g_byte_array_set_size(writer->record,
+			len + writer->header.nb_tracefiles * sizeof(struct state_position));
+	state_get_positions(self,
+			(struct state_position *)(writer->record->data + len));
+
+	process_table_foreach(self->processes, checkpoint_write_process, writer);
+
+	entry.time = record.time;
+	entry.offset = writer->header.file_size;
+	entry.size = writer->record->len;
+	if(fwrite(writer->record->data, writer->record->len, 1, writer->fp) != 1)
+		writer->error = TRUE;
+	writer->header.file_size += writer->record->len;
+	g_array_append_val(writer->index, entry);
+}
+
+
+gboolean lttv_state_checkpoint_writer_close(LttvStateCheckpointWriter *writer)
+{
+	struct checkpoint_header *header = &writer->header;
+	const gchar *string;
+	guint64 offset;
+	guint i;
+	gboolean ok;
+
+	header->nb_checkpoints = writer->index->len;
+	header->index_offset = header->file_size;
+	if(fwrite(writer->index->data, sizeof(struct checkpoint_index),
+			writer->index->len, writer->fp) != writer->index->len)
+		writer->error = TRUE;
+	header->file_size += writer->index->len * sizeof(struct checkpoint_index);
+
+	header->nb_strings = writer->strings->len;
+	header->strings_offset = header->file_size;
+	offset = header->strings_offset + header->nb_strings * sizeof(guint64);
+	for(i = 0 ; i < writer->strings->len ; i++) {
+		if(fwrite(&offset, sizeof(offset), 1, writer->fp) != 1)
+			writer->error = TRUE;
+		offset += strlen(g_ptr_array_index(writer->strings, i)) + 1;
+	}
+	for(i = 0 ; i < writer->strings->len ; i++) {
+		string = g_ptr_array_index(writer->strings, i);
+		if(fwrite(string, strlen(string) + 1, 1, writer->fp) != 1)
+			writer->error = TRUE;
+	}
+	header->file_size = offset;
+
+	if(fseek(writer->fp, 0, SEEK_SET) != 0
+			|| fwrite(header, sizeof(*header), 1, writer->fp) != 1)
+		writer->error = TRUE;
+	if(fclose(writer->fp) != 0)
+		writer->error = TRUE;
+
+	ok = !writer->error && rename(writer->tmp_path, writer->path) == 0;
+	if(!ok) {
+		g_warning("Cannot write checkpoint file %s", writer->path);
+		unlink(writer->tmp_path);
+	}
+
+	g_array_free(writer->index, TRUE);
+	g_ptr_array_free(writer->strings, TRUE);
+	g_hash_table_destroy(writer->string_numbers);
+	g_byte_array_free(writer->record, TRUE);
+	g_free(writer->tmp_path);
+	g_free(writer->path);
+	g_free(writer);
+	return ok;
+}
+
+
+static CheckpointStore **checkpoint_store_slot(LttvTraceState *tcs)
+{
+	LttvAttributeValue value;
+	gboolean retval;
+
+	retval = lttv_attribute_find(tcs->parent.t_a, LTTV_STATE_CHECKPOINTS,
+			LTTV_POINTER, &value);
+	g_assert(retval);
+	return (CheckpointStore **)value.v_pointer;
+}
 
-static void copy_process_state(gpointer key, gpointer value,gpointer user_data)
+/* Map the checkpoint file of the trace. Only the header, the index and the
+ * string offsets are checked here, the records when restored. */
+static CheckpointStore *checkpoint_store_open(LttvTraceState *tcs)
 {
-	LttvProcessState *process, *new_process;
+	CheckpointStore *store = NULL;
+	const struct checkpoint_header *header;
+	struct stat st;
+	gchar *path;
+	void *map;
+	int fd;
 
-	GHashTable *new_processes = (GHashTable *)user_data;
+	path = g_strdup_printf("%s/" LTTV_STATE_CHECKPOINT_FILE,
+			g_quark_to_string(ltt_trace_name(tcs->parent.t)));
+	fd = open(path, O_RDONLY);
+	if(fd < 0)
+		goto end;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*header))
+		goto close;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED)
+		goto close;
+
+	header = (const struct checkpoint_header *)map;
+	if(header->magic != CHECKPOINT_MAGIC
+			|| header->version != CHECKPOINT_VERSION
+			|| header->nb_cpus != ltt_trace_get_num_cpu(tcs->parent.t)
+			|| header->nb_tracefiles != tcs->parent.tracefiles->len
+			|| header->file_size != (guint64)st.st_size
+			|| header->index_offset > header->file_size
+			|| header->index_offset % 8 != 0
+			|| header->nb_checkpoints > (header->file_size - header->index_offset)
+					/ sizeof(struct checkpoint_index)
+			|| header->strings_offset % 8 != 0
+			|| header->nb_strings == 0
+			|| header->strings_offset > header->file_size
+			|| header->nb_strings > (header->file_size - header->strings_offset)
+					/ sizeof(guint64)) {
+		g_warning("Invalid checkpoint file %s", path);
+		munmap(map, st.st_size);
+		goto close;
+	}
 
-	guint i;
+	store = g_new(CheckpointStore, 1);
+	store->map = map;
+	store->size = st.st_size;
+	store->header = header;
+	store->index = (const struct checkpoint_index *)
+			((const char *)map + header->index_offset);
+	store->strings = (const guint64 *)
+			((const char *)map + header->strings_offset);
+	store->quarks = g_new0(GQuark, header->nb_strings);
+close:
+	close(fd);
+end:
+	g_free(path);
+	return store;
+}
 
-	process = (LttvProcessState *)value;
-	new_process = g_new(LttvProcessState, 1);
-	*new_process = *process;
-	new_process->execution_stack = g_array_sized_new(FALSE, FALSE,
-			sizeof(LttvExecutionState), PREALLOCATED_EXECUTION_STACK);
-	new_process->execution_stack =
-			g_array_set_size(new_process->execution_stack,
-			process->execution_stack->len);
-	for(i = 0 ; i < process->execution_stack->len; i++) {
-		g_array_index(new_process->execution_stack, LttvExecutionState, i) =
-				g_array_index(process->execution_stack, LttvExecutionState, i);
+/* Map the checkpoint file of the trace unless it is already, FALSE if there
+ * is none */
+static gboolean checkpoint_store_load(LttvTraceState *tcs)
+{
+	CheckpointStore **slot = checkpoint_store_slot(tcs);
+
+	if(*slot == NULL)
+		*slot = checkpoint_store_open(tcs);
+	return *slot != NULL;
+}
+
+static void free_checkpoint_store(LttvTraceState *tcs)
+{
+	CheckpointStore **slot = checkpoint_store_slot(tcs);
+	CheckpointStore *store = *slot;
+
+	if(store != NULL) {
+		munmap(store->map, store->size);
+		g_free(store->quarks);
+		g_free(store);
 	}
-	new_process->state = &g_array_index(new_process->execution_stack,
-			LttvExecutionState, new_process->execution_stack->len - 1);
-	new_process->user_stack = g_array_sized_new(FALSE, FALSE,
-			sizeof(guint64), 0);
-	new_process->user_stack = g_array_set_size(new_process->user_stack,
-			process->user_stack->len);
-	for(i = 0 ; i < process->user_stack->len; i++) {
-		g_array_index(new_process->user_stack, guint64, i) =
-				g_array_index(process->user_stack, guint64, i);
+	lttv_attribute_remove_by_name(tcs->parent.t_a, LTTV_STATE_CHECKPOINTS);
+}
+
+/* Quark of string number in the store, FALSE if there is none */
+static gboolean checkpoint_quark(CheckpointStore *store, guint32 number,
+		GQuark *q)
+{
+	const char *string;
+	guint64 offset;
+
+	if(number >= store->header->nb_strings)
+		return FALSE;
+	if(number == 0 || store->quarks[number] != 0) {
+		*q = store->quarks[number];
+		return TRUE;
 	}
-	new_process->current_function = process->current_function;
+	offset = store->strings[number];
+	if(offset >= store->size)
+		return FALSE;
+	string = (const char *)store->map + offset;
+	if(memchr(string, '\0', store->size - offset) == NULL)
+		return FALSE;
+	*q = store->quarks[number] = g_quark_from_string(string);
+	return TRUE;
+}
 
-	/* fd hash table stuff */
-	{
-		GHashTableIter it;
-		gpointer key;
-		gpointer value;
+/* Position of the last checkpoint before t, -1 if there is none */
+static gint checkpoint_find(CheckpointStore *store, LttTime t)
+{
+	gint min_pos = -1, max_pos, mid_pos;
 
-		/* copy every item in the hash table */
-		new_process->fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+	max_pos = store->header->nb_checkpoints - 1;
+	while(min_pos < max_pos) {
+		mid_pos = (min_pos + max_pos + 1) / 2;
+		if(ltt_time_compare(from_checkpoint_time(store->index[mid_pos].time), t)
+				< 0)
+			min_pos = mid_pos;
+		else
+			max_pos = mid_pos - 1;
+	}
+	return min_pos;
+}
 
-		g_hash_table_iter_init(&it, process->fds);
-		while (g_hash_table_iter_next (&it, (void *)&key, (void *)&value)) {
-			g_hash_table_insert(new_process->fds, key, value);
+/* Restore the processes of a record. p is the end of the part read, updated
+ * to the end of the processes. */
+static gboolean checkpoint_restore_processes(LttvTraceState *self,
+		CheckpointStore *store, const struct checkpoint_record *record,
+		const char **p, const char *end)
+{
+	const struct checkpoint_process *cp;
+	const struct checkpoint_execution_state *ces;
+	LttvProcessState *process;
+	LttvExecutionState *es = NULL;
+	LttTime insertion_time;
+	char buffer[128];
+	guint i, j;
+
+	for(i = 0 ; i < record->nb_processes ; i++) {
+		cp = (const struct checkpoint_process *)*p;
+		if((size_t)(end - *p) < sizeof(*cp) || cp->nb_execution_states == 0
+				|| (size_t)(end - *p - sizeof(*cp)) / sizeof(*ces)
+						< cp->nb_execution_states)
+			return FALSE;
+		*p += sizeof(*cp) + cp->nb_execution_states * sizeof(*ces);
+		if((size_t)(end - *p) / sizeof(guint64) < cp->nb_user_stack)
+			return FALSE;
+
+		insertion_time = from_checkpoint_time(cp->insertion_time);
+		process = lttv_state_find_process(self, cp->cpu, cp->pid);
+		if(process == NULL)
+			process = lttv_state_create_process(self, NULL, cp->cpu, cp->pid,
+					cp->tgid, 0, &insertion_time);
+		if(!checkpoint_quark(store, cp->name, &process->name)
+				|| !checkpoint_quark(store, cp->brand, &process->brand)
+				|| !checkpoint_quark(store, cp->type, &process->type))
+			return FALSE;
+		process->tgid = cp->tgid;
+		process->ppid = cp->ppid;
+		process->cpu = cp->cpu;
+		process->free_events = cp->free_events;
+		process->creation_time = from_checkpoint_time(cp->creation_time);
+		process->insertion_time = insertion_time;
+		process->current_function = cp->current_function;
+		sprintf(buffer,"%d-%lu.%lu", process->pid,
+				process->creation_time.tv_sec, process->creation_time.tv_nsec);
+		process->pid_time = g_quark_from_string(buffer);
+
+		process->execution_stack = g_array_set_size(process->execution_stack,
+				cp->nb_execution_states);
+		ces = (const struct checkpoint_execution_state *)(cp + 1);
+		for(j = 0 ; j < cp->nb_execution_states ; j++) {
+			es = &g_array_index(process->execution_stack, LttvExecutionState, j);
+			if(!checkpoint_quark(store, ces[j].t, &es->t)
+					|| !checkpoint_quark(store, ces[j].n, &es->n)
+					|| !checkpoint_quark(store, ces[j].s, &es->s))
+				return FALSE;
+			es->entry = from_checkpoint_time(ces[j].entry);
+			es->change = from_checkpoint_time(ces[j].change);
+			es->cum_cpu_time = from_checkpoint_time(ces[j].cum_cpu_time);
 		}
+		process->state = es;
+
+		process->user_stack = g_array_set_size(process->user_stack,
+				cp->nb_user_stack);
+		memcpy(process->user_stack->data, *p,
+				cp->nb_user_stack * sizeof(guint64));
+		*p += cp->nb_user_stack * sizeof(guint64);
+	}
+	return TRUE;
+}
+
+/* Restore the trace to the checkpoint at pos. Only this record of the file is
+ * read. Returns FALSE if it is corrupted, the state is then undefined. */
+static gboolean checkpoint_restore(LttvTraceState *self,
+		CheckpointStore *store, guint pos)
+{
+	const struct checkpoint_index *entry = &store->index[pos];
+	const struct checkpoint_record *record;
+	const struct state_position *positions;
+	const guint32 *running_pid;
+	const char *p, *end;
+	guint i, nb_cpus = store->header->nb_cpus;
+
+	if(entry->offset % 8 != 0 || entry->offset > store->size
+			|| entry->size > store->size - entry->offset
+			|| entry->size < sizeof(*record))
+		return FALSE;
+	p = (const char *)store->map + entry->offset;
+	end = p + entry->size;
+	record = (const struct checkpoint_record *)p;
+	p += sizeof(*record);
+	if(record->nb_cpus != nb_cpus
+			|| (size_t)(end - p) < (nb_cpus + nb_cpus % 2) * sizeof(guint32)
+					+ store->header->nb_tracefiles * sizeof(*positions))
+		return FALSE;
+	running_pid = (const guint32 *)p;
+	p += (nb_cpus + nb_cpus % 2) * sizeof(guint32);
+	positions = (const struct state_position *)p;
+	p += store->header->nb_tracefiles * sizeof(*positions);
+
+	restore_init_state(self);
+	if(!checkpoint_restore_processes(self, store, record, &p, end))
+		return FALSE;
+	for(i = 0 ; i < nb_cpus ; i++) {
+		self->running_process[i] =
+				lttv_state_find_process(self, i, running_pid[i]);
+		if(self->running_process[i] == NULL)
+			return FALSE;
 	}
 
-	/* When done creating the new process state, insert it in the
-	 * hash table */
-	g_hash_table_insert(new_processes, new_process, new_process);
+	return state_seek_positions(self, positions);
 }
 
 
-static GHashTable *lttv_state_copy_process_table(GHashTable *processes)
+/* Copy of a table for the current state. When copying a saved state, the
+ * processes remain linked to their record until they change. The copy has the
+ * same slots, so the processes keep their place and need not be hashed again.
+ * Its pool is a single chunk holding all of them. */
+
+static LttvProcessTable *lttv_state_copy_process_table(
+		LttvProcessTable *processes)
 {
-	GHashTable *new_processes = g_hash_table_new(process_hash, process_equal);
+	LttvProcessTable *new_processes = process_table_new(processes->count);
+	LttvProcessState *process, *new_process;
+	guint i;
 
-	g_hash_table_foreach(processes, copy_process_state, new_processes);
+	if(new_processes->size != processes->size) {
+		g_free(new_processes->slots);
+		process_table_init_slots(new_processes, processes->size);
+	}
+	for(i = 0; i < processes->size; i++) {
+		process = processes->slots[i].process;
+		if(process == NULL)
+			continue;
+		new_process = process_table_alloc(new_processes);
+		process_copy(new_process, process);
+		if(processes->saved) {
+			saved_process_ref(process);
+			new_process->saved = process;
+		}
+		new_processes->slots[i].key = processes->slots[i].key;
+		new_processes->slots[i].process = new_process;
+	}
+	new_processes->count = processes->count;
 	return new_processes;
 }
 
@@ -1577,31 +2672,47 @@ static void lttv_state_free_blkdev_hashtable(GHashTable *ht)
    stores a copy of the process table, and a member "tracefiles" with
    one entry per tracefile. Each tracefile has a "process" member pointing
    to the current process and a "position" member storing the tracefile
-   position (needed to seek to the current "next" event. */
+   position (needed to seek to the current "next" event. The processes which
+   did not change since the previous saved state are shared with it. The
+   members "copied processes" and "memory" tell how many processes were copied
+   and the memory taken by the copies and the process table. */
 
 static void state_save(LttvTraceState *self, LttvAttribute *container)
 {
 	guint i, nb_tracefile, nb_cpus, nb_irqs, nb_soft_irqs, nb_traps;
 
-	LttvTracefileState *tfcs;
+	guint nb_copied = 0;
 
-	LttvAttribute *tracefiles_tree, *tracefile_tree;
+	gsize memory = 0;
 
 	guint *running_process;
 
-	LttvAttributeValue value;
+	struct state_position *positions;
 
-	LttEventPosition *ep;
+	LttvAttributeValue value;
 
-	tracefiles_tree = lttv_attribute_find_subdir(container,
-			LTTV_STATE_TRACEFILES);
+	/* The running processes are changed through running_process without being
+	 * looked up : they are copied, and not linked to their copy */
+	nb_cpus = ltt_trace_get_num_cpu(self->parent.t);
+	for(i=0;i<nb_cpus;i++) {
+		process_changed(self->running_process[i]);
+	}
 
 	value = lttv_attribute_add(container, LTTV_STATE_PROCESSES,
 			LTTV_POINTER);
-	*(value.v_pointer) = lttv_state_copy_process_table(self->processes);
+	*(value.v_pointer) = process_table_save(self->processes, &nb_copied,
+			&memory);
+
+	for(i=0;i<nb_cpus;i++) {
+		process_changed(self->running_process[i]);
+	}
+
+	value = lttv_attribute_add(container, LTTV_STATE_SAVED_COPIED, LTTV_UINT);
+	*(value.v_uint) = nb_copied;
+	value = lttv_attribute_add(container, LTTV_STATE_SAVED_MEMORY, LTTV_ULONG);
+	*(value.v_ulong) = memory;
 
 	/* Add the currently running processes array */
-	nb_cpus = ltt_trace_get_num_cpu(self->parent.t);
 	running_process = g_new(guint, nb_cpus);
 	for(i=0;i<nb_cpus;i++) {
 		running_process[i] = self->running_process[i]->pid;
@@ -1610,45 +2721,16 @@ static void state_save(LttvTraceState *self, LttvAttribute *container)
 			LTTV_POINTER);
 	*(value.v_pointer) = running_process;
 
-	g_info("State save");
+	g_info("State save : %u processes, %u copied, %lu bytes",
+			lttv_process_table_size(self->processes), nb_copied,
+			(unsigned long)memory);
 
+	/* The position of each tracefile, at the end if it has no more events */
 	nb_tracefile = self->parent.tracefiles->len;
-
-	for(i = 0 ; i < nb_tracefile ; i++) {
-		tfcs =
-				LTTV_TRACEFILE_STATE(g_array_index(self->parent.tracefiles,
-						LttvTracefileContext*, i));
-		tracefile_tree = g_object_new(LTTV_ATTRIBUTE_TYPE, NULL);
-		value = lttv_attribute_add(tracefiles_tree, i,
-				LTTV_GOBJECT);
-		*(value.v_gobject) = (GObject *)tracefile_tree;
-#if 0
-		value = lttv_attribute_add(tracefile_tree, LTTV_STATE_PROCESS,
-				LTTV_UINT);
-		*(value.v_uint) = tfcs->process->pid;
-#endif //0
-		value = lttv_attribute_add(tracefile_tree, LTTV_STATE_EVENT,
-				LTTV_POINTER);
-		/* Only save the position if the tfs has not infinite time. */
-		//if(!g_tree_lookup(self->parent.ts_context->pqueue, &tfcs->parent)
-		//		&& current_tfcs != tfcs) {
-		if(ltt_time_compare(tfcs->parent.timestamp, ltt_time_infinite) == 0) {
-			*(value.v_pointer) = NULL;
-		} else {
-			LttEvent *e = ltt_tracefile_get_event(tfcs->parent.tf);
-			ep = ltt_event_position_new();
-			ltt_event_position(e, ep);
-			*(value.v_pointer) = ep;
-
-			guint nb_block, offset;
-			guint64 tsc;
-			LttTracefile *tf;
-			ltt_event_position_get(ep, &tf, &nb_block, &offset, &tsc);
-			g_info("Block %u offset %u tsc %" PRIu64 " time %lu.%lu", nb_block,
-					offset, tsc, tfcs->parent.timestamp.tv_sec,
-					tfcs->parent.timestamp.tv_nsec);
-		}
-	}
+	positions = g_new(struct state_position, nb_tracefile);
+	state_get_positions(self, positions);
+	value = lttv_attribute_add(container, LTTV_STATE_TRACEFILES, LTTV_POINTER);
+	*(value.v_pointer) = positions;
 
 	/* save the cpu state */
 	{
@@ -1692,13 +2774,11 @@ static void state_save(LttvTraceState *self, LttvAttribute *container)
 }
 
 
-static void state_restore(LttvTraceState *self, LttvAttribute *container)
+/* Restore the state saved in container, except the tracefile positions */
+static void state_restore_resources(LttvTraceState *self,
+		LttvAttribute *container)
 {
-	guint i, nb_tracefile, pid, nb_cpus, nb_irqs, nb_soft_irqs, nb_traps;
-
-	LttvTracefileState *tfcs;
-
-	LttvAttribute *tracefiles_tree, *tracefile_tree;
+	guint i, pid, nb_cpus, nb_irqs, nb_soft_irqs, nb_traps;
 
 	guint *running_process;
 
@@ -1706,18 +2786,6 @@ static void state_restore(LttvTraceState *self, LttvAttribute *container)
 
 	LttvAttributeValue value;
 
-	LttvAttributeName name;
-
-	gboolean is_named;
-
-	LttEventPosition *ep;
-
-	LttvTracesetContext *tsc = self->parent.ts_context;
-	int retval;
-
-	tracefiles_tree = lttv_attribute_find_subdir(container,
-			LTTV_STATE_TRACEFILES);
-
 	type = lttv_attribute_get_by_name(container, LTTV_STATE_PROCESSES,
 			&value);
 	g_assert(type == LTTV_POINTER);
@@ -1736,11 +2804,6 @@ static void state_restore(LttvTraceState *self, LttvAttribute *container)
 		g_assert(self->running_process[i] != NULL);
 	}
 
-	nb_tracefile = self->parent.tracefiles->len;
-
-	//g_tree_destroy(tsc->pqueue);
-	//tsc->pqueue = g_tree_new(compare_tracefile);
-
 	/* restore cpu resource states */
 	type = lttv_attribute_get_by_name(container, LTTV_STATE_RESOURCE_CPUS, &value);
 	g_assert(type == LTTV_POINTER);
@@ -1773,56 +2836,48 @@ static void state_restore(LttvTraceState *self, LttvAttribute *container)
 	g_assert(type == LTTV_POINTER);
 	lttv_state_free_blkdev_hashtable(self->bdev_states);
 	self->bdev_states = lttv_state_copy_blkdev_hashtable(*(value.v_pointer));
+}
 
-	for(i = 0 ; i < nb_tracefile ; i++) {
-		tfcs =
-				LTTV_TRACEFILE_STATE(g_array_index(self->parent.tracefiles,
-						LttvTracefileContext*, i));
-		type = lttv_attribute_get(tracefiles_tree, i, &name, &value, &is_named);
-		g_assert(type == LTTV_GOBJECT);
-		tracefile_tree = *((LttvAttribute **)(value.v_gobject));
-#if 0
-		type = lttv_attribute_get_by_name(tracefile_tree, LTTV_STATE_PROCESS,
-				&value);
-		g_assert(type == LTTV_UINT);
-		pid = *(value.v_uint);
-		tfcs->process = lttv_state_find_process_or_create(tfcs, pid);
-#endif //0
-		type = lttv_attribute_get_by_name(tracefile_tree, LTTV_STATE_EVENT,
-				&value);
-		g_assert(type == LTTV_POINTER);
-		//g_assert(*(value.v_pointer) != NULL);
-		ep = *(value.v_pointer);
-		g_assert(tfcs->parent.t_context != NULL);
-
-		tfcs->cpu_state = &self->cpu_states[tfcs->cpu];
-
-		LttvTracefileContext *tfc = LTTV_TRACEFILE_CONTEXT(tfcs);
-		g_tree_remove(tsc->pqueue, tfc);
-
-		if(ep != NULL) {
-			retval= ltt_tracefile_seek_position(tfc->tf, ep);
-			g_assert_cmpint(retval, ==, 0);
-			tfc->timestamp = ltt_event_time(ltt_tracefile_get_event(tfc->tf));
-			g_assert_cmpint(ltt_time_compare(tfc->timestamp, ltt_time_infinite),
-					!=, 0);
-			g_tree_insert(tsc->pqueue, tfc, tfc);
-			g_info("Restoring state for a tf at time %lu.%lu",
-					tfc->timestamp.tv_sec, tfc->timestamp.tv_nsec);
-		} else {
-			tfc->timestamp = ltt_time_infinite;
-		}
+
+static void state_restore(LttvTraceState *self, LttvAttribute *container)
+{
+	LttvAttributeType type;
+
+	LttvAttributeValue value;
+
+	gboolean retval;
+
+	state_restore_resources(self, container);
+
+	type = lttv_attribute_get_by_name(container, LTTV_STATE_TRACEFILES,
+			&value);
+	g_assert(type == LTTV_POINTER);
+	retval = state_seek_positions(self, *(value.v_pointer));
+	g_assert(retval);
+}
+
+/* Restore the saved state at pos. The tracefiles are seeked to the positions
+ * kept with the state, unless the class restores the states its own way. */
+static void saved_state_restore(LttvTraceState *self, SavedStates *saved,
+		guint pos)
+{
+	struct saved_state *state = saved_states_index(saved, pos);
+	gboolean retval;
+
+	if(LTTV_TRACE_STATE_GET_CLASS(self)->state_restore != state_restore
+			|| state->positions == NULL) {
+		lttv_state_restore(self, state->tree);
+		return;
 	}
+	state_restore_resources(self, state->tree);
+	retval = state_seek_positions(self, state->positions);
+	g_assert(retval);
 }
 
 
 static void state_saved_free(LttvTraceState *self, LttvAttribute *container)
 {
-	guint i, nb_tracefile, nb_cpus, nb_irqs, nb_soft_irqs;
-
-	LttvTracefileState *tfcs;
-
-	LttvAttribute *tracefiles_tree, *tracefile_tree;
+	guint nb_cpus, nb_irqs, nb_soft_irqs;
 
 	guint *running_process;
 
@@ -1830,13 +2885,10 @@ static void state_saved_free(LttvTraceState *self, LttvAttribute *container)
 
 	LttvAttributeValue value;
 
-	LttvAttributeName name;
-
-	gboolean is_named;
-
-	tracefiles_tree = lttv_attribute_find_subdir(container,
-			LTTV_STATE_TRACEFILES);
-	g_object_ref(G_OBJECT(tracefiles_tree));
+	type = lttv_attribute_get_by_name(container, LTTV_STATE_TRACEFILES,
+			&value);
+	g_assert(type == LTTV_POINTER);
+	g_free(*(value.v_pointer));
 	lttv_attribute_remove_by_name(container, LTTV_STATE_TRACEFILES);
 
 	type = lttv_attribute_get_by_name(container, LTTV_STATE_PROCESSES,
@@ -1877,48 +2929,20 @@ static void state_saved_free(LttvTraceState *self, LttvAttribute *container)
 	type = lttv_attribute_get_by_name(container, LTTV_STATE_RESOURCE_BLKDEVS, &value);
 	g_assert(type == LTTV_POINTER);
 	lttv_state_free_blkdev_hashtable(*(value.v_pointer));
-
-	nb_tracefile = self->parent.tracefiles->len;
-
-	for(i = 0 ; i < nb_tracefile ; i++) {
-		tfcs =
-				LTTV_TRACEFILE_STATE(g_array_index(self->parent.tracefiles,
-						LttvTracefileContext*, i));
-		type = lttv_attribute_get(tracefiles_tree, i, &name, &value, &is_named);
-		g_assert(type == LTTV_GOBJECT);
-		tracefile_tree = *((LttvAttribute **)(value.v_gobject));
-
-		type = lttv_attribute_get_by_name(tracefile_tree, LTTV_STATE_EVENT,
-				&value);
-		g_assert(type == LTTV_POINTER);
-		if(*(value.v_pointer) != NULL) g_free(*(value.v_pointer));
-	}
-	g_object_unref(G_OBJECT(tracefiles_tree));
 }
 
 
 static void free_saved_state(LttvTraceState *self)
 {
-	guint i, nb;
-
-	LttvAttributeType type;
-
-	LttvAttributeValue value;
-
-	LttvAttributeName name;
-
-	gboolean is_named;
-
-	LttvAttribute *saved_states;
+	guint i;
 
-	saved_states = lttv_attribute_find_subdir(self->parent.t_a,
-			LTTV_STATE_SAVED_STATES);
+	SavedStates *saved = saved_states_get(self);
 
-	nb = lttv_attribute_get_number(saved_states);
-	for(i = 0 ; i < nb ; i++) {
-		type = lttv_attribute_get(saved_states, i, &name, &value, &is_named);
-		g_assert(type == LTTV_GOBJECT);
-		state_saved_free(self, *((LttvAttribute **)value.v_gobject));
+	if(saved != NULL) {
+		for(i = 0 ; i < saved->states->len ; i++)
+			saved_states_free_state(self, saved, i);
+		g_array_free(saved->states, TRUE);
+		g_free(saved);
 	}
 
 	lttv_attribute_remove_by_name(self->parent.t_a, LTTV_STATE_SAVED_STATES);
@@ -2141,9 +3165,9 @@ static void test_process(gpointer key, gpointer value, gpointer user_data)
 	guint stack_len = process->execution_stack->len;
 }
 
-static void hash_table_check(GHashTable *table)
+static void hash_table_check(LttvProcessTable *table)
 {
-	g_hash_table_foreach(table, test_process, NULL);
+	process_table_foreach(table, test_process, NULL);
 }
 
 
@@ -2226,6 +3250,7 @@ static void push_state(LttvTracefileState *tfs, LttvExecutionMode t,
 
 	guint depth = process->execution_stack->len;
 
+	process_changed(process);
 	process->execution_stack =
 		g_array_set_size(process->execution_stack, depth + 1);
 	/* Keep in sync */
@@ -2252,6 +3277,7 @@ lttv_state_pop_state_cleanup(LttvProcessState *process, LttvTracefileState *tfs)
 		return 1;
 	}
 
+	process_changed(process);
 	process->execution_stack =
 			g_array_set_size(process->execution_stack, depth - 1);
 	process->state = &g_array_index(process->execution_stack, LttvExecutionState,
@@ -2290,6 +3316,7 @@ static void pop_state(LttvTracefileState *tfs, LttvExecutionMode t)
 		return;
 	}
 
+	process_changed(process);
 	process->execution_stack =
 			g_array_set_size(process->execution_stack, depth - 1);
 	process->state = &g_array_index(process->execution_stack, LttvExecutionState,
@@ -2355,7 +3382,7 @@ LttvProcessState *lttv_state_create_process(LttvTraceState *tcs,
 		LttvProcessState *parent, guint cpu, guint pid,
 		guint tgid, GQuark name, const LttTime *timestamp)
 {
-	LttvProcessState *process = g_new(LttvProcessState, 1);
+	LttvProcessState *process = process_table_alloc(tcs->processes);
 
 	LttvExecutionState *es;
 
@@ -2371,9 +3398,10 @@ LttvProcessState *lttv_state_create_process(LttvTraceState *tcs,
 	process->type = LTTV_STATE_USER_THREAD;
 	process->usertrace = ltt_state_usertrace_find(tcs, pid, timestamp);
 	process->current_function = 0; //function 0x0 by default.
+	process->saved = NULL;
 
 	g_info("Process %u, core %p", process->pid, process);
-	g_hash_table_insert(tcs->processes, process, process);
+	process_table_insert(tcs->processes, process);
 
 	if(parent) {
 		process->ppid = parent->pid;
@@ -2397,8 +3425,14 @@ LttvProcessState *lttv_state_create_process(LttvTraceState *tcs,
 	process->free_events = 0;
 	//process->last_cpu = tfs->cpu_name;
 	//process->last_cpu_index = ltt_tracefile_num(((LttvTracefileContext*)tfs)->tf);
-	process->execution_stack = g_array_sized_new(FALSE, FALSE,
-			sizeof(LttvExecutionState), PREALLOCATED_EXECUTION_STACK);
+	if(process->execution_stack == NULL) {
+		process->execution_stack = g_array_sized_new(FALSE, FALSE,
+				sizeof(LttvExecutionState), PREALLOCATED_EXECUTION_STACK);
+		/* Allocate an empty function call stack. If it's empty, use 0x0. */
+		process->user_stack = g_array_sized_new(FALSE, FALSE,
+				sizeof(guint64), 0);
+		process->fds = g_hash_table_new(g_direct_hash, g_direct_equal);
+	}
 	process->execution_stack = g_array_set_size(process->execution_stack, 2);
 	es = process->state = &g_array_index(process->execution_stack,
 			LttvExecutionState, 0);
@@ -2420,24 +3454,18 @@ LttvProcessState *lttv_state_create_process(LttvTraceState *tcs,
 	es->cum_cpu_time = ltt_time_zero;
 	es->s = LTTV_STATE_WAIT_FORK;
 
-	/* Allocate an empty function call stack. If it's empty, use 0x0. */
-	process->user_stack = g_array_sized_new(FALSE, FALSE,
-			sizeof(guint64), 0);
-
-	process->fds = g_hash_table_new(g_direct_hash, g_direct_equal);
-
 	return process;
 }
 
 LttvProcessState *
 lttv_state_find_process(LttvTraceState *ts, guint cpu, guint pid)
 {
-	LttvProcessState key;
-	LttvProcessState *process;
+	LttvProcessState *process =
+			process_table_lookup(ts->processes, process_key(pid, cpu))->process;
 
-	key.pid = pid;
-	key.cpu = cpu;
-	process = g_hash_table_lookup(ts->processes, &key);
+	/* The caller may change it */
+	if(process != NULL)
+		process_changed(process);
 	return process;
 }
 
@@ -2473,43 +3501,49 @@ LttvProcessState *lttv_state_find_process_or_create(LttvTraceState *ts,
 static int exit_process(LttvTracefileState *tfs, LttvProcessState *process) 
 {
 	LttvTraceState *ts = LTTV_TRACE_STATE(tfs->parent.t_context);
-	LttvProcessState key;
 
 	/* Wait for both schedule with exit dead and process free to happen.
 	 * They can happen in any order. */
 	if (++(process->free_events) < 2)
 		return 0;
 
-	key.pid = process->pid;
-	key.cpu = process->cpu;
-	g_hash_table_remove(ts->processes, &key);
-	g_array_free(process->execution_stack, TRUE);
-	g_array_free(process->user_stack, TRUE);
-
-	/* the following also clears the content */
-	g_hash_table_destroy(process->fds);
-
-	g_free(process);
+	process_table_remove(ts->processes,
+			process_key(process->pid, process->cpu));
+	process_table_release(ts->processes, process);
 	return 1;
 }
 
 
 static void free_process_state(gpointer key, gpointer value,gpointer user_data)
 {
-	g_array_free(((LttvProcessState *)value)->execution_stack, TRUE);
-	g_array_free(((LttvProcessState *)value)->user_stack, TRUE);
-
-	/* the following also clears the content */
-	g_hash_table_destroy(((LttvProcessState *)value)->fds);
-
-	g_free(value);
+	process_changed((LttvProcessState *)value);
+	process_free_content((LttvProcessState *)value);
 }
 
 
-static void lttv_state_free_process_table(GHashTable *processes)
+static void lttv_state_free_process_table(LttvProcessTable *processes)
 {
-	g_hash_table_foreach(processes, free_process_state, NULL);
-	g_hash_table_destroy(processes);
+	guint i;
+
+	if(processes->saved) {
+		for(i = 0; i < processes->size; i++) {
+			if(processes->slots[i].process != NULL)
+				saved_process_unref(processes->slots[i].process);
+		}
+		g_free(processes->slots);
+		g_free(processes);
+		return;
+	}
+
+	process_table_foreach(processes, free_process_state, NULL);
+	for(i = 0; i < processes->free_processes->len; i++)
+		free_process_state(NULL, g_ptr_array_index(processes->free_processes, i),
+				NULL);
+	g_ptr_array_free(processes->free_processes, TRUE);
+	g_slist_foreach(processes->chunks, (GFunc)g_free, NULL);
+	g_slist_free(processes->chunks);
+	g_free(processes->slots);
+	g_free(processes);
 }
 
 
@@ -2980,6 +4014,7 @@ static gboolean schedchange(void *hook_data, void *call_data)
 	state_out = ltt_event_get_long_int(e, lttv_trace_get_hook_field(th, 2));
 
 	if(likely(process != NULL)) {
+		process_changed(process);
 
 		/* We could not know but it was not the idle process executing.
 		   This should only happen at the beginning, before the first schedule
@@ -3404,7 +4439,7 @@ static gboolean statedump_end(void *hook_data, void *call_data)
 		/* if kernel thread, if stack[0] is unknown, set to syscall mode, wait */
 		/* else, if stack[0] is unknown, set to user mode, running */
 
-	g_hash_table_foreach(ts->processes, fix_process, &tfc->timestamp);
+	lttv_process_table_foreach(ts->processes, fix_process, &tfc->timestamp);
 
 	return FALSE;
 }
@@ -3803,6 +4838,11 @@ void lttv_state_add_event_hooks(LttvTracesetState *self)
 				FIELD_ARRAY(LTT_FIELD_FD, LTT_FIELD_FILENAME),
 				fs_open, NULL, &hooks);
 
+		/* The state of a trace only depends on its own events */
+		for(k = 0 ; k < hooks->len ; k++)
+			lttv_hooks_declare_per_trace(
+					g_array_index(hooks, LttvTraceHook, k).h);
+
 		/* Add these hooks to each event_by_id hooks list */
 
 		nb_tracefile = ts->parent.tracefiles->len;
@@ -3882,38 +4922,88 @@ void lttv_state_remove_event_hooks(LttvTracesetState *self)
 	}
 }
 
-static gboolean state_save_event_hook(void *hook_data, void *call_data)
+/* Placement of the saved states of a trace, shared by its tracefiles */
+
+struct state_save_data {
+	guint64 nb_events;	/* Events of the trace read */
+	guint64 events;		/* Events since the last saved state */
+	guint64 bytes;		/* Event payload bytes since the last saved state */
+	guint spacing;		/* Factor of the replay costs, doubled by thinning */
+};
+
+/* Remove every other saved state of the trace, keeping the first, until their
+ * memory fits under the cap */
+
+static void state_save_thin(LttvTraceState *tcs, struct state_save_data *data)
 {
-	guint *event_count = (guint*)hook_data;
+	SavedStates *saved = saved_states_get(tcs);
 
-	/* Only save at LTTV_STATE_SAVE_INTERVAL */
-	if(likely((*event_count)++ < LTTV_STATE_SAVE_INTERVAL))
-		return FALSE;
-	else
-		*event_count = 0;
+	LttvAttributeType type;
+
+	LttvAttributeValue value;
+
+	guint i, nb;
+
+	while(tcs->save_counters.memory > tcs->save_max_memory) {
+		nb = saved->states->len;
+		if(nb <= 2)
+			break;
+
+		for(i = 0 ; i < nb ; i++) {
+			if(i % 2 == 0) {
+				*saved_states_index(saved, i / 2) = *saved_states_index(saved, i);
+				continue;
+			}
+			type = lttv_attribute_get_by_name(saved_states_index(saved, i)->tree,
+					LTTV_STATE_PROCESSES, &value);
+			g_assert(type == LTTV_POINTER);
+			tcs->save_counters.memory -= MIN(tcs->save_counters.memory,
+					process_table_saved_memory(*(value.v_pointer)));
+			saved_states_free_state(tcs, saved, i);
+			tcs->save_counters.nb_thinned++;
+		}
+		g_array_set_size(saved->states, (nb + 1) / 2);
+		data->spacing *= 2;
+		g_info("Saved states thinned to %u, %lu bytes", saved->states->len,
+				(unsigned long)tcs->save_counters.memory);
+	}
+}
+
+static gboolean state_save_event_hook(void *hook_data, void *call_data)
+{
+	struct state_save_data *data = (struct state_save_data *)hook_data;
 
 	LttvTracefileState *self = (LttvTracefileState *)call_data;
 
 	LttvTraceState *tcs = (LttvTraceState *)(self->parent.t_context);
 
-	LttvAttribute *saved_states_tree, *saved_state_tree;
+	struct saved_state *state;
 
-	LttvAttributeValue value;
+	data->nb_events++;
+	data->events++;
+	data->bytes += ltt_tracefile_get_event(self->parent.tf)->data_size;
+
+	/* Save once replaying from the last saved state would cost too much */
+	if(likely((tcs->save_interval == 0
+			|| data->events <= (guint64)tcs->save_interval * data->spacing)
+			&& (tcs->save_max_bytes == 0
+			|| data->bytes <= tcs->save_max_bytes * data->spacing)))
+		return FALSE;
+	data->events = 0;
+	data->bytes = 0;
 
-	saved_states_tree = lttv_attribute_find_subdir(tcs->parent.t_a,
-			LTTV_STATE_SAVED_STATES);
-	saved_state_tree = g_object_new(LTTV_ATTRIBUTE_TYPE, NULL);
-	value = lttv_attribute_add(saved_states_tree,
-			lttv_attribute_get_number(saved_states_tree), LTTV_GOBJECT);
-	*(value.v_gobject) = (GObject *)saved_state_tree;
-	value = lttv_attribute_add(saved_state_tree, LTTV_STATE_TIME, LTTV_TIME);
-	*(value.v_time) = self->parent.timestamp;
-	lttv_state_save(tcs, saved_state_tree);
+	state = saved_states_add(tcs, self->parent.timestamp, data->nb_events);
 	g_debug("Saving state at time %lu.%lu", self->parent.timestamp.tv_sec,
 			self->parent.timestamp.tv_nsec);
 
 	*(tcs->max_time_state_recomputed_in_seek) = self->parent.timestamp;
 
+	tcs->save_counters.nb_saved++;
+	tcs->save_counters.memory += state->memory;
+	if(tcs->save_max_memory != 0
+			&& tcs->save_counters.memory > tcs->save_max_memory)
+		state_save_thin(tcs, data);
+
 	return FALSE;
 }
 
@@ -4069,8 +5159,11 @@ void lttv_state_save_add_event_hooks(LttvTracesetState *self)
 
 		if(ts->has_precomputed_states) continue;
 
-		guint *event_count = g_new(guint, 1);
-		*event_count = 0;
+		struct state_save_data *data = g_new0(struct state_save_data, 1);
+		data->spacing = 1;
+
+		/* The placement data is specific to the trace */
+		lttv_hooks_declare_per_trace(state_save_event_hook);
 
 		for(j = 0 ; j < nb_tracefile ; j++) {
 			tfs =
@@ -4078,7 +5171,7 @@ void lttv_state_save_add_event_hooks(LttvTracesetState *self)
 					LttvTracefileContext*, j));
 			lttv_hooks_add(tfs->parent.event,
 					state_save_event_hook,
-					event_count,
+					data,
 					LTTV_PRIO_STATE);
 
 		}
@@ -4168,16 +5261,16 @@ void lttv_state_save_remove_event_hooks(LttvTracesetState *self)
 
 		if(ts->has_precomputed_states) continue;
 
-		guint *event_count = NULL;
+		struct state_save_data *data = NULL;
 
 		for(j = 0 ; j < nb_tracefile ; j++) {
 			tfs =
 					LTTV_TRACEFILE_STATE(g_array_index(ts->parent.tracefiles,
 							LttvTracefileContext*, j));
-			event_count = lttv_hooks_remove(tfs->parent.event,
+			data = lttv_hooks_remove(tfs->parent.event,
 					state_save_event_hook);
 		}
-		if(event_count) g_free(event_count);
+		if(data) g_free(data);
 	}
 }
 
@@ -4190,27 +5283,70 @@ gint lttv_state_save_hook_remove_event_hooks(void *hook_data, void *call_data)
 	return 0;
 }
 
+/* Return the latest state saved for the trace before time t, NULL if none.
+ * The saved states are only read, several contexts may restore the
+ * returned state at once. */
+LttvAttribute *lttv_state_find_saved_state(LttvTraceState *self, LttTime t)
+{
+	SavedStates *saved = saved_states_get(self);
+
+	gint pos = saved_states_find(saved, t);
+
+	if(pos == -1) return NULL;
+	return saved_states_index(saved, pos)->tree;
+}
+
+/* Count a seek restoring the state saved at time, to replay up to t */
+static void seek_count_replay_time(LttvTraceState *tcs, LttTime time,
+		LttTime t)
+{
+	LttvStateSaveCounters *counters = &tcs->save_counters;
+
+	LttTime replay_time = ltt_time_sub(t, time);
+
+	counters->nb_seeks++;
+	counters->replay_time = ltt_time_add(counters->replay_time, replay_time);
+	if(ltt_time_compare(replay_time, counters->max_replay_time) > 0)
+		counters->max_replay_time = replay_time;
+}
+
+/* Count the replay of a seek to t from the saved state pos */
+static void seek_count_replay(LttvTraceState *tcs, SavedStates *saved,
+		guint pos, LttTime t)
+{
+	LttvStateSaveCounters *counters = &tcs->save_counters;
+
+	struct saved_state *state = saved_states_index(saved, pos);
+
+	guint64 events;
+
+	seek_count_replay_time(tcs, state->time, t);
+
+	/* The events up to the next saved state bound the replay. States read
+	 * from a file have no event count. */
+	if(pos + 1 >= saved->states->len || state->nb_events == 0)
+		return;
+	events = saved_states_index(saved, pos + 1)->nb_events - state->nb_events;
+	counters->replay_events += events;
+	if(events > counters->max_replay_events)
+		counters->max_replay_events = events;
+}
+
 void lttv_state_traceset_seek_time_closest(LttvTracesetState *self, LttTime t)
 {
 	LttvTraceset *traceset = self->parent.ts;
 
 	guint i, nb_trace;
 
-	int min_pos, mid_pos, max_pos;
-
 	guint call_rest = 0;
 
 	LttvTraceState *tcs;
 
-	LttvAttributeValue value;
-
-	LttvAttributeType type;
-
-	LttvAttributeName name;
+	SavedStates *saved;
 
-	gboolean is_named;
+	CheckpointStore *store;
 
-	LttvAttribute *saved_states_tree, *saved_state_tree, *closest_tree = NULL;
+	gint pos;
 
 	//g_tree_destroy(self->parent.pqueue);
 	//self->parent.pqueue = g_tree_new(compare_tracefile);
@@ -4221,42 +5357,38 @@ void lttv_state_traceset_seek_time_closest(LttvTracesetState *self, LttTime t)
 	for(i = 0 ; i < nb_trace ; i++) {
 		tcs = (LttvTraceState *)self->parent.traces[i];
 
-		if(ltt_time_compare(t, *(tcs->max_time_state_recomputed_in_seek)) < 0) {
-			saved_states_tree = lttv_attribute_find_subdir(tcs->parent.t_a,
-					LTTV_STATE_SAVED_STATES);
-			min_pos = -1;
-
-			if(saved_states_tree) {
-				max_pos = lttv_attribute_get_number(saved_states_tree) - 1;
-				mid_pos = max_pos / 2;
-				while(min_pos < max_pos) {
-					type = lttv_attribute_get(saved_states_tree, mid_pos,
-							&name, &value, &is_named);
-					g_assert(type == LTTV_GOBJECT);
-					saved_state_tree = *((LttvAttribute **)(value.v_gobject));
-					type = lttv_attribute_get_by_name(saved_state_tree,
-							LTTV_STATE_TIME, &value);
-					g_assert(type == LTTV_TIME);
-					if(ltt_time_compare(*(value.v_time), t) < 0) {
-						min_pos = mid_pos;
-						closest_tree = saved_state_tree;
-					}
-					else max_pos = mid_pos - 1;
-
-					mid_pos = (min_pos + max_pos + 1) / 2;
-				}
+		store = *(checkpoint_store_slot(tcs));
+		if(store != NULL) {
+			/* Only the checkpoint restored is read from the file */
+			pos = checkpoint_find(store, t);
+			if(pos != -1 && checkpoint_restore(tcs, store, pos)) {
+				call_rest = 1;
+				seek_count_replay_time(tcs,
+						from_checkpoint_time(store->index[pos].time), t);
+			} else {
+				if(pos != -1)
+					g_warning("Corrupted checkpoint %d, seeking from the start", pos);
+				restore_init_state(tcs);
+				lttv_process_trace_seek_time(&(tcs->parent), ltt_time_zero);
+				tcs->save_counters.nb_seeks_from_start++;
 			}
+		}
+		else if(ltt_time_compare(t, *(tcs->max_time_state_recomputed_in_seek)) < 0) {
+			saved = saved_states_get(tcs);
+			pos = saved_states_find(saved, t);
 
 			/* restore the closest earlier saved state */
-			if(min_pos != -1) {
-				lttv_state_restore(tcs, closest_tree);
+			if(pos != -1) {
+				saved_state_restore(tcs, saved, pos);
 				call_rest = 1;
+				seek_count_replay(tcs, saved, pos, t);
 			}
 
 			/* There is no saved state, yet we want to have it. Restart at T0 */
 			else {
 				restore_init_state(tcs);
 				lttv_process_trace_seek_time(&(tcs->parent), ltt_time_zero);
+				tcs->save_counters.nb_seeks_from_start++;
 			}
 		}
 		/* We want to seek quickly without restoring/updating the state */
@@ -4438,6 +5570,9 @@ static void module_init()
 	LTTV_STATE_EVENT = g_quark_from_string("event");
 	LTTV_STATE_SAVED_STATES = g_quark_from_string("saved states");
 	LTTV_STATE_SAVED_STATES_TIME = g_quark_from_string("saved states time");
+	LTTV_STATE_SAVED_COPIED = g_quark_from_string("copied processes");
+	LTTV_STATE_SAVED_MEMORY = g_quark_from_string("memory");
+	LTTV_STATE_CHECKPOINTS = g_quark_from_string("checkpoints");
 	LTTV_STATE_TIME = g_quark_from_string("time");
 	LTTV_STATE_HOOKS = g_quark_from_string("saved state hooks");
 	LTTV_STATE_NAME_TABLES = g_quark_from_string("name tables");
@@ -51,7 +51,16 @@
 /* Priority of state hooks */
 #define LTTV_PRIO_STATE 25
 
+/* Placement of the saved states. A state is saved once the events, or the
+   bytes of event payload, read since the previous one exceed the maximum
+   replay cost of the trace state (save_interval, save_max_bytes). When the
+   saved states of a trace take more than save_max_memory, every other one is
+   removed, keeping the first, and the replay costs used for the next ones are
+   doubled to match. A zero value disables the corresponding limit. */
+
 #define LTTV_STATE_SAVE_INTERVAL 50000
+#define LTTV_STATE_SAVE_MAX_BYTES (4 << 20)
+#define LTTV_STATE_SAVE_MAX_MEMORY (256 << 20)
 
 /* Channel Quarks */
 
@@ -292,11 +301,27 @@ typedef struct _LttvProcessState {
 	guint target_pid; /* target PID of the current event. */
 	guint free_events; /* 0 : none, 1 : free or exit dead, 2 : should delete */
 	GHashTable *fds; /* hash table of int (file descriptor) -> GQuark (file name) */
+	struct _LttvProcessState *saved; /* Copy in the last saved state, NULL once
+	                                    the process may have changed */
 } LttvProcessState;
 
 #define ANY_CPU 0 /* For clarity sake : a call to lttv_state_find_process for
                      a PID != 0 will search on any cpu automatically. */
 
+/* The processes of a trace, indexed by pid, and by cpu for pid 0. The table
+   owns the LttvProcessState structures and recycles those of exited
+   processes. */
+
+typedef struct _LttvProcessTable LttvProcessTable;
+
+/* Call func with each process as both key and value, like
+   g_hash_table_foreach. func must not create or remove processes. */
+
+void lttv_process_table_foreach(LttvProcessTable *table, GHFunc func,
+		gpointer user_data);
+
+guint lttv_process_table_size(LttvProcessTable *table);
+
 LttvProcessState *lttv_state_find_process(LttvTraceState *ts, guint cpu,
 		guint pid);
 
@@ -310,6 +335,43 @@ LttvProcessState *lttv_state_create_process(LttvTraceState *tcs,
 void lttv_state_write(LttvTraceState *self, LttTime t, FILE *fp);
 void lttv_state_write_raw(LttvTraceState *self, LttTime t, FILE *fp);
 
+/* Write the number of processes copied and the memory taken by each saved
+   state of the trace */
+void lttv_state_write_saved_memory(LttvTraceState *self, FILE *fp);
+
+/* Write the saving and seeking counters of the trace state */
+void lttv_state_write_save_counters(LttvTraceState *self, FILE *fp);
+
+/* Checkpoint file of a trace. It holds the states precomputed at regular
+   times, for seeks to start from the closest one instead of restoring saved
+   states built at open. The file found in the trace directory at
+   LTTV_STATE_CHECKPOINT_FILE is mapped when the trace state is created and
+   a seek only decodes the checkpoint it restores.
+
+   The file starts with a header giving the version, the number of cpus and
+   tracefiles of the trace, then the records, the index and the string table.
+   The index is sorted by time and gives the offset and size of each record.
+   A record holds the processes with their stacks, the running process of
+   each cpu and the position of each tracefile. It refers to the names by
+   their number in the string table and has no pointer, so it can be read in
+   place. Values are in host byte order. */
+
+#define LTTV_STATE_CHECKPOINT_FILE "precomputed/checkpoints"
+
+typedef struct _LttvStateCheckpointWriter LttvStateCheckpointWriter;
+
+/* Create the checkpoint file path for the trace, NULL on failure */
+LttvStateCheckpointWriter *lttv_state_checkpoint_writer_new(
+		LttvTraceState *self, const gchar *path);
+
+/* Add the current state of the trace, at time t, after the previous ones */
+void lttv_state_checkpoint_write(LttvStateCheckpointWriter *writer,
+		LttvTraceState *self, LttTime t);
+
+/* Write the index and string table and close the file. Returns FALSE if the
+   file could not be written. */
+gboolean lttv_state_checkpoint_writer_close(LttvStateCheckpointWriter *writer);
+
 /* The LttvTracesetState, LttvTraceState and LttvTracefileState types
    inherit from the corresponding Context objects defined in processTrace. */
 
@@ -362,6 +424,20 @@ typedef struct _LttvBdevState {
 	GArray *mode_stack;
 } LttvBdevState;
 
+/* Saving and seeking counters of a trace state */
+typedef struct _LttvStateSaveCounters {
+	guint nb_saved;            /* States saved */
+	guint nb_thinned;          /* Saved states removed under the memory cap */
+	gsize memory;              /* Memory of the saved states kept, an upper
+	                              bound once some were removed */
+	guint nb_seeks;            /* Seeks restoring a saved state */
+	guint nb_seeks_from_start; /* Seeks without a saved state before */
+	LttTime replay_time;       /* Total and maximum time from the saved state */
+	LttTime max_replay_time;   /* restored to the time sought */
+	guint64 replay_events;     /* Total and maximum number of events between */
+	guint64 max_replay_events; /* the saved state restored and the next one */
+} LttvStateSaveCounters;
+
 typedef struct _LttvNameTables {
 	GQuark *syscall_names;
 	guint nb_syscalls;
@@ -377,11 +453,14 @@ typedef struct _LttvNameTables {
 struct _LttvTraceState {
 	LttvTraceContext parent;
 
-	GHashTable *processes;  /* LttvProcessState objects indexed by pid and
-	                           last_cpu */
+	LttvProcessTable *processes;  /* LttvProcessState objects indexed by pid
+	                                 and last_cpu */
 	GHashTable *usertraces;  /* GPtrArray objects indexed by pid, containing
 	                           pointers to LttvTracefileState objects. */
 	guint nb_event, save_interval;
+	guint64 save_max_bytes;
+	gsize save_max_memory;
+	LttvStateSaveCounters save_counters;
 	/* Block/char devices, locks, memory pages... */
 	GQuark *eventtype_names;
 	LttvNameTables *name_tables;
@@ -415,6 +494,10 @@ void lttv_state_save(LttvTraceState *self, LttvAttribute *container);
 
 void lttv_state_restore(LttvTraceState *self, LttvAttribute *container);
 
+/* Latest state saved by lttv_state_save_add_event_hooks before time t, NULL if
+ * none. It may be restored in the context of a copy of the trace. */
+LttvAttribute *lttv_state_find_saved_state(LttvTraceState *self, LttTime t);
+
 void lttv_state_state_saved_free(LttvTraceState *self, 
 		LttvAttribute *container);
 
@@ -846,7 +846,7 @@ static void lttv_stats_cleanup_state(LttvTraceStats *tcs, LttTime current_time)
 #endif //0
 	cleanup_closure.ts = ts;
 	cleanup_closure.current_time = current_time;
-	g_hash_table_foreach(ts->processes, lttv_stats_cleanup_process_state,
+	lttv_process_table_foreach(ts->processes, lttv_stats_cleanup_process_state,
 		&cleanup_closure);
 }
 
@@ -1013,6 +1013,89 @@ void lttv_stats_sum_traceset(LttvTracesetStats *self, LttTime current_time)
 }
 
 
+static void slice_rebase_process_state(gpointer key, gpointer value,
+	gpointer user_data)
+{
+	LttvProcessState *process = (LttvProcessState *)value;
+	LttTime *start = (LttTime *)user_data;
+	LttvExecutionState *es;
+	guint i;
+
+	for(i = 0 ; i < process->execution_stack->len ; i++) {
+		es = &g_array_index(process->execution_stack, LttvExecutionState, i);
+		if(ltt_time_compare(es->entry, *start) < 0)
+			es->entry = *start;
+		if(ltt_time_compare(es->change, *start) < 0)
+			es->change = *start;
+		es->cum_cpu_time = ltt_time_zero;
+	}
+}
+
+/* The state was restored or computed up to start, without statistics. The
+ * time spent in the current execution states before start belongs to the
+ * previous slice : the states are considered entered at start. */
+void lttv_stats_slice_begin(LttvTracesetStats *self, LttTime start)
+{
+	LttvTraceset *traceset = self->parent.parent.ts;
+
+	LttvTraceStats *tcs;
+
+	guint i, nb_trace;
+
+	nb_trace = lttv_traceset_number(traceset);
+	for(i = 0 ; i < nb_trace ; i++) {
+		tcs = (LttvTraceStats *)(self->parent.parent.traces[i]);
+		lttv_process_table_foreach(tcs->parent.processes,
+				slice_rebase_process_state,
+				&start);
+		update_trace_event_tree(tcs);
+	}
+}
+
+/* Close the execution states still running at the end of the slice, so their
+ * time up to end is counted. The context must not be processed further. */
+void lttv_stats_slice_end(LttvTracesetStats *self, LttTime end)
+{
+	LttvTraceset *traceset = self->parent.parent.ts;
+
+	LttvTraceStats *tcs;
+
+	LttvTracefileContext *tfc;
+
+	guint i, j, nb_trace, nb_tracefile;
+
+	nb_trace = lttv_traceset_number(traceset);
+	for(i = 0 ; i < nb_trace ; i++) {
+		tcs = (LttvTraceStats *)(self->parent.parent.traces[i]);
+		nb_tracefile = tcs->parent.parent.tracefiles->len;
+		for(j = 0 ; j < nb_tracefile ; j++) {
+			tfc = g_array_index(tcs->parent.parent.tracefiles,
+					LttvTracefileContext*, j);
+			if(ltt_time_compare(tfc->timestamp, end) > 0)
+				tfc->timestamp = end;
+		}
+		lttv_stats_cleanup_state(tcs, end);
+	}
+}
+
+/* Add the per trace statistics of slice, not yet summed, to those of self.
+ * Both contexts must be on the same traces, in the same order. */
+void lttv_stats_merge(LttvTracesetStats *self, LttvTracesetStats *slice)
+{
+	LttvTraceStats *tcs, *slice_tcs;
+
+	guint i, nb_trace;
+
+	nb_trace = lttv_traceset_number(self->parent.parent.ts);
+	g_assert(nb_trace == lttv_traceset_number(slice->parent.parent.ts));
+	for(i = 0 ; i < nb_trace ; i++) {
+		tcs = (LttvTraceStats *)(self->parent.parent.traces[i]);
+		slice_tcs = (LttvTraceStats *)(slice->parent.parent.traces[i]);
+		lttv_attribute_recursive_add(tcs->stats, slice_tcs->stats);
+	}
+}
+
+
 // Hook wrapper. call_data is a traceset context.
 gboolean lttv_stats_hook_add_event_hooks(void *hook_data, void *call_data)
 {
@@ -1252,6 +1335,15 @@ void lttv_stats_add_event_hooks(LttvTracesetStats *self)
 
 		after_hooks = hooks;
 
+		/* The statistics of a trace only depend on its own events */
+		lttv_hooks_declare_per_trace(every_event);
+		for(k = 0 ; k < before_hooks->len ; k++)
+			lttv_hooks_declare_per_trace(
+					g_array_index(before_hooks, LttvTraceHook, k).h);
+		for(k = 0 ; k < after_hooks->len ; k++)
+			lttv_hooks_declare_per_trace(
+					g_array_index(after_hooks, LttvTraceHook, k).h);
+
 		/* Add these hooks to each event_by_id hooks list */
 
 		nb_tracefile = ts->parent.parent.tracefiles->len;
@@ -187,6 +187,19 @@ void lttv_stats_sum_trace(LttvTraceStats *self, LttvAttribute *ts_stats,
 /* Reset all statistics containers */
 void lttv_stats_reset(LttvTracesetStats *self);
 
+/* Time-sliced statistics : a context restored at a saved state before start
+ * (see lttv_state_find_saved_state) is processed up to start with the state
+ * hooks only. lttv_stats_slice_begin is then called before adding the
+ * statistics hooks and processing up to end, and lttv_stats_slice_end once
+ * done. The statistics of the slices are added by lttv_stats_merge into a
+ * context over the same traces, summed as usual afterwards. Event counts are
+ * exact, the times are split at the slice boundaries. */
+void lttv_stats_slice_begin(LttvTracesetStats *self, LttTime start);
+
+void lttv_stats_slice_end(LttvTracesetStats *self, LttTime end);
+
+void lttv_stats_merge(LttvTracesetStats *self, LttvTracesetStats *slice);
+
 
 /* The LttvTracesetStats, LttvTraceStats and LttvTracefileStats types
    inherit from the corresponding State objects defined in state.h.. */
@@ -218,6 +218,7 @@ bool syncTraceset(LttvTracesetContext* const traceSetContext)
 	double minOffset, minDrift;
 	unsigned int refFreqTrace;
 	int retval;
+	gboolean skipUnobserved;
 
 	if (!optionSync.present)
 	{
@@ -308,11 +309,14 @@ bool syncTraceset(LttvTracesetContext* const traceSetContext)
 		syncState->reductionModule->initReduction(syncState);
 	}
 
-	// Process traceset
+	// Process traceset, only the channels the modules hook are read
+	skipUnobserved= traceSetContext->skip_unobserved;
+	traceSetContext->skip_unobserved= TRUE;
 	lttv_process_traceset_seek_time(traceSetContext, ltt_time_zero);
 	lttv_process_traceset_middle(traceSetContext, ltt_time_infinite,
 		G_MAXULONG, NULL);
 	lttv_process_traceset_seek_time(traceSetContext, ltt_time_zero);
+	traceSetContext->skip_unobserved= skipUnobserved;
 
 	// Obtain, reduce, adjust and set correction factors
 	allFactors= syncState->processingModule->finalizeProcessing(syncState);
@@ -365,6 +369,7 @@ bool syncTraceset(LttvTracesetContext* const traceSetContext)
 		t->offset= traceFactors->offset;
 		t->start_freq= traceSetContext->traces[refFreqTrace]->t->start_freq;
 		t->freq_scale= traceSetContext->traces[refFreqTrace]->t->freq_scale;
+		ltt_trace_update_clock(t);
 		t->start_time_from_tsc =
 			ltt_time_from_uint64(tsc_to_uint64(t->freq_scale, t->start_freq,
 					t->drift * t->start_tsc + t->offset));
@@ -27,6 +27,7 @@
 #include <ltt/trace.h>
 #include <lttv/filter.h>
 #include <errno.h>
+#include <pthread.h>
 
 gint compare_tracefile(gconstpointer a, gconstpointer b)
 {
@@ -49,6 +50,170 @@ gint compare_tracefile(gconstpointer a, gconstpointer b)
 	return comparison;
 }
 
+/* Merge queue : 4-ary min heap. Each entry caches the timestamp of its
+ * context in nanoseconds so the sift loops only touch the heap array, the
+ * contexts being dereferenced on timestamp ties only. */
+#define TRACEFILE_QUEUE_ARITY 4
+
+typedef struct _LttvTracefileQueueEntry {
+	guint64 key;
+	LttvTracefileContext *tfc;
+} LttvTracefileQueueEntry;
+
+struct _LttvTracefileQueue {
+	LttvTracefileQueueEntry *heap;
+	guint len;
+	guint alloc;
+};
+
+static inline guint64 tracefile_queue_key(const LttvTracefileContext *tfc)
+{
+	return (guint64)tfc->timestamp.tv_sec * NANOSECONDS_PER_SECOND
+			+ tfc->timestamp.tv_nsec;
+}
+
+static inline gboolean tracefile_queue_less(const LttvTracefileQueueEntry *a,
+		const LttvTracefileQueueEntry *b)
+{
+	if(likely(a->key != b->key))
+		return a->key < b->key;
+	if(a->tfc->index != b->tfc->index)
+		return a->tfc->index < b->tfc->index;
+	return a->tfc->t_context->index < b->tfc->t_context->index;
+}
+
+static inline void tracefile_queue_set(LttvTracefileQueue *q, guint i,
+		const LttvTracefileQueueEntry *entry)
+{
+	q->heap[i] = *entry;
+	entry->tfc->queue_pos = i + 1;
+}
+
+/* Move entry up from the hole at position i */
+static void tracefile_queue_sift_up(LttvTracefileQueue *q, guint i,
+		const LttvTracefileQueueEntry *entry)
+{
+	guint parent;
+
+	while(i > 0) {
+		parent = (i - 1) / TRACEFILE_QUEUE_ARITY;
+		if(!tracefile_queue_less(entry, &q->heap[parent]))
+			break;
+		tracefile_queue_set(q, i, &q->heap[parent]);
+		i = parent;
+	}
+	tracefile_queue_set(q, i, entry);
+}
+
+/* Move entry down from the hole at position i */
+static void tracefile_queue_sift_down(LttvTracefileQueue *q, guint i,
+		const LttvTracefileQueueEntry *entry)
+{
+	guint child, last, min;
+
+	while(TRUE) {
+		child = i * TRACEFILE_QUEUE_ARITY + 1;
+		if(child >= q->len)
+			break;
+		last = MIN(child + TRACEFILE_QUEUE_ARITY, q->len);
+		min = child;
+		for(child++ ; child < last ; child++) {
+			if(tracefile_queue_less(&q->heap[child], &q->heap[min]))
+				min = child;
+		}
+		if(!tracefile_queue_less(&q->heap[min], entry))
+			break;
+		tracefile_queue_set(q, i, &q->heap[min]);
+		i = min;
+	}
+	tracefile_queue_set(q, i, entry);
+}
+
+LttvTracefileQueue *lttv_tracefile_queue_new(void)
+{
+	return g_new0(LttvTracefileQueue, 1);
+}
+
+void lttv_tracefile_queue_destroy(LttvTracefileQueue *q)
+{
+	guint i;
+
+	for(i = 0 ; i < q->len ; i++)
+		q->heap[i].tfc->queue_pos = 0;
+	g_free(q->heap);
+	g_free(q);
+}
+
+void lttv_tracefile_queue_insert(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc)
+{
+	LttvTracefileQueueEntry entry;
+
+	g_assert(tfc->queue_pos == 0);
+	if(unlikely(q->len == q->alloc)) {
+		q->alloc = MAX(16, q->alloc * 2);
+		q->heap = g_renew(LttvTracefileQueueEntry, q->heap, q->alloc);
+	}
+	entry.key = tracefile_queue_key(tfc);
+	entry.tfc = tfc;
+	tracefile_queue_sift_up(q, q->len++, &entry);
+}
+
+void lttv_tracefile_queue_remove(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc)
+{
+	LttvTracefileQueueEntry last;
+	guint i;
+
+	if(tfc->queue_pos == 0)
+		return;
+	i = tfc->queue_pos - 1;
+	g_assert(i < q->len && q->heap[i].tfc == tfc);
+	tfc->queue_pos = 0;
+	last = q->heap[--q->len];
+	if(i == q->len)
+		return;
+	/* Fill the hole with the last entry */
+	if(i > 0 && tracefile_queue_less(&last,
+			&q->heap[(i - 1) / TRACEFILE_QUEUE_ARITY]))
+		tracefile_queue_sift_up(q, i, &last);
+	else
+		tracefile_queue_sift_down(q, i, &last);
+}
+
+void lttv_tracefile_queue_update(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc)
+{
+	LttvTracefileQueueEntry entry;
+	guint i;
+
+	if(unlikely(tfc->queue_pos == 0)) {
+		lttv_tracefile_queue_insert(q, tfc);
+		return;
+	}
+	i = tfc->queue_pos - 1;
+	g_assert(i < q->len && q->heap[i].tfc == tfc);
+	entry.key = tracefile_queue_key(tfc);
+	entry.tfc = tfc;
+	if(i > 0 && tracefile_queue_less(&entry,
+			&q->heap[(i - 1) / TRACEFILE_QUEUE_ARITY]))
+		tracefile_queue_sift_up(q, i, &entry);
+	else
+		tracefile_queue_sift_down(q, i, &entry);
+}
+
+LttvTracefileContext *lttv_tracefile_queue_top(LttvTracefileQueue *q)
+{
+	if(unlikely(q->len == 0))
+		return NULL;
+	return q->heap[0].tfc;
+}
+
+guint lttv_tracefile_queue_length(LttvTracefileQueue *q)
+{
+	return q->len;
+}
+
 typedef struct _LttvTracefileContextPosition {
 	LttEventPosition *event;
 	LttvTracefileContext *tfc;
@@ -159,13 +324,18 @@ static void init_tracefile_context(LttTracefile *tracefile,
 	tfc->index = tc->tracefiles->len;
 	tc->tracefiles = g_array_append_val(tc->tracefiles, tfc);
 
-	tfc->tf = tracefile;
+	if(tsc->cursors)
+		tfc->tf = ltt_tracefile_cursor_new(tracefile);
+	else
+		tfc->tf = tracefile;
 
 	tfc->t_context = tc;
 	tfc->event = lttv_hooks_new();
 	tfc->event_by_id = lttv_hooks_by_id_new();
+	tfc->event_dispatch = lttv_hooks_dispatch_new(tfc->event, tfc->event_by_id);
 	tfc->a = g_object_new(LTTV_ATTRIBUTE_TYPE, NULL);
 	tfc->target_pid = -1;
+	tfc->batch = ltt_event_batch_new();
 }
 
 
@@ -237,7 +407,7 @@ init(LttvTracesetContext *self, LttvTraceset *ts)
 
 	}
 	self->sync_position = lttv_traceset_context_position_new(self);
-	self->pqueue = g_tree_new(compare_tracefile);
+	self->pqueue = lttv_tracefile_queue_new();
 	lttv_process_traceset_seek_time(self, ltt_time_zero);
 	lttv_traceset_context_compute_time_span(self, &self->time_span);
 
@@ -254,7 +424,7 @@ void fini(LttvTracesetContext *self)
 
 	LttvTraceset *ts = self->ts;
 
-	g_tree_destroy(self->pqueue);
+	lttv_tracefile_queue_destroy(self->pqueue);
 	g_object_unref(self->a);
 	lttv_traceset_context_position_destroy(self->sync_position);
 
@@ -269,8 +439,12 @@ void fini(LttvTracesetContext *self)
 
 		for(j = 0 ; j < nb_tracefile ; j++) {
 			tfc = &g_array_index(tc->tracefiles, LttvTracefileContext*, j);
+			if(self->cursors)
+				ltt_tracefile_cursor_destroy((*tfc)->tf);
+			lttv_hooks_dispatch_destroy((*tfc)->event_dispatch);
 			lttv_hooks_destroy((*tfc)->event);
 			lttv_hooks_by_id_destroy((*tfc)->event_by_id);
+			ltt_event_batch_destroy((*tfc)->batch);
 			g_object_unref((*tfc)->a);
 			g_object_unref(*tfc);
 		}
@@ -617,38 +791,25 @@ GType lttv_tracefile_context_get_type(void)
 
 
 
-static gboolean get_first(gpointer key, gpointer value, gpointer user_data) {
-	g_assert(key == value);
-	*((LttvTracefileContext **)user_data) = (LttvTracefileContext *)value;
-	return TRUE;
-}
-
 #ifdef DEBUG
-// Test to see if pqueue is traversed in the right order.
-static LttTime test_time;
-
-static gboolean test_tree(gpointer key, gpointer value, gpointer user_data) {
-
-	LttvTracefileContext *tfc = (LttvTracefileContext *)key;
-
-	g_debug("Tracefile name %s, time %lu.%lu, tfi %u, ti %u",
-			g_quark_to_string(ltt_tracefile_name(tfc->tf)),
-			tfc->timestamp.tv_sec, tfc->timestamp.tv_nsec,
-			tfc->index, tfc->t_context->index);
+// Test to see if the pqueue is a valid heap whose top is the earliest event.
+static void test_queue(LttvTracefileQueue *q)
+{
+	guint i;
 
-	if(user_data != NULL) {
-		if(((LttvTracefileContext *)user_data) == (LttvTracefileContext *)value) {
-			g_assert(compare_tracefile(user_data, value) == 0);
-		} else
-			g_assert(compare_tracefile(user_data, value) != 0);
+	for(i = 0 ; i < q->len ; i++) {
+		LttvTracefileContext *tfc = q->heap[i].tfc;
+
+		g_debug("Tracefile name %s, time %lu.%lu, tfi %u, ti %u",
+				g_quark_to_string(ltt_tracefile_name(tfc->tf)),
+				tfc->timestamp.tv_sec, tfc->timestamp.tv_nsec,
+				tfc->index, tfc->t_context->index);
+		g_assert(tfc->queue_pos == i + 1);
+		g_assert(q->heap[i].key == tracefile_queue_key(tfc));
+		if(i > 0)
+			g_assert(compare_tracefile(
+					q->heap[(i - 1) / TRACEFILE_QUEUE_ARITY].tfc, tfc) < 0);
 	}
-	g_assert(ltt_time_compare(test_time, tfc->timestamp) <= 0);
-	test_time.tv_sec = tfc->timestamp.tv_sec;
-	test_time.tv_nsec = tfc->timestamp.tv_nsec;
-
-
-	//g_assert(((LttvTracefileContext *)user_data) != (LttvTracefileContext *)value);
-	return FALSE;
 }
 #endif //DEBUG
 
@@ -675,14 +836,14 @@ void lttv_process_traceset_begin(LttvTracesetContext *self,
 
 //enum read_state { LAST_NONE, LAST_OK, LAST_EMPTY };
 
-/* Note : a _middle must be preceded from a _seek or another middle */
-guint lttv_process_traceset_middle(LttvTracesetContext *self,
+/* Merge the tracefiles of pqueue, which is the traceset queue or the queue of
+ * a trace processed on its own */
+static guint process_queue_middle(LttvTracesetContext *self,
+		LttvTracefileQueue *pqueue,
 		LttTime end,
 		gulong nb_events,
 		const LttvTracesetContextPosition *end_position)
 {
-	GTree *pqueue = self->pqueue;
-
 	LttvTracefileContext *tfc;
 
 	LttEvent *e;
@@ -695,14 +856,13 @@ guint lttv_process_traceset_middle(LttvTracesetContext *self,
 
 	gint last_ret = 0; /* return value of the last hook list called */
 
-	/* Get the next event from the pqueue, call its hooks,
-	   reinsert in the pqueue the following event from the same tracefile
-	   unless the tracefile is finished or the event is later than the
-	   end time. */
+	/* Get the next event from the pqueue, call its hooks, then replace it
+	   at the top of the pqueue by the following event from the same
+	   tracefile, or remove the tracefile from the pqueue if it is finished.
+	   The read stops when the event at the top is later than the end time. */
 
 	while(TRUE) {
-		tfc = NULL;
-		g_tree_foreach(pqueue, get_first, &tfc);
+		tfc = lttv_tracefile_queue_top(pqueue);
 		/* End of traceset : tfc is NULL */
 		if(unlikely(tfc == NULL))
 		{
@@ -726,26 +886,22 @@ guint lttv_process_traceset_middle(LttvTracesetContext *self,
 			return count;
 		}
 
-		/* Get the tracefile with an event for the smallest time found. If two
-		   or more tracefiles have events for the same time, hope that lookup
-		   and remove are consistent. */
- 
-#ifdef DEBUG
-		test_time.tv_sec = 0;
-		test_time.tv_nsec = 0;
-		g_debug("test tree before remove");
-		g_tree_foreach(pqueue, test_tree, tfc);
-#endif //DEBUG
-		g_tree_remove(pqueue, tfc);
+		/* No hook can observe the events of this tracefile : stop merging it */
+		if(unlikely(self->skip_unobserved
+				&& !lttv_hooks_dispatch_observed(tfc->event_dispatch))) {
+			g_debug("Skipping tracefile %s",
+					g_quark_to_string(ltt_tracefile_name(tfc->tf)));
+			lttv_tracefile_queue_remove(pqueue, tfc);
+			continue;
+		}
 
+		/* The tracefile stays at the top of the pqueue while its hooks are
+		   called : it is the current tracefile of the traceset. */
 #ifdef DEBUG
-		test_time.tv_sec = 0;
-		test_time.tv_nsec = 0;
-		g_debug("test tree after remove");
-		g_tree_foreach(pqueue, test_tree, tfc);
+		g_debug("test queue before hooks");
+		test_queue(pqueue);
 #endif //DEBUG
 
-
 		e = ltt_tracefile_get_event(tfc->tf);
 
 		//if(last_read_state != LAST_EMPTY) {
@@ -757,34 +913,32 @@ guint lttv_process_traceset_middle(LttvTracesetContext *self,
 		/* Hooks :
 		 * return values : 0 : continue read, 1 : go to next position and stop read,
 		 * 2 : stay at the current position and stop read */
-		last_ret = lttv_hooks_call_merge(tfc->event, tfc,
-				lttv_hooks_by_id_get(tfc->event_by_id, e->event_id), tfc);
+		last_ret = lttv_hooks_dispatch_call(tfc->event_dispatch, e->event_id, tfc);
 
 #if 0
 		/* This is buggy : it won't work well with state computation */
 	 if(unlikely(last_ret == 2)) {
 			/* This is a case where we want to stay at this position and stop read. */
-			g_tree_insert(pqueue, tfc, tfc);
 			return count - 1;
 		}
 #endif //0
-		read_ret = ltt_tracefile_read(tfc->tf);
+		/* The following events come from the subbuffer decoded in bulk */
+		read_ret = ltt_tracefile_read_batched(tfc->tf, tfc->batch);
 
 
 		if(likely(!read_ret)) {
 			//g_debug("An event is ready");
 			tfc->timestamp = ltt_event_time(e);
 			g_assert(ltt_time_compare(tfc->timestamp, ltt_time_infinite) != 0);
-			g_tree_insert(pqueue, tfc, tfc);
+			lttv_tracefile_queue_update(pqueue, tfc);
 #ifdef DEBUG
-			test_time.tv_sec = 0;
-			test_time.tv_nsec = 0;
-			g_debug("test tree after event ready");
-			g_tree_foreach(pqueue, test_tree, NULL);
+			g_debug("test queue after event ready");
+			test_queue(pqueue);
 #endif //DEBUG
 
 			//last_read_state = LAST_OK;
 		} else {
+			lttv_tracefile_queue_remove(pqueue, tfc);
 			tfc->timestamp = ltt_time_infinite;
 
 			if(read_ret == ERANGE) {
@@ -796,6 +950,189 @@ guint lttv_process_traceset_middle(LttvTracesetContext *self,
 	}
 }
 
+/* A trace processed by its own thread, see lttv_process_traceset_middle */
+struct trace_middle {
+	LttvTracesetContext *tsc;
+	LttvTracefileQueue *pqueue;    /* The tracefiles of the trace */
+	LttTime end;
+	guint count;
+	gboolean started;
+	pthread_t thread;
+};
+
+static void *trace_middle_thread(void *arg)
+{
+	struct trace_middle *tm = (struct trace_middle *)arg;
+
+	tm->count = process_queue_middle(tm->tsc, tm->pqueue, tm->end,
+			G_MAXULONG, NULL);
+	return NULL;
+}
+
+/* TRUE when the hooks of all the tracefiles are declared per trace */
+static gboolean traceset_per_trace(LttvTracesetContext *self)
+{
+	LttvTraceContext *tc;
+
+	LttvTracefileContext *tfc;
+
+	guint i, j, nb_trace, nb_tracefile;
+
+	nb_trace = lttv_traceset_number(self->ts);
+	for(i = 0 ; i < nb_trace ; i++) {
+		tc = self->traces[i];
+		nb_tracefile = tc->tracefiles->len;
+		for(j = 0 ; j < nb_tracefile ; j++) {
+			tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, j);
+			if(!lttv_hooks_dispatch_per_trace(tfc->event_dispatch))
+				return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/* Process each trace in its own thread, with its own queue, up to end */
+static guint process_traces_middle(LttvTracesetContext *self, LttTime end)
+{
+	struct trace_middle *traces;
+
+	LttvTracefileContext *tfc;
+
+	guint i, nb_trace, count = 0;
+
+	nb_trace = lttv_traceset_number(self->ts);
+	traces = g_new(struct trace_middle, nb_trace);
+	for(i = 0 ; i < nb_trace ; i++) {
+		traces[i].tsc = self;
+		traces[i].pqueue = lttv_tracefile_queue_new();
+		traces[i].end = end;
+		traces[i].count = 0;
+		traces[i].started = FALSE;
+	}
+
+	while((tfc = lttv_tracefile_queue_top(self->pqueue)) != NULL) {
+		lttv_tracefile_queue_remove(self->pqueue, tfc);
+		lttv_tracefile_queue_insert(traces[tfc->t_context->index].pqueue, tfc);
+	}
+
+	for(i = 0 ; i < nb_trace ; i++) {
+		if(lttv_tracefile_queue_length(traces[i].pqueue) == 0) continue;
+		if(pthread_create(&traces[i].thread, NULL, trace_middle_thread,
+				&traces[i]))
+			g_error("cannot create the thread of trace %u", i);
+		traces[i].started = TRUE;
+	}
+
+	/* Put the tracefiles left back in the traceset queue */
+	for(i = 0 ; i < nb_trace ; i++) {
+		if(traces[i].started)
+			pthread_join(traces[i].thread, NULL);
+		while((tfc = lttv_tracefile_queue_top(traces[i].pqueue)) != NULL) {
+			lttv_tracefile_queue_remove(traces[i].pqueue, tfc);
+			lttv_tracefile_queue_insert(self->pqueue, tfc);
+		}
+		lttv_tracefile_queue_destroy(traces[i].pqueue);
+		count += traces[i].count;
+	}
+	g_free(traces);
+	return count;
+}
+
+/* Note : a _middle must be preceded from a _seek or another middle */
+guint lttv_process_traceset_middle(LttvTracesetContext *self,
+		LttTime end,
+		gulong nb_events,
+		const LttvTracesetContextPosition *end_position)
+{
+	if(self->per_trace && nb_events == G_MAXULONG && end_position == NULL
+			&& lttv_traceset_number(self->ts) > 1 && traceset_per_trace(self))
+		return process_traces_middle(self, end);
+	return process_queue_middle(self, self->pqueue, end, nb_events,
+			end_position);
+}
+
+
+/* Follow traces still being written : read the new marker registrations,
+ * index the subbuffers appended to each tracefile, put back in the merge the
+ * tracefiles at their end which got events, then process the events earlier
+ * than the watermark. */
+guint lttv_process_traceset_follow(LttvTracesetContext *self, LttTime latency)
+{
+	LttvTraceContext *tc;
+
+	LttvTracefileContext *tfc;
+
+	LttTime end_time, latest = ltt_time_zero, watermark = ltt_time_infinite;
+
+	GArray *end_times;
+
+	guint i, j, nb_trace, nb_tracefile;
+
+	int ret;
+
+	end_times = g_array_new(FALSE, FALSE, sizeof(LttTime));
+	nb_trace = lttv_traceset_number(self->ts);
+	for(i = 0 ; i < nb_trace ; i++) {
+		tc = self->traces[i];
+		/* The markers must be known before their events are read */
+		if(ltt_trace_update_metadata(tc->t) < 0)
+			g_error("Cannot read the metadata of trace %s",
+					g_quark_to_string(ltt_trace_name(tc->t)));
+		nb_tracefile = tc->tracefiles->len;
+		for(j = 0 ; j < nb_tracefile ; j++) {
+			tfc = g_array_index(tc->tracefiles, LttvTracefileContext*, j);
+			ret = ltt_tracefile_update_block_index(tfc->tf);
+			if(ret < 0)
+				g_error("Cannot update the block index of tracefile %s",
+						g_quark_to_string(ltt_tracefile_long_name(tfc->tf)));
+
+			/* A read returned the end of the tracefile before. The metadata
+			 * tracefiles were indexed already, so ret is not checked. */
+			if(tfc->queue_pos == 0
+					&& ltt_time_compare(tfc->timestamp, ltt_time_infinite) == 0) {
+				/* The events of a lagging tracefile which the watermark passed
+				 * can not be merged in order anymore */
+				while((ret = ltt_tracefile_read_batched(tfc->tf,
+						tfc->batch)) == 0) {
+					tfc->timestamp = ltt_event_time(ltt_tracefile_get_event(tfc->tf));
+					if(ltt_time_compare(tfc->timestamp, self->follow_watermark) >= 0)
+						break;
+					self->follow_dropped++;
+				}
+				if(ret == 0)
+					lttv_tracefile_queue_insert(self->pqueue, tfc);
+				else
+					tfc->timestamp = ltt_time_infinite;
+			}
+
+			end_time = ltt_tracefile_indexed_end_time(tfc->tf);
+			g_array_append_val(end_times, end_time);
+			if(ltt_time_compare(end_time, latest) > 0)
+				latest = end_time;
+		}
+	}
+
+	/* The events of a tracefile come in subbuffers of increasing times : those
+	 * of all the tracefiles up to the earliest end of their data are known.
+	 * The tracefiles lagging more than latency behind the others are not
+	 * waited for, their events earlier than the watermark will be dropped. */
+	for(i = 0 ; i < end_times->len ; i++) {
+		end_time = g_array_index(end_times, LttTime, i);
+		if(ltt_time_compare(ltt_time_add(end_time, latency), latest) >= 0
+				&& ltt_time_compare(end_time, watermark) < 0)
+			watermark = end_time;
+	}
+	g_array_free(end_times, TRUE);
+
+	if(ltt_time_compare(latest, self->time_span.end_time) > 0)
+		self->time_span.end_time = latest;
+	if(ltt_time_compare(watermark, ltt_time_infinite) == 0
+			|| ltt_time_compare(watermark, self->follow_watermark) <= 0)
+		return 0;
+	self->follow_watermark = watermark;
+	return lttv_process_traceset_middle(self, watermark, G_MAXULONG, NULL);
+}
+
 
 void lttv_process_traceset_end(LttvTracesetContext *self,
 		LttvHooks *after_traceset,
@@ -830,12 +1167,12 @@ void lttv_process_trace_seek_time(LttvTraceContext *self, LttTime start)
 
 	nb_tracefile = self->tracefiles->len;
 
-	GTree *pqueue = self->ts_context->pqueue;
+	LttvTracefileQueue *pqueue = self->ts_context->pqueue;
 
 	for(i = 0 ; i < nb_tracefile ; i++) {
 		tfc = &g_array_index(self->tracefiles, LttvTracefileContext*, i);
 
-		g_tree_remove(pqueue, *tfc);
+		lttv_tracefile_queue_remove(pqueue, *tfc);
 
 		ret = ltt_tracefile_seek_time((*tfc)->tf, start);
 		if(ret == EPERM) g_error("error in lttv_process_trace_seek_time seek");
@@ -843,16 +1180,14 @@ void lttv_process_trace_seek_time(LttvTraceContext *self, LttTime start)
 		if(ret == 0) { /* not ERANGE especially */
 			(*tfc)->timestamp = ltt_event_time(ltt_tracefile_get_event((*tfc)->tf));
 			g_assert(ltt_time_compare((*tfc)->timestamp, ltt_time_infinite) != 0);
-			g_tree_insert(pqueue, (*tfc), (*tfc));
+			lttv_tracefile_queue_insert(pqueue, *tfc);
 		} else {
 			(*tfc)->timestamp = ltt_time_infinite;
 		}
 	}
 #ifdef DEBUG
-	test_time.tv_sec = 0;
-	test_time.tv_nsec = 0;
-	g_debug("test tree after seek_time");
-	g_tree_foreach(pqueue, test_tree, NULL);
+	g_debug("test queue after seek_time");
+	test_queue(self->ts_context->pqueue);
 #endif //DEBUG
 }
 
@@ -904,7 +1239,7 @@ gboolean lttv_process_traceset_seek_position(LttvTracesetContext *self,
 			LttvTracefileContextPosition *tfcp =
 					&g_array_index(pos->tfcp, LttvTracefileContextPosition, i);
 
-			g_tree_remove(self->pqueue, tfcp->tfc);
+			lttv_tracefile_queue_remove(self->pqueue, tfcp->tfc);
 
 			if(tfcp->used == TRUE) {
 				if(ltt_tracefile_seek_position(tfcp->tfc->tf, tfcp->event) != 0)
@@ -913,7 +1248,7 @@ gboolean lttv_process_traceset_seek_position(LttvTracesetContext *self,
 						ltt_event_time(ltt_tracefile_get_event(tfcp->tfc->tf));
 				g_assert(ltt_time_compare(tfcp->tfc->timestamp,
 						ltt_time_infinite) != 0);
-				g_tree_insert(self->pqueue, tfcp->tfc, tfcp->tfc);
+				lttv_tracefile_queue_insert(self->pqueue, tfcp->tfc);
 
 			} else {
 				tfcp->tfc->timestamp = ltt_time_infinite;
@@ -921,10 +1256,8 @@ gboolean lttv_process_traceset_seek_position(LttvTracesetContext *self,
 		}
 	}
 #ifdef DEBUG
-	test_time.tv_sec = 0;
-	test_time.tv_nsec = 0;
-	g_debug("test tree after seek_position");
-	g_tree_foreach(self->pqueue, test_tree, NULL);
+	g_debug("test queue after seek_position");
+	test_queue(self->pqueue);
 #endif //DEBUG
 
 
@@ -1259,12 +1592,7 @@ lttv_traceset_context_position_get_time(const LttvTracesetContextPosition *pos)
 LttvTracefileContext *
 lttv_traceset_context_get_current_tfc(LttvTracesetContext *self)
 {
-	GTree *pqueue = self->pqueue;
-	LttvTracefileContext *tfc = NULL;
-
-	g_tree_foreach(pqueue, get_first, &tfc);
-
-	return tfc;
+	return lttv_tracefile_queue_top(self->pqueue);
 }
 
 /* lttv_process_traceset_synchronize_tracefiles
@@ -1355,7 +1683,8 @@ static gint seek_back_event_hook(void *hook_data, void* call_data)
 	return FALSE;
 }
 
-/* Seek back n events back from the current position.
+/* Seek back n events back from the current position, by processing the
+ * traceset forward from times further and further back.
  *
  * Parameters :
  * @self          The trace set context
@@ -1381,7 +1710,7 @@ static gint seek_back_event_hook(void *hook_data, void* call_data)
  * Note2 : the caller must make sure that the LttvTracesetContext does not
  * contain any hook, as process_traceset_middle is used in this routine.
  */
-guint lttv_process_traceset_seek_n_backward(LttvTracesetContext *self,
+static guint seek_n_backward_by_time(LttvTracesetContext *self,
 						guint n, LttTime first_offset,
 						seek_time_fct time_seeker,
 						check_handler *check,
@@ -1391,7 +1720,6 @@ guint lttv_process_traceset_seek_n_backward(LttvTracesetContext *self,
 						LttvFilter *filter3,
 						gpointer data)
 {
-	if(lttv_traceset_number(self->ts) == 0) return 0;
 	g_assert(ltt_time_compare(first_offset, ltt_time_zero) != 0);
 
 	guint i;
@@ -1533,6 +1861,233 @@ guint lttv_process_traceset_seek_n_backward(LttvTracesetContext *self,
 }
 
 
+/* Tells if a filter tree reads the process state, which is not updated when
+ * reading events backward */
+static gboolean filter_tree_uses_state(const LttvFilterTree *t)
+{
+	if(t == NULL)
+		return FALSE;
+	if(t->left == LTTV_TREE_LEAF) {
+		if(t->l_child.leaf->field >= LTTV_FILTER_STATE_PID
+				&& t->l_child.leaf->field <= LTTV_FILTER_STATE_CPU)
+			return TRUE;
+	} else if(t->left == LTTV_TREE_NODE && filter_tree_uses_state(t->l_child.t))
+		return TRUE;
+	if(t->right == LTTV_TREE_LEAF) {
+		if(t->r_child.leaf->field >= LTTV_FILTER_STATE_PID
+				&& t->r_child.leaf->field <= LTTV_FILTER_STATE_CPU)
+			return TRUE;
+	} else if(t->right == LTTV_TREE_NODE && filter_tree_uses_state(t->r_child.t))
+		return TRUE;
+	return FALSE;
+}
+
+static inline gboolean filter_uses_state(const LttvFilter *filter)
+{
+	return filter != NULL && filter_tree_uses_state(filter->head);
+}
+
+static inline gboolean filter_match(const LttvFilter *filter,
+		LttvTracefileContext *tfc)
+{
+	return filter == NULL || filter->head == NULL
+			|| lttv_filter_tree_parse(filter->head,
+					ltt_tracefile_get_event(tfc->tf),
+					tfc->tf,
+					tfc->t_context->t,
+					tfc,NULL,NULL);
+}
+
+/* Reverse merge order : the latest event first */
+static gint compare_tracefile_reverse(gconstpointer a, gconstpointer b)
+{
+	return compare_tracefile(b, a);
+}
+
+static gboolean get_first(gpointer key, gpointer value, gpointer user_data)
+{
+	*(gpointer *)user_data = value;
+	return TRUE;
+}
+
+/* A tracefile in the reverse merge */
+struct seek_back_tracefile {
+	LttvTracefileContext *tfc;
+	LttEventPosition last;        /* Last event read backward */
+	LttTime last_time;
+	gboolean last_used;           /* FALSE when at the end of the tracefile */
+	LttEventPosition next;        /* First event after the last event found */
+	LttTime next_time;
+	gboolean next_used;
+	guint found;                  /* Events found when it was last read */
+};
+
+/* Read the event before the last one read in the tracefile, and queue it */
+static void seek_back_read_prev(GTree *queue, struct seek_back_tracefile *stf)
+{
+	int ret;
+
+	ret = ltt_tracefile_read_prev(stf->tfc->tf);
+	if(ret == EPERM)
+		g_error("error in lttv_process_traceset_seek_n_backward");
+	if(ret == 0) {
+		stf->tfc->timestamp =
+				ltt_event_time(ltt_tracefile_get_event(stf->tfc->tf));
+		g_tree_insert(queue, stf->tfc, stf);
+	}
+}
+
+/* Seek back n events back from the current position, by reading the
+ * tracefiles backward and merging their events latest first. */
+static guint seek_n_backward_reverse(LttvTracesetContext *self,
+						guint n,
+						check_handler *check,
+						gboolean *stop_flag,
+						LttvFilter *filter1,
+						LttvFilter *filter2,
+						LttvFilter *filter3,
+						gpointer data)
+{
+	guint i, j, k, nb_tracefiles = 0;
+	guint found = 0, raw_event_count = 0;
+	struct seek_back_tracefile *tracefiles, *stf;
+	LttvTracefileContext *tfc;
+	LttvTracesetContextPosition *pos;
+	GTree *queue = g_tree_new(compare_tracefile_reverse);
+	int retval;
+
+	for(i = 0; i < lttv_traceset_number(self->ts); i++)
+		nb_tracefiles += self->traces[i]->tracefiles->len;
+	tracefiles = g_new(struct seek_back_tracefile, nb_tracefiles);
+
+	/* Start from the current event of each tracefile */
+	k = 0;
+	for(i = 0; i < lttv_traceset_number(self->ts); i++) {
+		GArray *tfcs = self->traces[i]->tracefiles;
+
+		for(j = 0; j < tfcs->len; j++) {
+			tfc = g_array_index(tfcs, LttvTracefileContext*, j);
+			stf = &tracefiles[k++];
+			stf->tfc = tfc;
+			lttv_tracefile_queue_remove(self->pqueue, tfc);
+			if(ltt_time_compare(tfc->timestamp, ltt_time_infinite) != 0) {
+				ltt_event_position(ltt_tracefile_get_event(tfc->tf), &stf->last);
+				stf->last_time = tfc->timestamp;
+				stf->last_used = TRUE;
+			} else {
+				ltt_tracefile_seek_end(tfc->tf);
+				stf->last_used = FALSE;
+			}
+			stf->next = stf->last;
+			stf->next_time = stf->last_time;
+			stf->next_used = stf->last_used;
+			stf->found = 0;
+			seek_back_read_prev(queue, stf);
+		}
+	}
+
+	while(found < n) {
+		stf = NULL;
+		g_tree_foreach(queue, get_first, &stf);
+		if(stf == NULL)
+			break;	/* Beginning of the traceset */
+		if(check && check(raw_event_count, stop_flag, data))
+			break;
+		raw_event_count++;
+		g_tree_remove(queue, stf->tfc);
+
+		/* The events read since the last one found are after it */
+		if(stf->found != found) {
+			stf->next = stf->last;
+			stf->next_time = stf->last_time;
+			stf->next_used = stf->last_used;
+			stf->found = found;
+		}
+		ltt_event_position(ltt_tracefile_get_event(stf->tfc->tf), &stf->last);
+		stf->last_time = stf->tfc->timestamp;
+		stf->last_used = TRUE;
+
+		if(filter_match(filter1, stf->tfc) && filter_match(filter2, stf->tfc)
+				&& filter_match(filter3, stf->tfc))
+			found++;
+
+		seek_back_read_prev(queue, stf);
+	}
+	g_tree_destroy(queue);
+
+	/* Seek to the earliest event found, or stay in place */
+	pos = lttv_traceset_context_position_new(self);
+	for(k = 0; k < nb_tracefiles; k++) {
+		LttvTracefileContextPosition *tfcp =
+				&g_array_index(pos->tfcp, LttvTracefileContextPosition, k);
+
+		stf = &tracefiles[k];
+		if(stf->found != found) {
+			stf->next = stf->last;
+			stf->next_time = stf->last_time;
+			stf->next_used = stf->last_used;
+		}
+		stf->tfc->timestamp = ltt_time_infinite;
+		tfcp->tfc = stf->tfc;
+		tfcp->used = stf->next_used;
+		if(stf->next_used) {
+			*tfcp->event = stf->next;
+			if(ltt_time_compare(stf->next_time, pos->timestamp) < 0)
+				pos->timestamp = stf->next_time;
+		}
+	}
+	retval = lttv_process_traceset_seek_position(self, pos);
+	g_assert_cmpint(retval, ==, 0);
+	lttv_traceset_context_position_destroy(pos);
+	g_free(tracefiles);
+
+	return found;
+}
+
+/* Seek back n events back from the current position.
+ *
+ * Parameters :
+ * @self          The trace set context
+ * @n             number of events to jump over
+ * @first_offset  The initial offset value used when events are searched by
+ *                time. never put first_offset at ltt_time_zero.
+ * @time_seeker   Function pointer of the function to use to seek time :
+ *                either lttv_process_traceset_seek_time
+ *                    or lttv_state_traceset_seek_time_closest
+ * @filter        The filter to call.
+ *
+ * Return value : the number of events found (might be lower than the number
+ * requested if beginning of traceset is reached).
+ *
+ * The tracefiles are read backward from the current position. When a filter
+ * reads the process state, the events are instead processed forward from
+ * first_offset before the current time, then twice that and so on (see
+ * seek_n_backward_by_time), time_seeker giving the state to start from.
+ *
+ * Note : the caller must make sure that the LttvTracesetContext does not
+ * contain any hook, as process_traceset_middle may be used in this routine.
+ */
+guint lttv_process_traceset_seek_n_backward(LttvTracesetContext *self,
+						guint n, LttTime first_offset,
+						seek_time_fct time_seeker,
+						check_handler *check,
+						gboolean *stop_flag,
+						LttvFilter *filter1,
+						LttvFilter *filter2,
+						LttvFilter *filter3,
+						gpointer data)
+{
+	if(lttv_traceset_number(self->ts) == 0) return 0;
+
+	if(filter_uses_state(filter1) || filter_uses_state(filter2)
+			|| filter_uses_state(filter3))
+		return seek_n_backward_by_time(self, n, first_offset, time_seeker,
+				check, stop_flag, filter1, filter2, filter3, data);
+	return seek_n_backward_reverse(self, n, check, stop_flag,
+			filter1, filter2, filter3, data);
+}
+
+
 struct seek_forward_data {
 	guint event_count;  /* event counter */
 	guint n;            /* requested number of events to jump over */
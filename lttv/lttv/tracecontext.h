@@ -79,6 +79,8 @@ typedef struct _LttvTracefileContextClass LttvTracefileContextClass;
 typedef struct _LttvTracesetContextPosition LttvTracesetContextPosition;
 typedef struct _LttvTraceContextPosition LttvTraceContextPosition;
 
+typedef struct _LttvTracefileQueue LttvTracefileQueue;
+
 #ifndef LTTVFILTER_TYPE_DEFINED
 typedef struct _LttvFilter LttvFilter;
 #define LTTVFILTER_TYPE_DEFINED
@@ -99,10 +101,23 @@ struct _LttvTracesetContext {
 	LttvAttribute *a;
 	LttvAttribute *ts_a;
 	TimeInterval time_span;
-	GTree *pqueue;
+	LttvTracefileQueue *pqueue;  /* tracefiles with an event ready, by time */
+	gboolean skip_unobserved;    /* Leave the tracefiles without any event hook
+	                                out of the merge, see
+	                                lttv_process_traceset_middle */
+	gboolean per_trace;          /* Process each trace in its own thread when
+	                                all the hooks allow it, see
+	                                lttv_process_traceset_middle */
+	gboolean cursors;            /* Read cursors of the tracefiles, so other
+	                                contexts can read the same traces in other
+	                                threads. Set before lttv_context_init */
 
 	LttvTracesetContextPosition *sync_position;   /* position at which to sync the
 	                                                 trace context */
+	LttTime follow_watermark;    /* the events earlier were processed, see
+	                                lttv_process_traceset_follow */
+	guint64 follow_dropped;      /* events which came later than the
+	                                watermark passed their time */
 };
 
 struct _LttvTracesetContextClass {
@@ -175,10 +190,15 @@ struct _LttvTracefileContext {
  // LttEvent *e;
 	LttvHooks *event;
 	LttvHooksById *event_by_id;
+	LttvHooksDispatch *event_dispatch;  /* event and event_by_id merged by id */
 	LttTime timestamp;
 	LttvAttribute *a;
 	gint target_pid;          /* Target PID of the event.
 				Updated by state.c. -1 means unset. */
+	guint queue_pos;          /* 1 + position in ts_context->pqueue,
+				0 when not queued */
+	LttEventBatch *batch;     /* Events of the current subbuffer, decoded in
+				bulk for the merge */
 };
 
 struct _LttvTracefileContextClass {
@@ -197,7 +217,21 @@ void lttv_process_traceset(LttvTracesetContext *self, LttTime end,
 /* Process traceset can also be done in smaller pieces calling begin,
  * then seek and middle repeatedly, and end. The middle function return the
  * number of events processed. It will be smaller than nb_events if the end time
- * or end position is reached. */
+ * or end position is reached.
+ *
+ * When skip_unobserved is set in the traceset context, middle removes from
+ * the merge the tracefiles for which no event hook is registered, instead of
+ * reading all their events. Such a tracefile stays at the position it had
+ * when it was left out until the next seek puts it back in the merge, so
+ * this is meant for analyses which do not change their hooks nor save
+ * positions while processing.
+ *
+ * When per_trace is set in the traceset context and the event hooks of all
+ * the tracefiles are declared per trace (see lttv_hooks_declare_per_trace),
+ * a middle without end position nor events count processes each trace in
+ * its own thread, merging only the tracefiles of that trace. The events of
+ * different traces are then not processed in time order, and a hook
+ * stopping the read only stops its own trace. */
 
 
 void lttv_process_traceset_begin(LttvTracesetContext *self,
@@ -213,6 +247,16 @@ guint lttv_process_traceset_middle(LttvTracesetContext *self,
 		gulong nb_events,
 		const LttvTracesetContextPosition *end_position);
 
+/* Follow mode, for traces still being written. Each call indexes the data
+ * appended to the tracefiles since the previous one, then processes, like
+ * middle, the events earlier than the watermark : the earliest time up to
+ * which the data of all the tracefiles is written. The tracefiles whose data
+ * lags more than latency behind the latest ones do not hold the watermark
+ * back : when their data comes, the events earlier than the watermark are
+ * dropped and counted in follow_dropped, so the order of the events processed
+ * is kept. Returns the number of events processed. */
+guint lttv_process_traceset_follow(LttvTracesetContext *self, LttTime latency);
+
 void lttv_process_traceset_end(LttvTracesetContext *self,
 		LttvHooks *after_traceset,
 		LttvHooks *after_trace,
@@ -352,6 +396,33 @@ lttv_traceset_context_position_get_time(const LttvTracesetContextPosition *pos);
 
 gint compare_tracefile(gconstpointer a, gconstpointer b);
 
+/* Merge queue of the tracefile contexts of a traceset, ordered like
+ * compare_tracefile. It is a 4-ary heap keyed on the timestamp in
+ * nanoseconds : the context with the earliest event is always at the top.
+ *
+ * A context must not have its timestamp changed while it is queued, except
+ * through lttv_tracefile_queue_update, which moves it back in place. When the
+ * context is the top, this is the "replace top" operation of the merge. */
+LttvTracefileQueue *lttv_tracefile_queue_new(void);
+
+void lttv_tracefile_queue_destroy(LttvTracefileQueue *q);
+
+void lttv_tracefile_queue_insert(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc);
+
+/* Does nothing if tfc is not queued */
+void lttv_tracefile_queue_remove(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc);
+
+/* Inserts tfc if it is not queued */
+void lttv_tracefile_queue_update(LttvTracefileQueue *q,
+		LttvTracefileContext *tfc);
+
+/* NULL when the queue is empty */
+LttvTracefileContext *lttv_tracefile_queue_top(LttvTracefileQueue *q);
+
+guint lttv_tracefile_queue_length(LttvTracefileQueue *q);
+
 
 /* Synchronisation helpers : save/restore synchronization between ltt traces and
  * a traceset context. */
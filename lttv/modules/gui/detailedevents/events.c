@@ -60,6 +60,7 @@
 #include <lttv/hook.h>
 #include <lttv/tracecontext.h>
 #include <lttv/state.h>
+#include <lttv/eventindex.h>
 #include <lttv/filter.h>
 #include <lttv/print.h>
 #include <lttvwindow/lttvwindow.h>
@@ -101,6 +102,9 @@ gboolean traceset_changed(void * hook_data, void * call_data);
 gboolean filter_changed(void * hook_data, void * call_data);
 
 static void request_background_data(EventViewerData *event_viewer_data);
+static void update_scroll_range(EventViewerData *event_viewer_data);
+static double position_scroll_value(EventViewerData *event_viewer_data,
+    const LttvTracesetContextPosition *pos);
 
 //! Event Viewer's constructor hook
 GtkWidget *h_gui_events(LttvPlugin *plugin);
@@ -182,7 +186,6 @@ h_gui_events(LttvPlugin *plugin)
 EventViewerData *
 gui_events(LttvPluginTab *ptab)
 {
-  LttTime end;
   GtkTreeViewColumn *column;
   GtkCellRenderer *renderer;
   EventViewerData* event_viewer_data = g_new(EventViewerData,1);
@@ -476,11 +479,8 @@ gui_events(LttvPluginTab *ptab)
 
   //get the life span of the traceset and set the upper of the scroll bar
   
-  TimeInterval time_span = tsc->time_span;
-  end = ltt_time_sub(time_span.end_time, time_span.start_time);
-
-  event_viewer_data->vadjust_c->upper =
-              ltt_time_to_double(end);
+  event_viewer_data->scroll_by_number = FALSE;
+  update_scroll_range(event_viewer_data);
 
   /* Set the Selected Event */
   //  tree_v_set_cursor(event_viewer_data);
@@ -516,8 +516,21 @@ static gint background_ready(void *hook_data, void *call_data)
   event_viewer_data->background_info_waiting--;
 
   if(event_viewer_data->background_info_waiting == 0) {
+    gboolean scroll_by_number = event_viewer_data->scroll_by_number;
+
     g_message("event viewer : background computation data ready.");
 
+    update_scroll_range(event_viewer_data);
+    if(event_viewer_data->scroll_by_number != scroll_by_number) {
+      /* The scrollbar values change unit : stay on the same events */
+      if(ltt_time_compare(lttv_traceset_context_position_get_time(
+              event_viewer_data->first_event), ltt_time_infinite) != 0)
+        event_viewer_data->previous_value = position_scroll_value(
+            event_viewer_data, event_viewer_data->first_event);
+      else
+        event_viewer_data->previous_value = 0.0;
+      event_viewer_data->vadjust_c->value = event_viewer_data->previous_value;
+    }
     evd_redraw_notify(event_viewer_data, NULL);
   }
 
@@ -525,6 +538,37 @@ static gint background_ready(void *hook_data, void *call_data)
 }
 
 
+/* Ask for the background computation of module on the trace, unless it is
+ * already in progress, and to be told when it is ready */
+static void request_background_module(EventViewerData *event_viewer_data,
+    LttvTrace *trace, const gchar *module, LttvHooks *background_ready_hook)
+{
+  if(lttvwindowtraces_get_in_progress(g_quark_from_string(module),
+                                      trace) == FALSE) {
+    /* We first remove requests that could have been done for the same
+     * information. Happens when two viewers ask for it before servicing
+     * starts.
+     */
+    if(!lttvwindowtraces_background_request_find(trace, module))
+      lttvwindowtraces_background_request_queue(
+          main_window_get_widget(event_viewer_data->tab), trace, module);
+    lttvwindowtraces_background_notify_queue(event_viewer_data,
+                                             trace,
+                                             ltt_time_infinite,
+                                             NULL,
+                                             background_ready_hook);
+    event_viewer_data->background_info_waiting++;
+  } else { /* in progress */
+
+    lttvwindowtraces_background_notify_current(event_viewer_data,
+                                               trace,
+                                               ltt_time_infinite,
+                                               NULL,
+                                               background_ready_hook);
+    event_viewer_data->background_info_waiting++;
+  }
+}
+
 static void request_background_data(EventViewerData *event_viewer_data)
 {
   LttvTracesetContext * tsc =
@@ -534,56 +578,114 @@ static void request_background_data(EventViewerData *event_viewer_data)
   LttvTrace *trace;
   LttvTraceState *tstate;
 
-  LttvHooks *background_ready_hook = 
+  LttvHooks *background_ready_hook =
     lttv_hooks_new();
   lttv_hooks_add(background_ready_hook, background_ready, event_viewer_data,
       LTTV_PRIO_DEFAULT);
   event_viewer_data->background_info_waiting = 0;
-  
+
   for(i=0;i<num_traces;i++) {
     trace = lttv_traceset_get(tsc->ts, i);
     tstate = LTTV_TRACE_STATE(tsc->traces[i]);
 
     if(lttvwindowtraces_get_ready(g_quark_from_string("state"),trace)==FALSE
         && !tstate->has_precomputed_states) {
-
-      if(lttvwindowtraces_get_in_progress(g_quark_from_string("state"),
-                                          trace) == FALSE) {
-        /* We first remove requests that could have been done for the same
-         * information. Happens when two viewers ask for it before servicing
-         * starts.
-         */
-        if(!lttvwindowtraces_background_request_find(trace, "state"))
-          lttvwindowtraces_background_request_queue(
-              main_window_get_widget(event_viewer_data->tab), trace, "state");
-        lttvwindowtraces_background_notify_queue(event_viewer_data,
-                                                 trace,
-                                                 ltt_time_infinite,
-                                                 NULL,
-                                                 background_ready_hook);
-        event_viewer_data->background_info_waiting++;
-      } else { /* in progress */
-      
-        lttvwindowtraces_background_notify_current(event_viewer_data,
-                                                   trace,
-                                                   ltt_time_infinite,
-                                                   NULL,
-                                                   background_ready_hook);
-        event_viewer_data->background_info_waiting++;
-      }
+      request_background_module(event_viewer_data, trace, "state",
+                                background_ready_hook);
     } else {
       /* Data ready. By its nature, this viewer doesn't need to have
        * its data ready hook called there, because a background
        * request is always linked with a redraw.
        */
     }
-    
+
+    /* The event index lets the scrollbar go by event number */
+    if(lttvwindowtraces_get_ready(g_quark_from_string("eventindex"),
+                                  trace)==FALSE
+        && lttv_event_index_get(tsc->traces[i]) == NULL)
+      request_background_module(event_viewer_data, trace, "eventindex",
+                                background_ready_hook);
   }
 
   lttv_hooks_destroy(background_ready_hook);
 
 }
 
+/* Set the scrollbar range : the event numbers when every trace has its event
+ * index, the time span of the traceset before */
+static void update_scroll_range(EventViewerData *event_viewer_data)
+{
+  LttvTracesetContext * tsc =
+        lttvwindow_get_traceset_context(event_viewer_data->tab);
+  guint64 count;
+  LttTime end;
+
+  event_viewer_data->scroll_by_number =
+    lttv_event_index_traceset_count(tsc, &count);
+  if(event_viewer_data->scroll_by_number)
+    event_viewer_data->vadjust_c->upper = (double)count;
+  else {
+    end = ltt_time_sub(tsc->time_span.end_time, tsc->time_span.start_time);
+    event_viewer_data->vadjust_c->upper = ltt_time_to_double(end);
+  }
+}
+
+/* Scrollbar value of a position. Moves the traceset when scrolling by
+ * event number. */
+static double position_scroll_value(EventViewerData *event_viewer_data,
+    const LttvTracesetContextPosition *pos)
+{
+  LttvTracesetContext * tsc =
+        lttvwindow_get_traceset_context(event_viewer_data->tab);
+  LttTime time = lttv_traceset_context_position_get_time(pos);
+  guint64 number;
+  int retval;
+
+  if(event_viewer_data->scroll_by_number) {
+    if(ltt_time_compare(time, ltt_time_infinite) == 0) {
+      lttv_event_index_traceset_count(tsc, &number);
+      return (double)number;
+    }
+    retval= lttv_process_traceset_seek_position(tsc, pos);
+    g_assert_cmpint(retval, ==, 0);
+    lttv_event_index_get_number(tsc, &number);
+    return (double)number;
+  }
+  time = ltt_time_sub(time, tsc->time_span.start_time);
+  return ltt_time_to_double(time);
+}
+
+/* Seek the traceset, with its state, to a scrollbar value. Returns the value
+ * of the position reached. */
+static double seek_scroll_value(EventViewerData *event_viewer_data,
+    double value)
+{
+  LttvTracesetContext * tsc =
+        lttvwindow_get_traceset_context(event_viewer_data->tab);
+  LttvTracesetContextPosition *pos;
+  LttTime time;
+
+  if(event_viewer_data->scroll_by_number) {
+    pos = lttv_traceset_context_position_new(tsc);
+    lttv_event_index_seek_number(tsc, (guint64)value);
+    lttv_traceset_context_position_save(tsc, pos);
+    time = lttv_traceset_context_position_get_time(pos);
+    if(ltt_time_compare(time, ltt_time_infinite) != 0) {
+      /* Compute the state from the closest checkpoint */
+      lttv_state_traceset_seek_time_closest((LttvTracesetState*)tsc, time);
+      lttv_process_traceset_middle(tsc, ltt_time_infinite, G_MAXUINT, pos);
+    }
+    lttv_traceset_context_position_destroy(pos);
+    return floor(value);
+  }
+
+  time = ltt_time_add(tsc->time_span.start_time,
+                      ltt_time_from_double(value));
+  lttv_state_traceset_seek_time_closest((LttvTracesetState*)tsc, time);
+  lttv_process_traceset_middle(tsc, time, G_MAXUINT, NULL);
+  return value;
+}
+
 static gboolean
 header_size_allocate(GtkWidget *widget,
                         GtkAllocation *allocation,
@@ -1372,8 +1474,7 @@ static void get_events(double new_value, EventViewerData *event_viewer_data)
     break;
   }
 
-  LttTime time = ltt_time_from_double(new_value);
-  time = ltt_time_add(tsc->time_span.start_time, time);
+  LttTime time;
 
   if(!seek_by_time) {
   
@@ -1403,11 +1504,8 @@ static void get_events(double new_value, EventViewerData *event_viewer_data)
 		g_assert_cmpint(retval, ==, 0);
       }
     } else {
-      /* There is nothing in the list : simply seek to the time value. */
-      lttv_state_traceset_seek_time_closest((LttvTracesetState*)tsc,
-          time);
-      lttv_process_traceset_middle(tsc, time, G_MAXUINT,
-                                   NULL);
+      /* There is nothing in the list : simply seek to the scrollbar value. */
+      seek_scroll_value(event_viewer_data, new_value);
     }
     
   /* Note that, as we mess with the tsc position, this function CANNOT be called
@@ -1452,28 +1550,22 @@ static void get_events(double new_value, EventViewerData *event_viewer_data)
     /* Save the first event position */
     lttv_traceset_context_position_save(tsc, event_viewer_data->first_event);
     
+    event_viewer_data->previous_value = position_scroll_value(
+        event_viewer_data, event_viewer_data->first_event);
+
     time = lttv_traceset_context_position_get_time(
                                             event_viewer_data->first_event);
     //if(ltt_time_compare(time, tsc->time_span.end_time) > 0)
     //  time = tsc->time_span.end_time;
 
-    LttTime time_val = ltt_time_sub(time,
-                        tsc->time_span.start_time);
-    event_viewer_data->previous_value = ltt_time_to_double(time_val);
-    
     lttv_state_traceset_seek_time_closest((LttvTracesetState*)tsc, time);
     lttv_process_traceset_middle(tsc, ltt_time_infinite, G_MAXUINT,
                                  event_viewer_data->first_event);
 
   } else {
-    /* Seek by time */
-    lttv_state_traceset_seek_time_closest((LttvTracesetState*)tsc,
-          time);
-    lttv_process_traceset_middle(tsc, time, G_MAXUINT,
-                                 NULL);
-    LttTime time_val = ltt_time_sub(time,
-                        tsc->time_span.start_time);
-    event_viewer_data->previous_value = ltt_time_to_double(time_val);
+    /* Seek by time, or by event number */
+    event_viewer_data->previous_value =
+      seek_scroll_value(event_viewer_data, new_value);
     lttv_traceset_context_position_save(tsc, event_viewer_data->first_event);
   }
  
@@ -1720,13 +1812,8 @@ gboolean update_current_time(void * hook_data, void * call_data)
         event_viewer_data->current_time_get_first);
     lttv_traceset_context_position_destroy(
         event_viewer_data->current_time_get_first);
-    pos_time = lttv_traceset_context_position_get_time(
-        event_viewer_data->currently_selected_position);
   }
 
-  LttTime time = ltt_time_sub(pos_time, tsc->time_span.start_time);
-  double new_value = ltt_time_to_double(time);
- 
   event_viewer_data->report_position = FALSE;
   /* Change the viewed area if does not match */
   if(lttv_traceset_context_pos_pos_compare(
@@ -1736,6 +1823,8 @@ gboolean update_current_time(void * hook_data, void * call_data)
      lttv_traceset_context_pos_pos_compare(
         event_viewer_data->currently_selected_position,
         event_viewer_data->last_event) > 0) {
+    double new_value = position_scroll_value(event_viewer_data,
+        event_viewer_data->currently_selected_position);
     gtk_adjustment_set_value(event_viewer_data->vadjust_c, new_value);
   } else {
     /* Simply update the current time : it is in the list */
@@ -1768,9 +1857,7 @@ gboolean update_current_position(void * hook_data, void * call_data)
        lttv_traceset_context_pos_pos_compare(
           event_viewer_data->currently_selected_position,
           event_viewer_data->last_event) > 0) {
-      LttTime time = lttv_traceset_context_position_get_time(current_pos);
-      time = ltt_time_sub(time, tsc->time_span.start_time);
-      double new_value = ltt_time_to_double(time);
+      double new_value = position_scroll_value(event_viewer_data, current_pos);
       gtk_adjustment_set_value(event_viewer_data->vadjust_c, new_value);
     } else {
       /* Simply update the current time : it is in the list */
@@ -1790,14 +1877,11 @@ gboolean traceset_changed(void * hook_data, void * call_data)
   EventViewerData *event_viewer_data = (EventViewerData*) hook_data;
   LttvTracesetContext * tsc =
         lttvwindow_get_traceset_context(event_viewer_data->tab);
-  TimeInterval time_span = tsc->time_span;
- 
-  LttTime end;
+
   gtk_list_store_clear(event_viewer_data->store_m);
   g_ptr_array_set_size(event_viewer_data->pos, 0);
 
-  end = ltt_time_sub(time_span.end_time, time_span.start_time);
-  event_viewer_data->vadjust_c->upper = ltt_time_to_double(end);
+  update_scroll_range(event_viewer_data);
 
   /* Reset the positions */
   lttv_traceset_context_position_destroy(
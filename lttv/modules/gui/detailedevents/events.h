@@ -17,6 +17,9 @@ struct _EventViewerData {
    * the number of events shown on the screen) instead of changing begin time.
    */
   double       previous_value;
+  gboolean     scroll_by_number; /* The scrollbar values are event numbers,
+                                   once every trace has its event index, else
+                                   times from the traceset start */
 
   //scroll window containing Tree View
   GtkWidget * scroll_win;
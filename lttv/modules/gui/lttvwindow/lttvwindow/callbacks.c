@@ -393,8 +393,11 @@ static void connect_focus_recursive(GtkWidget *widget,
 /* Stop all the processings and call gtk_main_quit() */
 static void mainwindow_quit()
 {
+  lttvwindowtraces_unregister_requests(g_quark_from_string("eventindex"));
   lttvwindowtraces_unregister_requests(g_quark_from_string("stats"));
   lttvwindowtraces_unregister_requests(g_quark_from_string("state"));
+  lttvwindowtraces_unregister_computation_hooks(
+      g_quark_from_string("eventindex"));
   lttvwindowtraces_unregister_computation_hooks(g_quark_from_string("stats"));
   lttvwindowtraces_unregister_computation_hooks(g_quark_from_string("state"));
 
@@ -37,6 +37,7 @@
 #include <lttv/tracecontext.h>
 #include <lttv/state.h>
 #include <lttv/stats.h>
+#include <lttv/eventindex.h>
 #include <lttvwindow/menu.h>
 #include <lttvwindow/toolbar.h>
 #include <lttvwindow/lttvwindowtraces.h>
@@ -199,6 +200,20 @@ static void init() {
         hook_adder, hook_remover);
   }
 
+  {
+    /* Register event index builder */
+    LttvHooks *hook_adder = lttv_hooks_new();
+    lttv_hooks_add(hook_adder, lttv_event_index_hook_add_event_hooks, NULL,
+                   LTTV_PRIO_DEFAULT);
+    LttvHooks *hook_remover = lttv_hooks_new();
+    lttv_hooks_add(hook_remover, lttv_event_index_hook_remove_event_hooks,
+                                    NULL, LTTV_PRIO_DEFAULT);
+    lttvwindowtraces_register_computation_hooks(
+        g_quark_from_string("eventindex"),
+        NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+        hook_adder, hook_remover);
+  }
+
   {
     /* Register statistics calculator */
     LttvHooks *hook_adder = lttv_hooks_new();
@@ -259,4 +274,4 @@ static void destroy() {
 
 LTTV_MODULE("lttvwindow", "Viewer main window", \
     "Viewer with multiple windows, tabs and panes for graphical modules", \
-	    init, destroy, "stats", "option", "sync")
+	    init, destroy, "stats", "eventindex", "option", "sync")
@@ -24,6 +24,7 @@
 #endif
 
 #include <glib.h>
+#include <pthread.h>
 #include <lttv/lttv.h>
 #include <lttv/attribute.h>
 #include <lttv/hook.h>
@@ -52,6 +53,27 @@ static char *a_trace;
 
 static gboolean a_stats;
 
+static int a_parallel;
+
+static int a_follow;
+
+static int a_follow_latency;
+
+/* Interval between two looks at the size of the tracefiles followed, in us */
+#define FOLLOW_POLL_INTERVAL 100000
+
+/* A time slice of the traceset, whose statistics are computed by its own
+ * thread on a context reading cursors of the tracefiles */
+struct stats_slice {
+  LttvTraceset *ts;
+  LttvTracesetStats *tscs;
+  LttvTracesetState *checkpoints;  /* Context whose traces hold the states
+                                      saved over the whole traceset */
+  LttTime start, end;
+  gboolean first, last;
+  pthread_t thread;
+};
+
 void lttv_trace_option(void *hook_data)
 { 
   LttTrace *trace;
@@ -62,6 +84,142 @@ void lttv_trace_option(void *hook_data)
 }
 
 
+/* Traceset of the traces of ts, with attributes of its own. The contexts on
+ * it read cursors of the tracefiles : the traces, with the clock corrections
+ * of the synchronization, are shared. */
+static LttvTraceset *slice_traceset(LttvTraceset *ts)
+{
+  LttvTraceset *copy;
+
+  guint i, nb_trace;
+
+  copy = lttv_traceset_new();
+  nb_trace = lttv_traceset_number(ts);
+  for(i = 0 ; i < nb_trace ; i++)
+    lttv_traceset_add(copy, lttv_trace_new(lttv_trace(lttv_traceset_get(ts,
+        i))));
+  return copy;
+}
+
+
+/* Restore the nearest state saved before the slice, compute the state up to
+ * its start, then the statistics up to its end */
+static void *process_slice(void *arg)
+{
+  struct stats_slice *slice = (struct stats_slice *)arg;
+
+  LttvTracesetContext *tc = &slice->tscs->parent.parent;
+
+  LttvTraceState *tcs;
+
+  LttvAttribute *saved_state;
+
+  guint i, nb_trace;
+
+  nb_trace = lttv_traceset_number(slice->ts);
+  for(i = 0 ; i < nb_trace ; i++) {
+    tcs = (LttvTraceState *)tc->traces[i];
+    saved_state = NULL;
+    if(!slice->first)
+      saved_state = lttv_state_find_saved_state(
+          (LttvTraceState *)slice->checkpoints->parent.traces[i], slice->start);
+    if(saved_state != NULL)
+      lttv_state_restore(tcs, saved_state);
+    else
+      lttv_process_trace_seek_time(&tcs->parent, ltt_time_zero);
+  }
+
+  if(!slice->first) {
+    lttv_process_traceset_middle(tc, slice->start, G_MAXULONG, NULL);
+    lttv_stats_slice_begin(slice->tscs, slice->start);
+  }
+  lttv_stats_add_event_hooks(slice->tscs);
+  lttv_process_traceset_middle(tc, slice->end, G_MAXULONG, NULL);
+  lttv_stats_slice_end(slice->tscs,
+      slice->last ? ltt_time_infinite : slice->end);
+  return NULL;
+}
+
+
+/* Compute the statistics of tscs in a_parallel time slices processed at once,
+ * from the states saved while tscs was processed, and add them to tscs */
+static void process_slices(LttvTracesetStats *tscs, LttTime end)
+{
+  LttvTracesetContext *tc = &tscs->parent.parent;
+
+  struct stats_slice *slices;
+
+  LttTime slice_length;
+
+  guint i;
+
+  slices = g_new(struct stats_slice, a_parallel);
+  slice_length = ltt_time_div(ltt_time_sub(tc->time_span.end_time,
+      tc->time_span.start_time), a_parallel);
+
+  /* The contexts are created and destroyed by this thread, only the
+   * processing is done by the slice threads */
+  for(i = 0 ; i < a_parallel ; i++) {
+    slices[i].ts = slice_traceset(tc->ts);
+    slices[i].tscs = g_object_new(LTTV_TRACESET_STATS_TYPE, NULL);
+    slices[i].checkpoints = &tscs->parent;
+    slices[i].first = i == 0;
+    slices[i].last = i == a_parallel - 1;
+    slices[i].start = i == 0 ? ltt_time_zero : slices[i - 1].end;
+    slices[i].end = slices[i].last ? end : ltt_time_add(
+        tc->time_span.start_time, ltt_time_mul(slice_length, i + 1));
+    slices[i].tscs->parent.parent.cursors = TRUE;
+    lttv_context_init(&slices[i].tscs->parent.parent, slices[i].ts);
+    slices[i].tscs->parent.parent.per_trace = TRUE;
+    lttv_state_add_event_hooks(&slices[i].tscs->parent);
+  }
+
+  for(i = 0 ; i < a_parallel ; i++) {
+    if(pthread_create(&slices[i].thread, NULL, process_slice, &slices[i]))
+      g_error("cannot create the thread of time slice %u", i);
+  }
+
+  for(i = 0 ; i < a_parallel ; i++) {
+    pthread_join(slices[i].thread, NULL);
+    lttv_stats_merge(tscs, slices[i].tscs);
+
+    lttv_state_remove_event_hooks(&slices[i].tscs->parent);
+    lttv_stats_remove_event_hooks(slices[i].tscs);
+    lttv_context_fini(&slices[i].tscs->parent.parent);
+    g_object_unref(slices[i].tscs);
+    lttv_traceset_destroy(slices[i].ts);
+  }
+  g_free(slices);
+}
+
+
+/* Process the traces while they are written, until no event came for
+ * a_follow seconds */
+static void process_follow(LttvTracesetContext *tc)
+{
+  LttTime latency;
+
+  guint idle = 0;
+
+  latency = ltt_time_from_double(a_follow_latency / 1000.0);
+  while((guint64)idle * FOLLOW_POLL_INTERVAL
+      < (guint64)a_follow * G_USEC_PER_SEC) {
+    if(lttv_process_traceset_follow(tc, latency) > 0)
+      idle = 0;
+    else {
+      idle++;
+      g_usleep(FOLLOW_POLL_INTERVAL);
+    }
+  }
+
+  /* The events held back for the tracefiles which did not go on */
+  lttv_process_traceset_middle(tc, ltt_time_infinite, G_MAXULONG, NULL);
+  if(tc->follow_dropped > 0)
+    g_warning("%" G_GUINT64_FORMAT " events came more than the follow latency "
+        "late and were dropped", tc->follow_dropped);
+}
+
+
 static gboolean process_traceset(void *hook_data, void *call_data)
 {
   LttvAttributeValue value_expression, value_filter;
@@ -77,6 +235,10 @@ static gboolean process_traceset(void *hook_data, void *call_data)
   LttTime start, end;
   gboolean retval;
 
+  /* The statistics are computed by slices, the traceset itself is only
+   * processed to save the state periodically */
+  gboolean parallel = a_stats && a_parallel > 1 && a_follow <= 0;
+
   g_info("BatchAnalysis begin process traceset");
 
   if (a_stats) {
@@ -94,7 +256,7 @@ static gboolean process_traceset(void *hook_data, void *call_data)
   syncTraceset(tc);
 
   lttv_state_add_event_hooks(tc);
-  if(a_stats) lttv_stats_add_event_hooks(tscs);
+  if(a_stats && !parallel) lttv_stats_add_event_hooks(tscs);
 
   retval= lttv_iattribute_find_by_path(attributes, "filter/expression",
     LTTV_POINTER, &value_expression);
@@ -133,11 +295,27 @@ static gboolean process_traceset(void *hook_data, void *call_data)
 
   g_info("BatchAnalysis process traceset");
 
+  /* Hooks do not change during the analysis : tracefiles no hook observes
+   * need not be read. The saved states must hold the position of all the
+   * tracefiles however. */
+  tc->skip_unobserved = !parallel;
+  /* Without hooks correlating events across traces, each trace is processed
+   * on its own thread */
+  tc->per_trace = TRUE;
   lttv_process_traceset_seek_time(tc, start);
-  lttv_process_traceset_middle(tc,
-                               end,
-                               G_MAXULONG,
-                               NULL);
+  if(parallel) lttv_state_save_add_event_hooks(tss);
+  if(a_follow > 0)
+    process_follow(tc);
+  else
+    lttv_process_traceset_middle(tc,
+                                 end,
+                                 G_MAXULONG,
+                                 NULL);
+  if(parallel) {
+    lttv_state_save_remove_event_hooks(tss);
+    g_info("BatchAnalysis process %d time slices", a_parallel);
+    process_slices(tscs, end);
+  }
 
 
   //lttv_traceset_context_remove_hooks(tc,
@@ -154,7 +332,7 @@ static gboolean process_traceset(void *hook_data, void *call_data)
 
   lttv_filter_destroy(*(value_filter.v_pointer));
   lttv_state_remove_event_hooks(tss);
-  if(a_stats) lttv_stats_remove_event_hooks(tscs);
+  if(a_stats && !parallel) lttv_stats_remove_event_hooks(tscs);
   lttv_context_fini(tc);
   if (a_stats)
     g_object_unref(tscs);
@@ -186,6 +364,24 @@ static void init()
       "", 
       LTTV_OPT_NONE, &a_stats, NULL, NULL);
 
+  a_parallel = 0;
+  lttv_option_add("parallel", ' ',
+      "compute the statistics by this many time slices processed at once",
+      "number of time slices",
+      LTTV_OPT_INT, &a_parallel, NULL, NULL);
+
+  a_follow = 0;
+  lttv_option_add("follow", ' ',
+      "process the traces while they are written, until they stop growing",
+      "seconds without new events before the end",
+      LTTV_OPT_INT, &a_follow, NULL, NULL);
+
+  a_follow_latency = 1000;
+  lttv_option_add("follow-latency", ' ',
+      "longest delay of the events of a tracefile not waited for when following",
+      "milliseconds",
+      LTTV_OPT_INT, &a_follow_latency, NULL, NULL);
+
 
   traceset = lttv_traceset_new();
 
@@ -251,6 +447,9 @@ static void destroy()
 
   lttv_option_remove("trace");
   lttv_option_remove("stats");
+  lttv_option_remove("parallel");
+  lttv_option_remove("follow");
+  lttv_option_remove("follow-latency");
 
   lttv_hooks_destroy(before_traceset);
   lttv_hooks_destroy(after_traceset);
@@ -48,7 +48,8 @@ static gboolean
 
 static char
   *a_file_name = NULL,
-  *a_quark_file_name = NULL;
+  *a_quark_file_name = NULL,
+  *a_checkpoint_file_name = NULL;
 
 static LttvHooks
   *before_traceset,
@@ -66,6 +67,8 @@ static FILE *a_file;
 
 static GString *a_string;
 
+static LttvStateCheckpointWriter *a_checkpoint_writer;
+
 static gboolean write_traceset_header(void *hook_data, void *call_data)
 {
   LttvTracesetContext *tc = (LttvTracesetContext *)call_data;
@@ -85,6 +88,10 @@ static gboolean write_traceset_header(void *hook_data, void *call_data)
         lttv_traceset_number(tc->ts));
   }
 
+  /* The checkpoint file is for one trace */
+  g_assert(a_checkpoint_file_name == NULL
+      || lttv_traceset_number(tc->ts) == 1);
+
   return FALSE;
 }
 
@@ -143,6 +150,13 @@ static gboolean write_trace_header(void *hook_data, void *call_data)
     fprintf(a_file,"<TRACE TRACE_NUMBER=%d/>\n", 
         tc->index);
   }
+
+  if(a_checkpoint_file_name != NULL) {
+    a_checkpoint_writer = lttv_state_checkpoint_writer_new(
+        (LttvTraceState *)tc, a_checkpoint_file_name);
+    if(a_checkpoint_writer == NULL)
+      g_error("cannot open file %s", a_checkpoint_file_name);
+  }
   
   return FALSE;
 }
@@ -157,6 +171,12 @@ static gboolean write_trace_footer(void *hook_data, void *call_data)
     fprintf(a_file,"</TRACE>\n");
   }
 
+  if(a_checkpoint_writer != NULL) {
+    if(!lttv_state_checkpoint_writer_close(a_checkpoint_writer))
+      g_error("cannot write file %s", a_checkpoint_file_name);
+    a_checkpoint_writer = NULL;
+  }
+
   return FALSE;
 }
 
@@ -192,6 +212,10 @@ static int for_each_event(void *hook_data, void *call_data)
   } else {
     lttv_state_write(ts, tfs->parent.timestamp, a_file);
   }
+
+  if(a_checkpoint_writer != NULL)
+    lttv_state_checkpoint_write(a_checkpoint_writer, ts,
+        tfs->parent.timestamp);
   
   return FALSE;
 }
@@ -220,6 +244,13 @@ static void init()
       "file name", 
       LTTV_OPT_STRING, &a_quark_file_name, NULL, NULL);
 
+  a_checkpoint_file_name = NULL;
+  lttv_option_add("checkpoints", 'C', 
+      "checkpoint file where the saved states are to be written, read from "
+      "the trace directory as " LTTV_STATE_CHECKPOINT_FILE, 
+      "file name", 
+      LTTV_OPT_STRING, &a_checkpoint_file_name, NULL, NULL);
+
   lttv_option_add("raw", 'r', 
       "Output in raw binary",
       "Raw binary", 
@@ -266,6 +297,8 @@ static void destroy()
 
   lttv_option_remove("qoutput");
 
+  lttv_option_remove("checkpoints");
+
   lttv_option_remove("raw");
 
   g_string_free(a_string, TRUE);